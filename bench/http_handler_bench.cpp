@@ -0,0 +1,50 @@
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "http_handler.h"
+#include "id_generator.h"
+
+namespace {
+
+void BM_GenerateResponseDump(benchmark::State& state) {
+    const std::string id = "20250808_120000_123_000_00001";
+    for (auto _ : state) {
+        std::string body = FileRequestHandler::GenerateResponse(42, id, Status::Ok, "BUFFERED").dump();
+        benchmark::DoNotOptimize(body.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GenerateResponseDump);
+
+void BM_ParseQuery(benchmark::State& state) {
+    std::string uri = "/state?num=12345";
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(FileRequestHandler::ParseQuery(uri));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ParseQuery);
+
+void BM_ParseLogId(benchmark::State& state) {
+    const std::string uri = "/getlog?id=20250808_120000_123_000_00001";
+    for (auto _ : state) {
+        std::string id = FileRequestHandler::ParseLogId(uri);
+        benchmark::DoNotOptimize(id.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ParseLogId);
+
+// Job IDs of concurrent /start requests.
+void BM_IdGeneratorNext(benchmark::State& state) {
+    static IdGenerator ids;
+    for (auto _ : state) {
+        IdGenerator::Id id = ids.Next();
+        benchmark::DoNotOptimize(id.data);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_IdGeneratorNext)->ThreadRange(1, 8);
+
+}  // namespace
@@ -0,0 +1,60 @@
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <ostream>
+#include <string>
+
+#include "logger.h"
+
+namespace {
+
+// Records still go to a file; the console stream discards everything so the benchmark output stays readable.
+std::ostream& NullStream() {
+    static std::ostream stream(nullptr);
+    return stream;
+}
+
+std::string LogFile() {
+    return (std::filesystem::temp_directory_path() / "nats-connector-bench.log").string();
+}
+
+// A statement below the runtime threshold: one comparison, operands never evaluated.
+void BM_LogDisabled(benchmark::State& state) {
+    logger::SetLevel(logger::Level::Info);
+    const std::string id = "20250808_120000_123_000_00001";
+    for (auto _ : state) {
+        LOG_DEBUG() << "Received State request with ID=" << id << " (query=" << 42 << ")" << std::endl;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LogDisabled);
+
+// Synchronous backend: the calling thread formats and writes every record itself.
+void BM_LogSync(benchmark::State& state) {
+    const std::string file = LogFile();
+    const std::string id = "20250808_120000_123_000_00001";
+    for (auto _ : state) {
+        logger::LogStream(file, NullStream()) << "Received State request with ID=" << id << " (query=" << 42 << ")"
+                                              << std::endl;
+    }
+    state.SetItemsProcessed(state.iterations());
+    std::filesystem::remove(file);
+}
+BENCHMARK(BM_LogSync);
+
+// Asynchronous backend: formatting on the calling thread, writing batched on the writer thread.
+void BM_LogAsync(benchmark::State& state) {
+    const std::string file = LogFile();
+    const std::string id = "20250808_120000_123_000_00001";
+    logger::StartAsync();
+    for (auto _ : state) {
+        logger::LogStream(file, NullStream()) << "Received State request with ID=" << id << " (query=" << 42 << ")"
+                                              << std::endl;
+    }
+    logger::StopAsync();
+    state.SetItemsProcessed(state.iterations());
+    std::filesystem::remove(file);
+}
+BENCHMARK(BM_LogAsync);
+
+}  // namespace
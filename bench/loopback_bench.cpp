@@ -0,0 +1,47 @@
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <string>
+
+#include "logger.h"
+#include "loopback_transport.h"
+
+// Messaging paths of the request handlers on the in-process transport: what the connector's own code costs
+// per message once the network and nats-server are out of the picture.
+namespace {
+
+const std::string kStateReply =
+    R"({"state":{"globalID":"20250808_120000_000_000_00001","status":1,"desc":"DONE","solnumbs":2,"time":1500}})";
+
+// Fan-out of one publish to `Arg` wildcard subscriptions.
+void BM_LoopbackPublish(benchmark::State& state) {
+    logger::SetLevel(logger::Level::Warn);
+    LoopbackTransport transport;
+    int64_t received = 0;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        transport.SubscribeRaw("IsMathAlive.*", [&received](NatsMessage&) { ++received; });
+    }
+    const nlohmann::json heartbeat = {{"event", "alive"}};
+    for (auto _ : state) {
+        transport.Publish("IsMathAlive.core", heartbeat);
+    }
+    state.SetItemsProcessed(received);
+}
+BENCHMARK(BM_LoopbackPublish)->Arg(1)->Arg(8);
+
+// A /state round trip without HTTP: request, responder, reply routing and JSON decode of the answer.
+void BM_LoopbackRequestReply(benchmark::State& state) {
+    logger::SetLevel(logger::Level::Warn);
+    LoopbackTransport transport;
+    transport.SubscribeRaw("State.Request.*",
+                           [&transport](NatsMessage& request) { transport.Respond(request, kStateReply); });
+    const auto deadline = Transport::Clock::now() + std::chrono::hours(1);
+    for (auto _ : state) {
+        transport.AsyncRequest("State.Request.20250808_120000_000_000_00001", {}, deadline, "mathcore",
+                               [](NatsReply&& reply) { benchmark::DoNotOptimize(reply.message->Json()); });
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LoopbackRequestReply);
+
+}  // namespace
@@ -0,0 +1,123 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "logger.h"
+#include "nats_manager.h"
+
+// Publishing and subscription benchmarks need a NATS server on localhost:4222 and are skipped without one.
+namespace {
+
+const char* const kServerUrl = "nats://localhost:4222";
+
+nlohmann::json StateMessage() {
+    return {{"query", 42},
+            {"globalID", "20250808_120000_123_000_00001"},
+            {"status", 1},
+            {"desc", "CALCULATING"},
+            {"solnumbs", 1250},
+            {"time", 37}};
+}
+
+bool ConnectOrSkip(NatsManager& nats, benchmark::State& state) {
+    logger::SetLevel(logger::Level::Warn);
+    if (!nats.Connect(kServerUrl)) {
+        state.SkipWithError("NATS server not reachable on localhost:4222");
+        return false;
+    }
+    return true;
+}
+
+// What Callback() does with every received message: wrap the natsMsg and decode its payload.
+// Arg: 0 - JSON, 1 - MessagePack, 2 - CBOR.
+void BM_NatsMessageDecode(benchmark::State& state) {
+    const WireEncoding encoding = static_cast<WireEncoding>(state.range(0));
+    std::string payload;
+    const char* content_type = nullptr;
+    switch (encoding) {
+        case WireEncoding::MsgPack:
+            nlohmann::json::to_msgpack(StateMessage(), payload);
+            content_type = "application/msgpack";
+            break;
+        case WireEncoding::Cbor:
+            nlohmann::json::to_cbor(StateMessage(), payload);
+            content_type = "application/cbor";
+            break;
+        default: payload = StateMessage().dump(); break;
+    }
+
+    for (auto _ : state) {
+        natsMsg* msg = nullptr;
+        natsMsg_Create(&msg, "State.Response", nullptr, payload.data(), static_cast<int>(payload.size()));
+        if (content_type) {
+            natsMsgHeader_Set(msg, NatsManager::kContentTypeHeader, content_type);
+        }
+        NatsMessage message(msg);
+        benchmark::DoNotOptimize(message.Json());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NatsMessageDecode)->Arg(0)->Arg(1)->Arg(2);
+
+void BM_Publish(benchmark::State& state) {
+    NatsManager nats;
+    if (!ConnectOrSkip(nats, state)) {
+        return;
+    }
+    const nlohmann::json message = StateMessage();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(nats.Publish("Bench.Publish", message));
+    }
+    natsConnection_Flush(nats.get_connection());
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Publish);
+
+void BM_PublishRaw(benchmark::State& state) {
+    NatsManager nats;
+    if (!ConnectOrSkip(nats, state)) {
+        return;
+    }
+    const std::string payload = StateMessage().dump();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(nats.PublishRaw("Bench.Publish", payload));
+    }
+    natsConnection_Flush(nats.get_connection());
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PublishRaw);
+
+// Publish -> server -> Subscribe() callback with JSON parsing, until every message has been handled.
+void BM_SubscribeDelivery(benchmark::State& state) {
+    NatsManager nats;
+    if (!ConnectOrSkip(nats, state)) {
+        return;
+    }
+    std::atomic<int64_t> received{0};
+    nats.Subscribe("Bench.Delivery", [&received](const std::string&, const nlohmann::json& message) {
+        benchmark::DoNotOptimize(message.size());
+        received.fetch_add(1, std::memory_order_relaxed);
+    });
+    natsConnection_Flush(nats.get_connection());
+
+    const nlohmann::json message = StateMessage();
+    for (auto _ : state) {
+        nats.Publish("Bench.Delivery", message);
+    }
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (received.load(std::memory_order_relaxed) < state.iterations() &&
+           std::chrono::steady_clock::now() < give_up) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    if (received.load(std::memory_order_relaxed) < state.iterations()) {
+        state.SkipWithError("messages were lost (slow consumer?)");
+    }
+    nats.Unsubscribe("Bench.Delivery");
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SubscribeDelivery)->UseRealTime();
+
+}  // namespace
@@ -0,0 +1,95 @@
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "logger.h"
+#include "nlohmann/json.hpp"
+#include "query_journal.h"
+#include "query_registry.h"
+
+// Cost of the persisted id -> query table at realistic sizes (Arg: pairs already stored).
+namespace {
+
+std::filesystem::path BenchDir() {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "nats-connector-bench";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    return dir;
+}
+
+// Snapshot holding `pairs` queries, as written by compaction.
+QueryJournalOptions WriteSnapshot(const std::filesystem::path& dir, int64_t pairs) {
+    nlohmann::json snapshot = nlohmann::json::array();
+    for (int64_t i = 1; i <= pairs; ++i) {
+        snapshot.push_back({{"id", "20250808_120000_000_000_" + std::to_string(i)}, {"query", i}});
+    }
+    QueryJournalOptions options;
+    options.snapshot_path = (dir / "query_state.json").string();
+    options.sync = false;  // measure our code, not the disk
+    std::ofstream(options.snapshot_path) << snapshot.dump();
+    return options;
+}
+
+// Startup: load the snapshot and replay the journal.
+void BM_QueryJournalOpen(benchmark::State& state) {
+    logger::SetLevel(logger::Level::Warn);
+    const std::filesystem::path dir = BenchDir();
+    const QueryJournalOptions options = WriteSnapshot(dir, state.range(0));
+    for (auto _ : state) {
+        QueryJournal journal(options);
+        benchmark::DoNotOptimize(journal.Open().size());
+    }
+    std::filesystem::remove_all(dir);
+}
+BENCHMARK(BM_QueryJournalOpen)->Arg(1000)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// /start and the /state that completes it: two journal commits, plus the snapshot rewrites they trigger
+// every `compact_after` records.
+void BM_QueryRegistryRegister(benchmark::State& state) {
+    logger::SetLevel(logger::Level::Warn);
+    const std::filesystem::path dir = BenchDir();
+    QueryJournal journal(WriteSnapshot(dir, state.range(0)));
+    QueryRegistry queries;
+    queries.Open(journal);
+
+    int64_t next = 0;
+    for (auto _ : state) {
+        const std::string id = "bench_" + std::to_string(next++);
+        benchmark::DoNotOptimize(queries.Register(id));
+        queries.Complete(id);
+    }
+    queries.Close();
+    state.SetItemsProcessed(state.iterations());
+    std::filesystem::remove_all(dir);
+}
+BENCHMARK(BM_QueryRegistryRegister)->Arg(1000)->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+// /state lookups from concurrent HTTP workers, all reading one registry (ThreadRange measures the contention).
+std::unique_ptr<QueryRegistry> g_find_id_queries;
+
+void BM_QueryRegistryFindId(benchmark::State& state) {
+    // Threads wait for each other at the start of the loop, so the registry is filled before anyone reads it.
+    if (state.thread_index() == 0) {
+        g_find_id_queries = std::make_unique<QueryRegistry>();
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            g_find_id_queries->Register("20250808_120000_000_000_" + std::to_string(i));
+        }
+    }
+    const int pairs = static_cast<int>(state.range(0));
+    int query = state.thread_index() * pairs / state.threads() + 1;
+    for (auto _ : state) {
+        std::string id = g_find_id_queries->FindId(query);
+        benchmark::DoNotOptimize(id.data());
+        query = query % pairs + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        g_find_id_queries.reset();
+    }
+}
+BENCHMARK(BM_QueryRegistryFindId)->Arg(1000)->Arg(100000)->ThreadRange(1, 8);
+
+}  // namespace
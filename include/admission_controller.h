@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+struct AdmissionLimits {
+    int max_in_flight = 512;  // MathCore requests of all endpoints together, 0 - unlimited
+    std::unordered_map<std::string, int> max_in_flight_per_endpoint;  // missing or 0 - unlimited
+    int max_queued = 256;                                                // parked requests waiting for a slot
+    std::chrono::milliseconds queue_timeout{2000};                       // how long a queued request waits
+    std::chrono::seconds retry_after{5};                                 // hint sent with 503 responses
+};
+
+// Caps the number of outstanding MathCore requests. A request that finds its limit reached is parked in a bounded
+// queue - no thread waits for it - until a slot frees up or the queue timeout passes; once the queue is full (or
+// the wait times out) it's rejected so the caller can answer 503 Service Unavailable instead of letting clients
+// pile up.
+class AdmissionController {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // Holds one in-flight slot until destroyed.
+    class Ticket {
+      public:
+        ~Ticket();
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+
+      private:
+        friend class AdmissionController;
+        Ticket(AdmissionController& owner, const std::string& endpoint) : owner_(owner), endpoint_(endpoint) {}
+
+        AdmissionController& owner_;
+        std::string endpoint_;
+    };
+
+    // Receives the ticket of a parked request, or nullptr if it has to be rejected.
+    using Admitted = std::function<void(std::shared_ptr<Ticket>)>;
+
+    explicit AdmissionController(AdmissionLimits limits);
+    // Rejects the requests still parked.
+    ~AdmissionController();
+
+    AdmissionController(const AdmissionController&) = delete;
+    AdmissionController& operator=(const AdmissionController&) = delete;
+
+    // Returns nullptr if `endpoint` has no free slot; never waits.
+    std::shared_ptr<Ticket> Admit(const std::string& endpoint);
+    // Queues a request Admit() turned down. `admitted` gets the ticket once a slot frees up (right away if one
+    // already has) or nullptr after queue_timeout, on the thread releasing the slot or on the timer thread, so it
+    // should only hand the request over (e.g. to the completion pool). Returns false without calling `admitted`
+    // if the queue is full.
+    bool Park(const std::string& endpoint, Admitted admitted);
+
+    const AdmissionLimits& limits() const { return limits_; }
+    int in_flight() const;
+    int queued() const;
+
+  private:
+    struct Waiter {
+        std::string endpoint;
+        Clock::time_point deadline;
+        Admitted admitted;
+    };
+
+    bool HasSlotLocked(const std::string& endpoint) const;
+    std::shared_ptr<Ticket> TakeSlotLocked(const std::string& endpoint);
+    void Release(const std::string& endpoint);
+    void RunTimer();
+
+    const AdmissionLimits limits_;
+    mutable std::mutex mutex_;
+    std::condition_variable timer_cv_;
+    int in_flight_ = 0;
+    std::unordered_map<std::string, int> in_flight_per_endpoint_;
+    std::deque<Waiter> waiters_;  // in arrival order, which is also deadline order
+    bool stop_ = false;
+    std::thread timer_;
+};
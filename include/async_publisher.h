@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "transport.h"
+
+struct AsyncPublishOptions {
+    bool enabled = false;                           // false - publish on the calling thread
+    std::size_t max_queued = 10000;                 // messages waiting for the publisher thread
+    std::size_t max_queued_bytes = 64 << 20;        // their payloads together
+    std::chrono::milliseconds queue_timeout{1000};  // how long a publish waits for room before it fails
+};
+
+// Bounded queue in front of a connection with one thread handing the messages over. The thread takes whatever
+// piled up since its last round in one go, so bursts reach the socket in few large writes instead of one per
+// caller, and callers don't wait for the connection lock. A full queue makes publishers wait (then fail)
+// rather than buffer without bound. Messages keep the order in which they were queued.
+class AsyncPublisher {
+  public:
+    struct Message {
+        std::string subject;
+        std::string reply;  // empty for plain messages
+        std::string payload;
+        Transport::Headers headers;
+        // Runs on the publisher thread if the connection refuses the message, e.g. to fail the request waiting
+        // for its reply - Enqueue() has long returned true by then.
+        std::function<void()> on_failure;
+    };
+    // Hands one message to the connection; false if it refused it.
+    using PublishFn = std::function<bool(const Message& message)>;
+    // Waits until the connection wrote everything handed to it and the server confirmed it.
+    using FlushFn = std::function<bool(std::chrono::milliseconds timeout)>;
+
+    AsyncPublisher(AsyncPublishOptions options, PublishFn publish, FlushFn flush);
+    // Publishes whatever is still queued, then joins the thread.
+    ~AsyncPublisher();
+
+    AsyncPublisher(const AsyncPublisher&) = delete;
+    AsyncPublisher& operator=(const AsyncPublisher&) = delete;
+
+    // Queues `message`, waiting up to queue_timeout for room. False if the queue stayed full.
+    bool Enqueue(Message message);
+    // Waits until everything queued before the call was published and flushed. Concurrent flushes that find
+    // their messages in the same round share one flush of the connection.
+    // False on timeout, or if the connection refused one of the messages of that round.
+    bool Flush(std::chrono::milliseconds timeout);
+
+    std::size_t queued() const;
+
+  private:
+    // Outcome of a Flush() call, completed by the publisher thread.
+    struct FlushWaiter {
+        std::chrono::steady_clock::time_point deadline;
+        bool done = false;
+        bool ok = false;
+    };
+    struct Entry {
+        Message message;
+        std::shared_ptr<FlushWaiter> flush;  // set for flush markers, which carry no message
+    };
+
+    void Run();
+
+    const AsyncPublishOptions options_;
+    const PublishFn publish_;
+    const FlushFn flush_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_;     // wakes the publisher thread
+    std::condition_variable room_;     // wakes publishers waiting for room
+    std::condition_variable flushed_;  // wakes Flush() callers
+    std::deque<Entry> queue_;
+    std::size_t queued_msgs_ = 0;
+    std::size_t queued_bytes_ = 0;
+    bool stop_ = false;
+    std::thread thread_;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small fixed set of threads finishing parked HTTP requests (building the response and writing it to the
+// detached connection), so neither NATS delivery threads nor Poco worker threads do that work.
+class CompletionPool {
+  public:
+    explicit CompletionPool(std::size_t threads);
+    // Stop()s the pool.
+    ~CompletionPool();
+
+    CompletionPool(const CompletionPool&) = delete;
+    CompletionPool& operator=(const CompletionPool&) = delete;
+
+    // Tasks posted after shutdown began run on the calling thread.
+    void Post(std::function<void()> task);
+    // Runs the tasks still queued, then joins the threads; the pool stays usable (see Post()). Lets the owner
+    // drain it while the objects those tasks touch are still alive. Must not be called from a task.
+    void Stop();
+
+  private:
+    void Run();
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool stop_ = false;
+    std::vector<std::thread> threads_;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/StreamSocket.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// HTTP response written after FileRequestHandler::handleRequest() has returned.
+// The connection's socket is taken away from Poco's HTTPServer, so the worker thread goes back to the pool
+// while MathCore is computing; the connection is closed once the response is sent.
+class DetachedResponse {
+  public:
+    // Takes over the connection of `request`. Returns nullptr if `request` doesn't come from Poco's HTTPServer.
+    static std::shared_ptr<DetachedResponse> Detach(Poco::Net::HTTPServerRequest& request);
+
+    ~DetachedResponse();
+
+    // Extra header for the response (e.g. Content-Encoding); must be set before anything is sent.
+    void AddHeader(const std::string& name, const std::string& value);
+
+    // Writes the complete response and closes the connection; later calls are ignored.
+    void Send(Poco::Net::HTTPResponse::HTTPStatus status, const std::string& content_type, std::string_view body);
+
+    // Chunked transfer encoding for bodies that arrive piece by piece: the first SendChunk() writes the
+    // "200 OK" headers (with `content_type`), FinishChunked() ends the body. Returns false once the client is gone.
+    bool SendChunk(const std::string& content_type, std::string_view chunk);
+    // Writes the terminating chunk and closes the connection; a complete body whose chunks were all empty goes
+    // out as an empty "200 OK" instead. With `complete` false the connection is only closed, so the client sees
+    // a truncated transfer instead of a body that looks whole.
+    void FinishChunked(bool complete);
+
+  private:
+    explicit DetachedResponse(const Poco::Net::StreamSocket& socket) : socket_(socket) {}
+
+    void WriteHead(Poco::Net::HTTPResponse& response);
+    void SendAll(const char* data, std::size_t size);
+    void Close();
+
+    Poco::Net::StreamSocket socket_;
+    std::vector<std::pair<std::string, std::string>> headers_;
+    std::string content_type_;  // of the chunked response, for FinishChunked() if nothing was written
+    bool sent_ = false;
+    bool chunked_ = false;  // headers of a chunked response are out
+    bool failed_ = false;   // writing a chunk failed, the connection is dead
+};
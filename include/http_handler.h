@@ -8,6 +8,7 @@
 
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <fstream>
 #include <functional>
@@ -17,9 +18,21 @@
 #include <nlohmann/json.hpp>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 
-#include "nats_manager.h"
+#include "admission_controller.h"
+#include "completion_pool.h"
+#include "id_generator.h"
+#include "mathcore_instances.h"
+#include "query_registry.h"
+#include "request_coalescer.h"
+#include "response_compression.h"
+#include "server_config.h"
+#include "transport.h"
+
+class DetachedResponse;
 
 enum class Status : int {
     Error = 0,
@@ -27,85 +40,191 @@ enum class Status : int {
 };
 std::string ToString(Status s);
 
+// Delivers the final JSON body of a request - onto its detached connection, or into the Poco response
+// when the connection couldn't be detached. May be called from any thread, after the handler is gone.
+using Responder = std::function<void(std::string_view body)>;
+
+// Responders of one request. Bodies that MathCore streams in pieces (GET /getlog) go out with chunked transfer
+// encoding through `write` and `finish`; anything that arrives in one piece still goes through `send`.
+struct StreamResponder {
+    Responder send;
+    std::function<bool(std::string_view chunk)> write;  // false once the client is gone
+    std::function<void(bool complete)> finish;          // complete=false cuts the transfer short
+};
+
+// Long-lived objects shared by all request handlers; owned by ServerApp::main.
+struct HandlerContext {
+    Transport& transport;
+    CompletionPool& completion_pool;
+    AdmissionController& admission;
+    QueryRegistry& queries;
+    MathCoreInstances& instances;  // also decides whether jobs are routed to single instances
+    IdGenerator& ids;
+    RequestCoalescer& coalescer;
+    std::chrono::milliseconds mathcore_request_timeout;  // 0 - no deadline
+    std::chrono::milliseconds logslist_cache_ttl;        // 0 - every /logslist flight asks MathCore
+    bool validate_start_body;                            // reject /start bodies that aren't well-formed JSON
+    std::chrono::milliseconds start_flush_timeout;       // 0 - answer /start without waiting for the server
+    CompressionSettings compression;
+};
+
 // HTTP request handler
 class FileRequestHandler : public Poco::Net::HTTPRequestHandler {
   public:
-    explicit FileRequestHandler(NatsManager& nats_manager) : nats_manager_(nats_manager) {}
+    explicit FileRequestHandler(const HandlerContext& context) :
+        transport_(context.transport),
+        completion_pool_(context.completion_pool),
+        admission_(context.admission),
+        queries_(context.queries),
+        instances_(context.instances),
+        ids_(context.ids),
+        coalescer_(context.coalescer),
+        mathcore_request_timeout_(context.mathcore_request_timeout),
+        logslist_cache_ttl_(context.logslist_cache_ttl),
+        validate_start_body_(context.validate_start_body),
+        start_flush_timeout_(context.start_flush_timeout),
+        compression_(context.compression),
+        context_(context) {}
 
     void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) override;
 
-    // Subscribe to MathCore heartbeat channel; should be called once during startup.
-    static bool StartMathAliveWatcher(NatsManager& nats_manager);
+    // Subscribe to MathCore heartbeat channel and start the heartbeat watchdog; should be called once during startup.
+    // Heartbeats of every instance update `instances`. MathCore restarts reset the numbering of `queries` (on
+    // `pool`, it may ask the shared query store); with routing, a restarted instance only takes the queries of its
+    // own jobs along.
+    static bool StartMathAliveWatcher(Transport& transport,
+                                      QueryRegistry& queries,
+                                      MathCoreInstances& instances,
+                                      CompletionPool& pool);
+    // Stops the watchdog; must be called before the objects passed to StartMathAliveWatcher() go away.
+    static void StopMathAliveWatcher();
     static bool IsMathCoreAlive();
 
+    // Request parsing and response building, public for the benchmarks.
+    static int ParseQuery(std::string& uri);
+    static std::string ParseLogId(const std::string& uri);
+    static nlohmann::json GenerateResponse(const int query,
+                                           const std::string& ID,
+                                           const enum Status status,
+                                           const std::string& desc);
+
   private:
-    static void RecordMathCoreHeartbeat(const nlohmann::json& payload);
-    static void HandleMathCoreStartup();
+    // `load` is negative if the heartbeat had no load figure.
+    static void RecordMathCoreHeartbeat(const std::string& instance, const std::string& event, double load);
+    static void RunMathAliveWatchdog();
 
     std::string GenerateID();
-    std::string GetID(int Query);
-    int ParseQuery(std::string& uri);
-    std::string ParseLogId(const std::string& uri);
-    int NextQuery(const std::string& ID);
+
+    // Runs on the handler object that serves the request: this one, or a new one for a request that waited for
+    // admission after this one was gone.
+    using DispatchHandler = std::function<void(FileRequestHandler& self, const StreamResponder&)>;
+    // Runs `handler` with responders bound to this request. The connection is detached from the server first,
+    // so this returns as soon as the handler has sent its NATS request. Requests over the admission limits of
+    // `endpoint` wait parked (see AdmissionController::Park()) and are answered with 503 if no slot frees up.
+    void Dispatch(Poco::Net::HTTPServerRequest& request,
+                  Poco::Net::HTTPServerResponse& response,
+                  const std::string& endpoint,
+                  const DispatchHandler& handler);
+    void RejectOverloaded(Poco::Net::HTTPServerResponse& response, const std::string& endpoint);
+    static void RejectOverloaded(DetachedResponse& detached,
+                                 const std::string& endpoint,
+                                 std::chrono::seconds retry_after);
+    // Encoding the client accepts, Identity when compression is off.
+    ContentEncoding ResponseEncoding(const Poco::Net::HTTPServerRequest& request) const;
+    // Sends a complete body (JSON unless told otherwise) through `response`, compressed if it's worth it.
+    void SendBody(Poco::Net::HTTPServerResponse& response,
+                  ContentEncoding encoding,
+                  std::string_view body,
+                  const char* content_type = "application/json");
+    Transport::Clock::time_point MathCoreDeadline() const;
 
     void HandleStart(Poco::Net::HTTPServerRequest& request, std::ostream& ostr);
-    void HandleState(std::ostream& ostr, int ID);
-    void HandleLogsList(std::ostream& ostr);
-    void HandleGetLog(std::ostream& ostr, const std::string& id);
-    void WaitForResponse(uint64_t startup_epoch,
-                         const std::string& response_subject,
-                         const std::string& request_name,
-                         std::future<nlohmann::json>& future,
-                         const std::function<nlohmann::json(const std::string&)>& make_error,
-                         const std::function<void()>& on_restart_cleanup,
-                         nlohmann::json& response_json);
-
-    nlohmann::json GenerateResponse(const int query,
-                                    const std::string& ID,
-                                    const enum Status status,
-                                    const std::string& desc);
-    nlohmann::json GenerateErrorResponse(const int query, const std::string& desc);
-    void OnMessageState(const std::string& msg_subject,
-                        const nlohmann::json& message,
-                        nlohmann::json& state,
-                        const int Query);
-
-    void EnsureStateLoadedLocked();
-    static void PersistStateLocked();
-    void RemovePairLocked(const std::string& id);
-    void RemovePersistedPairLocked(const std::string& id);
-
-    NatsManager& nats_manager_;
-    static int query_number_;
-    static std::unordered_map<std::string, int> id_query_map_;
-    static std::unordered_map<std::string, int> persisted_id_query_map_;
-    static std::mutex state_mutex_;
-    static bool state_loaded_;
-    static const std::string kStateFilePath;
+    // Handlers of MathCore queries. They must not touch `this` once the NATS request is sent:
+    // the rest runs as a continuation on the completion pool after this handler object is destroyed.
+    // Identical concurrent /state and /logslist requests share one NATS request (see RequestCoalescer).
+    void HandleState(int Query, Responder respond);
+    void HandleLogsList(Responder respond);
+    // Writes each chunk of a streamed log as soon as it arrives, buffering at most a few chunks per client.
+    void HandleGetLog(const std::string& id, StreamResponder respond);
+    // GET /loglevel reports the runtime log threshold, POST (or PUT) /loglevel?level=warn changes it.
+    void HandleLogLevel(Poco::Net::HTTPServerRequest& request, std::ostream& ostr);
+    // GET /metrics: the metrics registry plus NATS connection, heartbeat and admission state, in Prometheus
+    // text format.
+    std::string HandleMetrics();
+    // Wraps `continuation` so that it runs on the completion pool instead of a NATS delivery thread, recording
+    // the MathCore wait, pool queueing and run time of `endpoint`.
+    Transport::ReplyHandler OnCompletionPool(const char* endpoint, std::function<void(NatsReply&)> continuation);
+    // Subject of a request about job `id` on `route`: "<prefix><instance>.<id>", or "<prefix><id>" when shared.
+    static std::string JobSubject(const char* prefix, const MathCoreInstances::Route& route, const std::string& id);
+    // Requests to one instance go in their own group, so that only its restart or heartbeat loss cancels them.
+    static std::string RequestGroup(const MathCoreInstances::Route& route);
+    bool IsMathCoreAlive(const MathCoreInstances::Route& route) const;
+    void CheckMissedMathCoreEvents(const MathCoreInstances::Route& route, uint64_t request_id);
+    // Returns true if `reply` holds MathCore's response, or false with an error response built by `make_error`
+    // in `error_json`.
+    static bool CompleteMathCoreRequest(const MathCoreInstances& instances,
+                                        const MathCoreInstances::Route& route,
+                                        NatsReply& reply,
+                                        const char* request_kind,
+                                        const std::string& request_id,
+                                        const std::function<nlohmann::json(const std::string&)>& make_error,
+                                        const std::function<void()>& on_restart_cleanup,
+                                        nlohmann::json& error_json);
+
+    static nlohmann::json GenerateErrorResponse(const int query, const std::string& desc);
+    static void OnMessageState(const nlohmann::json& message,
+                               nlohmann::json& state,
+                               const int Query,
+                               const std::string& ID);
+
+    Transport& transport_;
+    CompletionPool& completion_pool_;
+    AdmissionController& admission_;
+    QueryRegistry& queries_;
+    MathCoreInstances& instances_;
+    IdGenerator& ids_;
+    RequestCoalescer& coalescer_;
+    std::chrono::milliseconds mathcore_request_timeout_;
+    std::chrono::milliseconds logslist_cache_ttl_;
+    bool validate_start_body_;
+    std::chrono::milliseconds start_flush_timeout_;
+    CompressionSettings compression_;
+    HandlerContext context_;  // to create the handler of a request parked by admission control
 
     static std::atomic<bool> mathcore_alive_;
-    static std::atomic<uint64_t> mathcore_startup_epoch_;
     static std::chrono::steady_clock::time_point last_mathcore_heartbeat_;
     static std::mutex health_mutex_;
+    static std::condition_variable health_cv_;
     static bool mathcore_subscription_active_;
+    static bool watchdog_stop_;
+    static std::thread watchdog_;
+    static Transport* watched_transport_;
+    static QueryRegistry* watched_queries_;
+    static MathCoreInstances* watched_instances_;
+    static CompletionPool* watched_pool_;
     static const std::chrono::seconds kMathAliveTimeout;
     static const std::string kMathAliveSubject;
+    // Every MathCore request is sent in this group (or "<group>.<instance>" when routed to one instance), so
+    // restarts and heartbeat loss can cancel them at once.
+    static const std::string kMathCoreRequestGroup;
 };
 
 // Factory to create handlers (needed by Poco)
 class FileRequestHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
   public:
-    explicit FileRequestHandlerFactory(NatsManager& nats_manager) : nats_manager_(nats_manager) {}
+    explicit FileRequestHandlerFactory(const HandlerContext& context) : context_(context) {}
 
     Poco::Net::HTTPRequestHandler* createRequestHandler(const Poco::Net::HTTPServerRequest&) override {
-        return new FileRequestHandler(nats_manager_);
+        return new FileRequestHandler(context_);
     }
 
   private:
-    NatsManager& nats_manager_;
+    HandlerContext context_;
 };
 
 class ServerApp : public Poco::Util::ServerApplication {
   protected:
+    // Loads nats-connector.properties (see ServerConfig).
+    void initialize(Poco::Util::Application& self) override;
     int main(const std::vector<std::string>&) override;
 };
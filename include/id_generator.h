@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Unique job IDs: "YYYYMMDD_HHMMSS_mmm_NNN_SSSSS" - UTC time down to milliseconds, node number and a sequence
+// within the millisecond. IDs of one generator are strictly increasing and sort lexicographically in that order,
+// even under concurrent use or when the clock steps back. They contain no dots, so they can be used in subjects.
+// Formatting is done by hand into a fixed buffer: no iostreams, locale, time zone lookup or allocation.
+class IdGenerator {
+  public:
+    static constexpr std::size_t kLength = 29;
+    static constexpr unsigned kMaxNode = 999;
+
+    struct Id {
+        char data[kLength + 1];  // NUL-terminated
+        std::string_view view() const { return std::string_view(data, kLength); }
+    };
+
+    // `node` tells apart connectors sharing one MathCore; values above kMaxNode are clamped.
+    explicit IdGenerator(unsigned node = 0);
+
+    Id Next();
+
+  private:
+    const unsigned node_;
+    std::atomic<uint64_t> last_{0};  // (unix milliseconds << kSequenceBits) | sequence of the last ID
+};
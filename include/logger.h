@@ -1,8 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <ostream>
+#include <sstream>
 #include <string>
 
 #include "nlohmann/json.hpp"
@@ -11,24 +17,64 @@ namespace logger {
 
 constexpr int json_indent = 4;
 
+enum class Level : int {
+    Trace = 0,
+    Debug = 1,
+    Info = 2,
+    Warn = 3,
+    Error = 4,
+    Off = 5
+};
+
+// Statements below this level are compiled out by the LOG_* macros (arguments included).
+// Set through the LOG_MIN_LEVEL CMake cache variable, e.g. -DLOG_MIN_LEVEL=3 keeps warnings and errors only.
+#ifndef LOGGER_MIN_LEVEL
+    #define LOGGER_MIN_LEVEL 0
+#endif
+constexpr Level kCompileTimeMinLevel = static_cast<Level>(LOGGER_MIN_LEVEL);
+
+// Runtime threshold; statements below it are skipped before any formatting happens.
+extern std::atomic<int> g_runtime_level;
+
+inline bool IsEnabled(Level level) {
+    return static_cast<int>(level) >= static_cast<int>(kCompileTimeMinLevel) &&
+           static_cast<int>(level) >= g_runtime_level.load(std::memory_order_relaxed);
+}
+
+void SetLevel(Level level);
+Level GetLevel();
+const char* ToString(Level level);
+// Accepts "trace", "debug", "info", "warn"/"warning", "error" and "off" (case-insensitive).
+bool ParseLevel(const std::string& name, Level& level);
+
+// Settings of the asynchronous backend (see StartAsync()).
+struct AsyncOptions {
+    // How often the writer thread flushes pending records when nothing urgent happens.
+    std::chrono::milliseconds flush_interval{200};
+    // Number of pending records after which producers wake the writer early.
+    std::size_t max_batch = 512;
+    // Picks the daily log file; replaced by tests to cross midnight.
+    std::function<std::chrono::system_clock::time_point()> clock = std::chrono::system_clock::now;
+};
+
+// Collects one log statement and hands it over to the backend when destroyed.
+// In synchronous mode (default) the record is written right away by the calling thread,
+// in asynchronous mode it's queued for the writer thread which owns the open files.
 class LogStream {
   public:
-    explicit LogStream(const std::string& filename, std::ostream& stream = std::cout);
-    explicit LogStream(const std::string& filename,
-                       const std::string& latest_filename,
-                       std::ostream& stream = std::cout);
+    // Writes to `filename` and `stream`.
+    explicit LogStream(const std::string& filename, std::ostream& stream = std::cout, Level level = Level::Info);
+    // Writes to the daily log file, logs/latest.log and `stream`.
+    explicit LogStream(std::ostream& stream = std::cout, Level level = Level::Info);
     ~LogStream();
 
+    LogStream(const LogStream&) = delete;
+    LogStream& operator=(const LogStream&) = delete;
+
     template <typename T>
     LogStream& operator<<(const T& value) {
         WritePrefixIfNeeded();
-        (*stream_) << value;
-        if (file_.is_open()) {
-            file_ << value;
-        }
-        if (latest_file_.is_open()) {
-            latest_file_ << value;
-        }
+        (*buffer_) << value;
         return *this;
     }
 
@@ -37,10 +83,13 @@ class LogStream {
   private:
     void WritePrefixIfNeeded();
 
-    std::ofstream file_;
-    std::ofstream latest_file_;
+    std::string filename_;  // empty means daily log + latest.log
     std::ostream* stream_;
+    Level level_;
     bool at_line_start_ = true;
+    bool owns_thread_buffer_ = false;
+    std::ostringstream* buffer_;
+    std::unique_ptr<std::ostringstream> own_buffer_;  // used only by nested statements on the same thread
 };
 
 // Usage: log("path/to/file.txt") << "value" << std::endl;
@@ -48,5 +97,28 @@ LogStream log(const std::string& filename);
 LogStream log();
 LogStream log_error(const std::string& filename);
 LogStream log_error();
+// Warnings and errors go to std::cerr, everything else to std::cout.
+LogStream log(Level level);
+
+// Switches to the asynchronous backend: a single writer thread keeps log files open (with daily rollover),
+// batches writes and flushes on a timer or right after an error record.
+void StartAsync(const AsyncOptions& options = AsyncOptions());
+// Drains pending records, stops the writer thread and returns to synchronous mode; statements that race
+// with the call are either drained or written synchronously.
+void StopAsync();
+
+}  // namespace logger
+
+// Leveled logging: LOG_DEBUG() << "value" << std::endl;
+// A disabled statement costs one comparison at runtime, or nothing at all below LOGGER_MIN_LEVEL -
+// the stream and every operand to the right of it are never evaluated.
+#define LOGGER_STATEMENT(level)        \
+    if (!::logger::IsEnabled(level)) { \
+    } else                             \
+        ::logger::log(level)
 
-}  // namespace logger
\ No newline at end of file
+#define LOG_TRACE() LOGGER_STATEMENT(::logger::Level::Trace)
+#define LOG_DEBUG() LOGGER_STATEMENT(::logger::Level::Debug)
+#define LOG_INFO() LOGGER_STATEMENT(::logger::Level::Info)
+#define LOG_WARN() LOGGER_STATEMENT(::logger::Level::Warn)
+#define LOG_ERROR() LOGGER_STATEMENT(::logger::Level::Error)
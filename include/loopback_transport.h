@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+#include "pending_requests.h"
+#include "transport.h"
+
+// In-process Transport for tests and benchmarks: subjects, wildcards ("*" matches one token, ">" all remaining
+// ones), headers and request/reply behave as with a NATS server, but messages never leave the process.
+// Handlers run on the publishing thread, so a responder that answers right away completes the request before
+// AsyncRequest() returns; requests nobody answers run into their deadline.
+class LoopbackTransport : public Transport {
+  public:
+    LoopbackTransport();
+    ~LoopbackTransport() override;
+
+    bool Publish(const std::string& subject, const nlohmann::json& message) override;
+    bool PublishRaw(const std::string& subject, std::string_view payload) override;
+    bool Respond(const NatsMessage& request, std::string_view payload, const Headers& headers = {}) override;
+    bool SubscribeRaw(const std::string& subject, RawHandler handler) override;
+    bool Unsubscribe(const std::string& subject) override;
+    // Delivery is synchronous: everything published has been handled already.
+    bool Flush(std::chrono::milliseconds timeout) override;
+    bool Flush(const std::string& subject, std::chrono::milliseconds timeout) override;
+
+    uint64_t AsyncRequest(const std::string& subject,
+                          const nlohmann::json& message,
+                          Clock::time_point deadline,
+                          const std::string& group,
+                          ReplyHandler on_reply) override;
+    uint64_t AsyncStreamRequest(const std::string& subject,
+                                const nlohmann::json& message,
+                                Clock::time_point deadline,
+                                const std::string& group,
+                                ReplyHandler on_chunk) override;
+    bool CancelRequest(uint64_t id, const std::string& reason) override;
+    std::size_t CancelRequests(const std::string& group, const std::string& reason) override;
+
+    bool GetStats(NatsStats& stats) const override;
+
+    // True if a message published to `subject` is delivered to a subscription on `pattern`.
+    static bool SubjectMatches(std::string_view pattern, std::string_view subject);
+    // Non-empty tokens separated by dots; "*" and ">" (last token only) are accepted if `wildcards` is set.
+    static bool IsValidSubject(std::string_view subject, bool wildcards);
+
+  private:
+    struct Subscription {
+        std::string pattern;
+        RawHandler handler;
+    };
+
+    // Hands the message to every matching subscription, or to the pending request it replies to.
+    bool Send(const std::string& subject, const char* reply_subject, std::string_view payload, const Headers& headers);
+    uint64_t StartRequest(const std::string& subject,
+                          const nlohmann::json& message,
+                          Clock::time_point deadline,
+                          const std::string& group,
+                          ReplyHandler on_reply,
+                          bool streamed);
+
+    mutable std::shared_mutex mutex_;
+    std::vector<std::shared_ptr<const Subscription>> subs_;
+    PendingRequests pending_;
+
+    std::atomic<uint64_t> in_msgs_{0};
+    std::atomic<uint64_t> in_bytes_{0};
+    std::atomic<uint64_t> out_msgs_{0};
+    std::atomic<uint64_t> out_bytes_{0};
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// MathCore instances known from their heartbeats (IsMathAlive.<instance>), and the instance each job went to.
+// With routing on, every /start goes to the least-loaded live instance and later requests about the job follow
+// it there, so a restart of one instance only loses the jobs it owned. Without routing, all instances share
+// the same subjects and any restart counts as a restart of MathCore as a whole.
+class MathCoreInstances {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // Where requests about one job go.
+    struct Route {
+        std::string instance;  // empty - the subjects every instance listens on
+        uint64_t epoch = 0;    // startups of `instance` (of all instances for shared routes) when it was taken
+    };
+
+    // What a heartbeat changed.
+    struct Update {
+        bool restarted = false;              // a "startup" event
+        bool revived = false;                // the instance was new or had timed out
+        std::vector<std::string> lost_jobs;  // routed to the instance before its restart, now unpinned
+    };
+
+    explicit MathCoreInstances(bool routing = false) : routing_(routing) {}
+
+    MathCoreInstances(const MathCoreInstances&) = delete;
+    MathCoreInstances& operator=(const MathCoreInstances&) = delete;
+
+    bool routing() const { return routing_; }
+
+    // `load` is the load figure of the heartbeat, negative if it had none.
+    Update Record(const std::string& instance, const std::string& event, double load, Clock::time_point now);
+    // Marks instances without a heartbeat for `timeout` dead and returns their names.
+    std::vector<std::string> Expire(Clock::time_point now, Clock::duration timeout);
+    // When the first live instance times out; Clock::time_point::max() if none is alive.
+    Clock::time_point NextExpiry(Clock::duration timeout) const;
+
+    // Pins job `id` to the live instance with the lowest load: its last reported load plus the jobs routed to it
+    // since (instances that report no load are balanced by job count). Empty route if no instance is alive.
+    Route Assign(const std::string& id);
+    // Undoes Assign() for a job that never reached MathCore.
+    void Release(const std::string& id);
+    // Route of job `id`; the shared route if it isn't pinned (routing off, or routed by another process).
+    Route Find(const std::string& id) const;
+    // Route of requests not about one job.
+    Route Shared() const;
+    // True if the instance behind `route` started up again since the route was taken. Shared routes only
+    // restart without routing: with it, MathCore as a whole never does.
+    bool Restarted(const Route& route) const;
+    // Liveness of the instance behind a pinned route; shared routes are alive while any instance is.
+    bool IsAlive(const Route& route) const;
+
+    std::size_t size() const;
+    std::size_t alive_count() const;
+    std::size_t pinned_size() const;
+    uint64_t startups() const;
+
+  private:
+    struct Instance {
+        bool alive = true;
+        uint64_t epoch = 0;  // startups seen
+        double load = 0;
+        std::size_t routed = 0;  // jobs pinned since the last load report
+        Clock::time_point last_heartbeat;
+    };
+
+    const bool routing_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Instance> instances_;
+    std::unordered_map<std::string, Route> jobs_;  // job ID -> instance it was routed to
+    uint64_t startups_ = 0;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// In-process metrics exported on GET /metrics in Prometheus text format.
+// Recording is lock-free: counters and histograms are split into cache-line sized shards picked per thread,
+// and only a scrape sums them up. Look metrics up once (e.g. into a function-local static reference) and keep
+// the reference - the lookup itself takes the registry lock.
+namespace metrics {
+
+constexpr std::size_t kShards = 8;
+
+// Shard of the calling thread, assigned round-robin on first use.
+std::size_t ThisThreadShard();
+
+class Counter {
+  public:
+    void Add(uint64_t n = 1) { shards_[ThisThreadShard()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Value() const;
+
+  private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, kShards> shards_;
+};
+
+class Gauge {
+  public:
+    void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    void Add(int64_t delta) { value_.fetch_add(delta, std::memory_order_relaxed); }
+    int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<int64_t> value_{0};
+};
+
+// Latency histogram in microseconds with HDR-style log-linear buckets: exact below 32us, then 16 buckets per
+// power of two (at most ~6% relative error) up to 2^40us; larger values land in the last bucket.
+class Histogram {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr unsigned kSubBucketBits = 4;
+    static constexpr std::size_t kLinearBuckets = std::size_t(2) << kSubBucketBits;
+    static constexpr unsigned kMaxExponent = 40;
+    static constexpr std::size_t kBuckets =
+        kLinearBuckets + (kMaxExponent - kSubBucketBits - 1) * (std::size_t(1) << kSubBucketBits);
+
+    struct Snapshot {
+        std::vector<uint64_t> buckets;
+        uint64_t count = 0;
+        uint64_t sum = 0;  // microseconds
+
+        // Upper bound of the bucket holding the `quantile` (0..1) of recorded values, 0 if there are none.
+        uint64_t ValueAt(double quantile) const;
+    };
+
+    Histogram();
+
+    void Record(uint64_t micros);
+    void RecordSince(Clock::time_point start);
+    Snapshot Collect() const;
+
+    static std::size_t BucketOf(uint64_t micros);
+    static uint64_t UpperBound(std::size_t bucket);
+
+  private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> buckets[kBuckets];
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+    };
+    std::unique_ptr<Shard[]> shards_;
+};
+
+class Registry {
+  public:
+    // Return the metric `name{labels}` (labels like `endpoint="state"`), created on first use. References
+    // stay valid for the lifetime of the registry. A name must not be reused for another kind of metric.
+    Counter& GetCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Gauge& GetGauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    Histogram& GetHistogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    // Text exposition format 0.0.4. Histograms are exported as summaries in seconds: quantiles 0.5, 0.9, 0.99
+    // and 0.999 plus _sum and _count.
+    std::string Render() const;
+
+  private:
+    template <typename Metric>
+    struct Family {
+        std::string help;
+        std::map<std::string, std::unique_ptr<Metric>> by_labels;
+    };
+
+    template <typename Metric>
+    static Metric& GetLocked(std::map<std::string, Family<Metric>>& families,
+                             const std::string& name,
+                             const std::string& help,
+                             const std::string& labels);
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Family<Counter>> counters_;
+    std::map<std::string, Family<Gauge>> gauges_;
+    std::map<std::string, Family<Histogram>> histograms_;
+};
+
+// Process-wide registry rendered by /metrics.
+Registry& Global();
+
+// Appends a metric whose value is computed at scrape time (HELP, TYPE and one sample line).
+void AppendSample(std::string& out, const std::string& name, const char* type, const std::string& help, double value);
+
+}  // namespace metrics
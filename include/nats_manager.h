@@ -1,39 +1,165 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
-#include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
+#include "async_publisher.h"
 #include "nats.h"
 #include "nlohmann/json.hpp"
+#include "pending_requests.h"
+#include "transport.h"
 
-struct MsgGuard {
-    natsMsg* m;
-    ~MsgGuard() {
-        if (m) natsMsg_Destroy(m);
-    }
+// Settings of NatsManager's connections, applied through natsOptions by Connect(). 0 keeps the nats.c default.
+struct NatsOptions {
+    // Outgoing messages are spread over the connections by NatsManager::ShardOf(), each subscription goes to
+    // the connection with the fewest.
+    std::size_t connections = 1;
+    // Threads of the library-wide pool delivering messages of all subscriptions; 0 - a thread per subscription.
+    // The pool is shared by every connection of the process and never shrinks.
+    int delivery_threads = 0;
+    // Messages and bytes a subscription may have waiting for its handler (nats.c: 65536 and 64 MB); beyond
+    // that nats.c drops messages and reports a slow consumer.
+    int pending_msgs = 0;
+    int pending_bytes = 0;
+    int io_buffer_size = 0;  // read and write buffer of each connection (nats.c: 32 KB)
+    bool send_asap = false;  // write every message right away instead of leaving it to nats.c's flusher
+    // With `async_publish.enabled`, publishes and requests go through an AsyncPublisher (one per connection)
+    // instead of being handed to nats.c on the calling thread.
+    AsyncPublishOptions async_publish;
 };
 
-class NatsManager {
+// Transport over one or more connections to a NATS server.
+// Requests whose replies can no longer arrive fail right away: on a slow consumer report for the reply inbox
+// (nats.c dropped messages to it) and when the connection they went out on is lost.
+class NatsManager : public Transport {
   public:
     NatsManager();
-    ~NatsManager();
+    ~NatsManager() override;
+
+    // Takes effect on the next Connect().
+    void SetOptions(const NatsOptions& options) { options_ = options; }
 
     bool Connect(const std::string& server_url);
-    bool Publish(const std::string& subject, const nlohmann::json& message);
-    bool Subscribe(const std::string& subject,
-                   std::function<void(const std::string& subject, const nlohmann::json& message)> handler);
-    bool Unsubscribe(const std::string& subject);
+    bool Publish(const std::string& subject, const nlohmann::json& message) override;
+    bool PublishRaw(const std::string& subject, std::string_view payload) override;
+    bool Respond(const NatsMessage& request, std::string_view payload, const Headers& headers = {}) override;
+    // Safe from any thread, handlers included; delivery to other subscriptions doesn't wait for them.
+    bool SubscribeRaw(const std::string& subject, RawHandler handler) override;
+    // Like SubscribeRaw(), but each message reaches only one member of `queue` among all subscribers with that
+    // queue name, in any process: replicas of a service share the work instead of each getting everything.
+    // Unsubscribe(subject) removes it like any other subscription.
+    bool QueueSubscribeRaw(const std::string& subject, const std::string& queue, RawHandler handler);
+    // Removes the most recent subscription to `subject`.
+    bool Unsubscribe(const std::string& subject) override;
+    // natsConnection_FlushTimeout() on every connection, behind whatever the publish queues still hold in
+    // async mode.
+    bool Flush(std::chrono::milliseconds timeout) override;
+    // Flushes the connection ShardOf(`subject`) only.
+    bool Flush(const std::string& subject, std::chrono::milliseconds timeout) override;
+    // Publishes what's still queued, then closes the connections.
     void Disconnect();
 
-    // for testing purposes
-    natsConnection* get_connection() const { return conn_; }
+    // Every connection has one wildcard inbox subscription shared by all requests sent over it, so no
+    // SUB/UNSUB traffic happens per request.
+    uint64_t AsyncRequest(const std::string& subject,
+                          const nlohmann::json& message,
+                          Clock::time_point deadline,
+                          const std::string& group,
+                          ReplyHandler on_reply) override;
+    uint64_t AsyncStreamRequest(const std::string& subject,
+                                const nlohmann::json& message,
+                                Clock::time_point deadline,
+                                const std::string& group,
+                                ReplyHandler on_chunk) override;
+    bool CancelRequest(uint64_t id, const std::string& reason) override;
+    std::size_t CancelRequests(const std::string& group, const std::string& reason) override;
+
+    // Traffic counters kept by nats.c, summed over all connections. Returns false when not connected.
+    bool GetStats(NatsStats& stats) const override;
+
+    // Connection carrying messages to `subject`, picked by a hash of its last token: messages to one subject
+    // keep their order, and so do all messages about one job (Start.<ID>, State.Request.<ID>, ...).
+    std::size_t ShardOf(std::string_view subject) const;
+    std::size_t connection_count() const { return connections_.size(); }
+
+    // For JetStream contexts and testing purposes; nullptr while disconnected.
+    natsConnection* get_connection(std::size_t index = 0) const;
 
   private:
-    natsConnection* conn_;
-    std::unordered_map<std::string, natsSubscription*> subs_;
-    std::unordered_map<natsSubscription*, std::function<void(const std::string&, const nlohmann::json&)>> callbacks_;
+    struct Connection {
+        NatsManager* owner = nullptr;
+        std::size_t index = 0;  // also the inbox number of its requests in pending_
+        natsConnection* conn = nullptr;
+        // Reply inbox: "<inbox_prefix>.<correlation id>" for every request sent over this connection.
+        std::string inbox_prefix;
+        natsSubscription* inbox_sub = nullptr;
+        std::unique_ptr<AsyncPublisher> publisher;  // set in async mode
+        std::size_t subscriptions = 0;
 
+        // Set by the closed callback, the last one nats.c invokes for a connection.
+        std::mutex mutex;
+        std::condition_variable closed_cv;
+        bool closed = false;
+    };
+    struct SubscriptionEntry {
+        natsSubscription* sub;
+        Connection* connection;
+    };
+
+    bool Open(Connection& connection, const std::string& server_url);
+    // A plain subscription when `queue` is empty.
+    bool AddSubscription(const std::string& subject, const std::string& queue, RawHandler handler);
+    natsStatus ConnectWithOptions(Connection& connection, const std::string& server_url);
+    // Applies the pending limits of options_ to a new subscription.
+    void SetPendingLimits(natsSubscription* sub) const;
+    // Publishes what's still queued, then unsubscribes the inbox and destroys the connection.
+    static void Close(Connection& connection);
+    // Flush() of one connection.
+    static bool FlushConnection(Connection& connection, std::chrono::milliseconds timeout);
+    // Sends an already encoded payload: queued in async mode, otherwise handed to nats.c right away.
+    // `on_failure` runs if a queued message is refused later; a false return covers everything else.
+    bool Send(Connection& connection,
+              const std::string& subject,
+              const char* reply_subject,
+              std::string_view payload,
+              Headers headers,
+              std::function<void()> on_failure = nullptr);
+    // Hands the message to nats.c, without headers unless there are some to send.
+    static natsStatus PublishMsg(natsConnection* conn,
+                                 const std::string& subject,
+                                 const char* reply_subject,
+                                 std::string_view payload,
+                                 const Headers& headers);
+    uint64_t StartRequest(const std::string& subject,
+                          const nlohmann::json& message,
+                          Clock::time_point deadline,
+                          const std::string& group,
+                          ReplyHandler on_reply,
+                          bool streamed);
+
+    NatsOptions options_;
+    std::vector<std::unique_ptr<Connection>> connections_;  // empty while disconnected
+    // Registry of subscriptions by subject, only used to subscribe and unsubscribe: delivery reaches the
+    // handler through the subscription's closure without touching it.
+    std::mutex subs_mutex_;
+    std::unordered_map<std::string, std::vector<SubscriptionEntry>> subs_;
+    PendingRequests pending_;
+
+    // `closure` is the RawHandler of the subscription.
     static void Callback(natsConnection* nc, natsSubscription* sub, natsMsg* msg, void* closure);
-};
\ No newline at end of file
+    static void OnSubscriptionComplete(void* closure);
+    static void InboxCallback(natsConnection* nc, natsSubscription* sub, natsMsg* msg, void* closure);
+    // Connection callbacks; `closure` is the Connection.
+    static void OnAsyncError(natsConnection* nc, natsSubscription* sub, natsStatus error, void* closure);
+    static void OnDisconnected(natsConnection* nc, void* closure);
+    static void OnClosed(natsConnection* nc, void* closure);
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "transport.h"
+
+// Requests of one transport waiting for their replies: correlation ids, deadlines, groups and the ordering of
+// streamed chunks. The transport publishes each request with a reply subject ending in its id and hands
+// whatever arrives there to Deliver(); every handler runs exactly once (per chunk), outside of the lock.
+class PendingRequests {
+  public:
+    using Clock = Transport::Clock;
+    using ReplyHandler = Transport::ReplyHandler;
+
+    ~PendingRequests();
+
+    // Starts the thread that times requests out.
+    void Start();
+    // Stops the deadline thread and cancels whatever is still pending with `reason`.
+    void Stop(const std::string& reason);
+
+    // Registers a request and returns its id. Register before publishing: the reply may arrive before the
+    // publish call returns. `inbox` tells which reply subscription the reply will come through.
+    uint64_t Add(ReplyHandler on_reply,
+                 Clock::time_point deadline,
+                 const std::string& group,
+                 bool streamed,
+                 std::size_t inbox = 0);
+    // Routes a message received on the reply subject of request `id`.
+    void Deliver(uint64_t id, std::shared_ptr<NatsMessage> message);
+    // Removes the entry and runs its handler. Returns false if `id` isn't pending.
+    bool Complete(uint64_t id, NatsReply&& reply);
+    bool Cancel(uint64_t id, const std::string& reason);
+    std::size_t CancelGroup(const std::string& group, const std::string& reason);
+    // Fails every request waiting for a reply through `inbox`, e.g. once messages to it were dropped.
+    std::size_t FailInbox(std::size_t inbox, const std::string& reason);
+
+    // Wraps the chunk handler of a streamed request so that chunks and the final call never run concurrently.
+    static ReplyHandler SerializeChunks(ReplyHandler on_chunk);
+    // Id at the end of a reply subject "<inbox>.<id>", 0 if there is none.
+    static uint64_t IdFromSubject(std::string_view subject);
+
+  private:
+    struct Entry {
+        ReplyHandler handler;
+        Clock::time_point deadline;
+        std::string group;
+        bool streamed = false;
+        uint64_t next_chunk = 0;  // sequence number expected next, streamed requests only
+        std::size_t inbox = 0;
+    };
+
+    // Completes every entry `matches` accepts with `status` and `reason`. Returns how many there were.
+    template <typename Predicate>
+    std::size_t CompleteAll(Predicate matches, NatsReply::Status status, const std::string& reason);
+
+    // Must be called with mutex_ held.
+    void EraseDeadlineLocked(uint64_t id, Clock::time_point deadline);
+    void CancelAll(const std::string& reason);
+    void RunDeadlineReaper();
+
+    std::mutex mutex_;
+    std::condition_variable cv_;  // wakes the reaper when an earlier deadline shows up
+    std::unordered_map<uint64_t, Entry> pending_;
+    std::multimap<Clock::time_point, uint64_t> deadlines_;
+    uint64_t next_id_ = 1;
+    bool reaper_stop_ = false;
+    std::thread reaper_;
+};
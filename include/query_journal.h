@@ -0,0 +1,78 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct QueryJournalOptions {
+    std::string snapshot_path = "query_state.json";  // the journal lives next to it, with a ".journal" suffix
+    std::size_t compact_after = 10000;               // journal records that trigger folding it into the snapshot
+    bool sync = true;                                // fsync every commit (a crash can't lose an answered /start)
+};
+
+// Persistent id -> query number table. Changes are appended to a journal by a writer thread, which commits
+// whatever accumulated while the previous write was in flight with a single write + fsync (group commit),
+// and now and then rewrites the snapshot (atomically, via rename) so the journal stays short.
+// On startup the snapshot is read and the journal replayed on top of it; a torn last record is ignored.
+class QueryJournal {
+  public:
+    explicit QueryJournal(QueryJournalOptions options);
+    // Commits pending records and stops the writer.
+    ~QueryJournal();
+
+    QueryJournal(const QueryJournal&) = delete;
+    QueryJournal& operator=(const QueryJournal&) = delete;
+
+    // Loads the persisted table and starts the writer; call once, before anything else.
+    std::unordered_map<std::string, int> Open();
+
+    // Queue a record and return its sequence number; records are committed in the order they were queued.
+    uint64_t Add(const std::string& id, int query);
+    uint64_t Remove(const std::string& id);
+    // Blocks until record `seq` (and everything before it) was written. Returns false if `seq` didn't make it to
+    // disk; a failure doesn't affect later records.
+    bool WaitCommitted(uint64_t seq);
+
+  private:
+    struct Record {
+        bool add;
+        std::string id;
+        int query;
+    };
+
+    uint64_t Queue(Record&& record);
+    void Run();
+    bool WriteBatch(const std::vector<Record>& batch);
+    // Returns true once the snapshot holding live_ is durable.
+    bool Compact();
+    // Applies the journal to live_. Returns false if it has malformed or torn records.
+    bool Replay(std::FILE* journal);
+    bool OpenJournal(const char* mode);
+
+    const QueryJournalOptions options_;
+    const std::string journal_path_;
+
+    std::mutex mutex_;
+    std::condition_variable queued_cv_;     // wakes the writer
+    std::condition_variable committed_cv_;  // wakes WaitCommitted()
+    std::vector<Record> queued_;
+    uint64_t last_queued_ = 0;
+    uint64_t last_committed_ = 0;
+    std::deque<std::pair<uint64_t, uint64_t>> failed_batches_;  // first and last record of recent failed batches
+    uint64_t forgotten_failures_ = 0;                            // records up to here count as failed
+    bool stop_ = false;
+    std::thread writer_;
+
+    // Owned by the writer thread (and by Open() before it starts).
+    std::FILE* journal_ = nullptr;
+    std::unordered_map<std::string, int> live_;  // the table as committed, source of snapshots
+    std::size_t journal_records_ = 0;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "query_journal.h"
+
+class SharedQueryStore;
+
+// Query numbers handed out by /start, indexed both ways (ID -> query and query -> ID).
+// Lookups take a shared lock only, so /state requests don't queue behind each other; changes are rare
+// (one per /start) and also go to the journal, if one is attached.
+// In replica mode the pairs go to a SharedQueryStore instead, and the maps here cache what this process saw.
+class QueryRegistry {
+  public:
+    QueryRegistry() = default;
+
+    QueryRegistry(const QueryRegistry&) = delete;
+    QueryRegistry& operator=(const QueryRegistry&) = delete;
+
+    // Takes over the pairs persisted in `journal` and records later changes in it; call before serving requests.
+    void Open(QueryJournal& journal);
+    // Replica mode, instead of Open(): numbers are reserved from `store` in blocks of `block`, so they're unique
+    // across all connectors sharing it, and pairs this process doesn't know are looked up there.
+    void Share(SharedQueryStore& store, int block);
+    // Stops recording changes; must be called before the journal passed to Open() (or the store passed to
+    // Share()) goes away.
+    void Close();
+
+    // Assigns the next query number to `id`. When a journal is attached it returns once the pair is on disk,
+    // in replica mode once it's in the store; 0 if it couldn't be persisted (the caller should Forget() `id`).
+    int Register(const std::string& id);
+    // Empty if `query` isn't known (never issued, or issued before the last MathCore restart). In replica mode
+    // numbers missing here are looked up in the store; misses are remembered for a second, so repeated
+    // requests for unknown numbers don't each cost a round trip.
+    std::string FindId(int query);
+    // 0 if `id` isn't known.
+    int FindQuery(const std::string& id) const;
+
+    // The result of `id` was delivered: the pair doesn't need to survive a restart anymore.
+    void Complete(const std::string& id);
+    // Drops `id` entirely (its job never reached MathCore or was lost with it).
+    void Forget(const std::string& id);
+    // MathCore restarted: numbering starts over. Persisted pairs stay until completed or forgotten.
+    // In replica mode numbers stay unique; pairs stored before the startup marker all replicas share (see
+    // SharedQueryStore::StartupCheckpoint()) aren't found anymore, and expire by the store's TTL. That takes a
+    // round trip to the store, so don't call this on a NATS delivery thread.
+    void ResetActive();
+
+    std::size_t active_size() const;
+    std::size_t persisted_size() const;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    // Must be called with mutex_ held exclusively.
+    void CompleteLocked(const std::string& id);
+    void CacheMissLocked(int query, Clock::time_point now);
+    int RegisterShared(SharedQueryStore& store, const std::string& id);
+
+    mutable std::shared_mutex mutex_;
+    int last_query_ = 0;
+    std::unordered_map<std::string, int> query_by_id_;
+    std::unordered_map<int, std::string> id_by_query_;
+    std::unordered_set<std::string> persisted_;  // IDs whose results weren't delivered yet
+    QueryJournal* journal_ = nullptr;
+
+    SharedQueryStore* store_ = nullptr;
+    int block_ = 0;
+    std::mutex block_mutex_;  // guards the reserved block; held across Reserve() round trips, unlike mutex_
+    int next_shared_ = 0;     // next number of the reserved block
+    int shared_end_ = 0;      // end of the reserved block
+    uint64_t restart_checkpoint_ = 0;                       // store checkpoint of the last MathCore restart
+    std::unordered_map<int, Clock::time_point> misses_;  // numbers the store didn't know, until when to believe it
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Single-flight for MathCore queries: concurrent requests with the same key (endpoint plus its parameters) share
+// one outstanding NATS request and all get its response body. A completed body may also be kept for a short
+// while, so requests arriving right after it are answered without asking MathCore at all.
+class RequestCoalescer {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Waiter = std::function<void(std::string_view body)>;
+
+    // Returns true if the caller leads a new flight for `key`: it must send the request and hand the outcome to
+    // Complete(). Otherwise `waiter` has been queued behind the flight in progress, or already answered from
+    // the cache.
+    bool Join(const std::string& key, Waiter waiter);
+    // Ends the flight of `key`: every waiter gets `body` (on the calling thread, in arrival order), and if
+    // `cache_for` is positive later Join()s reuse it until then.
+    void Complete(const std::string& key, std::string_view body, std::chrono::milliseconds cache_for);
+
+    std::size_t in_flight() const;
+    std::size_t coalesced() const;  // requests that joined a flight or were served from the cache
+
+  private:
+    struct Cached {
+        std::string body;
+        Clock::time_point expires;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::vector<Waiter>> flights_;  // waiters of the flight, leader first
+    std::unordered_map<std::string, Cached> cache_;
+    std::size_t coalesced_ = 0;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Poco/DeflatingStream.h>
+
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+// Content-Encoding of an HTTP response body.
+enum class ContentEncoding {
+    Identity,
+    Gzip,
+    Deflate
+};
+
+struct CompressionSettings {
+    bool enabled = true;
+    std::size_t min_size = 1024;  // smaller bodies are sent as they are
+    int level = 6;                // zlib level, 1 (fastest) .. 9 (smallest)
+};
+
+// Picks the encoding for a request's Accept-Encoding header: gzip or deflate by q-value (gzip on a tie),
+// Identity if neither is acceptable.
+ContentEncoding NegotiateEncoding(const std::string& accept_encoding);
+// Value of the Content-Encoding header, empty for Identity.
+const char* ToString(ContentEncoding encoding);
+// Compresses a complete body.
+std::string Compress(std::string_view body, ContentEncoding encoding, int level);
+
+// Compresses a body sent in pieces: every piece comes out flushed, so the client can decode all it got so far.
+class StreamCompressor {
+  public:
+    StreamCompressor(ContentEncoding encoding, int level);
+
+    StreamCompressor(const StreamCompressor&) = delete;
+    StreamCompressor& operator=(const StreamCompressor&) = delete;
+
+    std::string Compress(std::string_view piece);
+    // Ends the compressed stream; returns the trailer to send after the last piece.
+    std::string Finish();
+
+  private:
+    std::string TakeOutput();
+
+    std::ostringstream sink_;
+    Poco::DeflatingOutputStream stream_;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Poco/Util/AbstractConfiguration.h>
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <string>
+
+#include "admission_controller.h"
+#include "logger.h"
+#include "nats_manager.h"
+#include "query_journal.h"
+#include "response_compression.h"
+#include "shared_query_store.h"
+#include "transport.h"
+
+// Runtime settings of the connector. Read from nats-connector.properties (or .ini/.xml) next to the executable,
+// see the sample nats-connector.properties in the repository root for all keys; missing keys keep the defaults.
+struct ServerConfig {
+    std::string nats_url = "nats://localhost:4222";
+    NatsOptions nats;  // connections, delivery threads, pending limits, buffering, async publishing
+    // Encoding of messages sent to MathCore, by subject prefix ("" applies to every subject).
+    std::map<std::string, WireEncoding> subject_encodings;
+
+    int http_port = 9000;
+    int http_backlog = 64;      // listen() backlog of the server socket
+    int http_max_threads = 16;  // Poco worker threads
+    int http_max_queued = 64;   // accepted connections waiting for a worker thread
+    std::chrono::milliseconds http_timeout{60000};
+    bool http_keep_alive = true;  // not for parked responses: DetachedResponse always closes the connection
+    CompressionSettings http_compression;  // gzip/deflate negotiated from Accept-Encoding
+
+    std::size_t completion_threads = 4;                      // threads finishing parked MathCore queries
+    std::chrono::milliseconds mathcore_request_timeout{0};  // 0 - wait as long as MathCore is alive
+    // Send each job to the least-loaded live MathCore instance and later requests about it to the same one,
+    // instead of subjects shared by all instances (see MathCoreInstances).
+    bool mathcore_routing = false;
+    // Concurrent identical /state and /logslist requests always share one MathCore request; a successful
+    // LogsList response can additionally be reused for this long (0 - not at all).
+    std::chrono::milliseconds logslist_cache_ttl{0};
+
+    // /start bodies are forwarded to MathCore byte for byte; this only decides whether they're checked to be
+    // well-formed JSON first (a streaming check, no DOM is built).
+    bool start_validate_json = true;
+    // Answer /start only once the NATS server confirmed the job (a flush), waiting at most this long; 0 - don't.
+    std::chrono::milliseconds start_flush_timeout{0};
+    // Part of every job ID; give each connector in front of the same MathCore (every replica too) its own
+    // number (0-999).
+    unsigned node_id = 0;
+
+    QueryJournalOptions query_state;  // persisted id -> query number table
+    SharedQueryOptions replica;       // replica mode: the table lives in a JetStream Key-Value bucket instead
+
+    logger::Level log_level = logger::Level::Info;
+
+    AdmissionLimits admission;
+
+    static ServerConfig Load(const Poco::Util::AbstractConfiguration& config);
+};
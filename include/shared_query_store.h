@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "nats.h"
+
+struct SharedQueryOptions {
+    bool enabled = false;  // replica mode: query numbers live in the bucket instead of state.path
+    // JetStream Key-Value bucket of the pairs, created if missing; "<bucket>_counter" (without TTL) holds the
+    // next query number.
+    std::string bucket = "nats_connector_queries";
+    int query_block = 100;                    // query numbers a replica reserves at once
+    std::chrono::seconds ttl{7 * 24 * 3600};  // the server drops pairs older than this; 0 - never
+};
+
+// Query number -> job ID pairs shared by connector replicas, so that /state?num=N works on any of them.
+class SharedQueryStore {
+  public:
+    virtual ~SharedQueryStore() = default;
+
+    // Reserves `count` consecutive query numbers no other replica gets; the first one goes to `first`.
+    virtual bool Reserve(int count, int& first) = 0;
+    virtual bool Put(int query, const std::string& id) = 0;
+    // Empty if `query` isn't known (never issued, forgotten or expired) or was stored before checkpoint `since`.
+    virtual std::string Get(int query, uint64_t since) = 0;
+    virtual void Remove(int query) = 0;
+    // Position in the store's history marking the MathCore startup seen just now, for Get(); 0 if it couldn't be
+    // taken. Replicas that see the same startup get the same checkpoint. May take a round trip to the server.
+    virtual uint64_t StartupCheckpoint() = 0;
+};
+
+// SharedQueryStore in JetStream Key-Value buckets: "query.<N>" keys hold job IDs, "next_query" the first query
+// number not reserved yet (taken by compare-and-set on its revision). The counter has a bucket of its own that
+// never expires: reset by the pairs' TTL after a quiet spell, it would hand out numbers of live pairs again.
+// "mathcore_startup" in the pairs' bucket marks the last MathCore startup.
+class JetStreamQueryStore : public SharedQueryStore {
+  public:
+    JetStreamQueryStore() = default;
+    ~JetStreamQueryStore() override { Close(); }
+
+    JetStreamQueryStore(const JetStreamQueryStore&) = delete;
+    JetStreamQueryStore& operator=(const JetStreamQueryStore&) = delete;
+
+    // Binds to the bucket of `options` over `conn`, creating it if needed; `conn` must outlive the store.
+    // Needs a server with JetStream enabled (nats-server -js).
+    bool Open(natsConnection* conn, const SharedQueryOptions& options);
+    void Close();
+
+    bool Reserve(int count, int& first) override;
+    bool Put(int query, const std::string& id) override;
+    std::string Get(int query, uint64_t since) override;
+    void Remove(int query) override;
+    // Revision of the startup marker: every pair stored later has a higher one. The first replica to see the
+    // startup rewrites the marker (compare-and-set); one finding it rewritten moments ago adopts it.
+    uint64_t StartupCheckpoint() override;
+
+  private:
+    bool OpenBucket(kvStore** kv, const std::string& bucket, std::chrono::seconds ttl);
+
+    jsCtx* js_ = nullptr;
+    kvStore* kv_ = nullptr;
+    kvStore* counter_ = nullptr;
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "nats.h"
+#include "nlohmann/json.hpp"
+
+// Payload encoding on the wire. JSON messages go out without headers; binary ones carry kContentTypeHeader,
+// so the receiving side can tell them apart per message.
+enum class WireEncoding {
+    Json,
+    MsgPack,
+    Cbor
+};
+
+const char* ToString(WireEncoding encoding);
+// Accepts "json", "msgpack" and "cbor" (case-insensitive).
+bool ParseWireEncoding(const std::string& name, WireEncoding& encoding);
+// Value of the content type header for `encoding`.
+const char* ContentType(WireEncoding encoding);
+// Serializes `message` as `encoding`.
+std::string EncodePayload(const nlohmann::json& message, WireEncoding encoding);
+
+// Owning view of a received natsMsg: subject and payload are exposed as string_views into the message itself,
+// JSON is only parsed when asked for. Destroys the message unless it's moved elsewhere or Release()d.
+class NatsMessage {
+  public:
+    explicit NatsMessage(natsMsg* msg) : msg_(msg) {}
+    ~NatsMessage();
+
+    NatsMessage(NatsMessage&& other) noexcept;
+    NatsMessage& operator=(NatsMessage&& other) noexcept;
+    NatsMessage(const NatsMessage&) = delete;
+    NatsMessage& operator=(const NatsMessage&) = delete;
+
+    std::string_view Subject() const;
+    std::string_view Data() const;
+    // Reply subject of a request, empty for plain messages.
+    std::string_view Reply() const;
+    // Value of header `name`, empty if the message has no such header.
+    std::string_view Header(const char* name) const;
+    // Taken from the content type header; messages without one are JSON.
+    WireEncoding Encoding() const;
+    // Decodes the payload (JSON, MessagePack or CBOR, see Encoding()) on first call.
+    // Throws nlohmann::json::parse_error for malformed payloads.
+    const nlohmann::json& Json() const;
+
+    natsMsg* get() const { return msg_; }
+    // Gives up ownership; the caller becomes responsible for natsMsg_Destroy().
+    natsMsg* Release();
+
+  private:
+    natsMsg* msg_;
+    mutable std::unique_ptr<nlohmann::json> json_;
+};
+
+// Outcome of a request sent through Transport::Request().
+struct NatsReply {
+    enum class Status {
+        Ok,         // `message` holds the response
+        Timeout,    // deadline passed before a response arrived
+        Cancelled,  // CancelRequest()/Disconnect() gave up on it, see `error`
+        Failed      // request couldn't be sent, see `error`
+    };
+
+    Status status = Status::Failed;
+    std::shared_ptr<NatsMessage> message;  // the response as received; parse it with message->Json() if needed
+    std::string error;
+    bool more = false;  // streamed reply (AsyncStreamRequest()): more chunks follow this one
+};
+
+// Traffic counters of a transport (natsConnection_GetStats() for NATS).
+struct NatsStats {
+    uint64_t in_msgs = 0;
+    uint64_t in_bytes = 0;
+    uint64_t out_msgs = 0;
+    uint64_t out_bytes = 0;
+    uint64_t reconnects = 0;
+};
+
+struct PendingRequest {
+    uint64_t id = 0;  // correlation id, 0 if the request wasn't sent
+    std::future<NatsReply> reply;
+};
+
+// Messaging as the request handlers see it: publish/subscribe on NATS subjects and request/reply with
+// deadlines, groups and streamed responses. NatsManager talks to a NATS server, LoopbackTransport delivers
+// within the process with the same subject semantics.
+class Transport {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using ReplyHandler = std::function<void(NatsReply&&)>;
+    // Handler of SubscribeRaw(); it may move the message out to keep it beyond the call.
+    using RawHandler = std::function<void(NatsMessage& message)>;
+    using Headers = std::vector<std::pair<std::string, std::string>>;
+
+    static constexpr const char* kContentTypeHeader = "Content-Type";
+    // Headers of streamed responses, see AsyncStreamRequest().
+    static constexpr const char* kChunkSeqHeader = "Chunk-Seq";
+    static constexpr const char* kChunkLastHeader = "Chunk-Last";
+
+    virtual ~Transport() = default;
+
+    // Encodes `message` as configured for `subject` (see SetSubjectEncoding()).
+    virtual bool Publish(const std::string& subject, const nlohmann::json& message) = 0;
+    // Publishes `payload` as is, for bytes that are forwarded unchanged (no parse/dump round trip).
+    virtual bool PublishRaw(const std::string& subject, std::string_view payload) = 0;
+    // Answers `request` on its reply subject with `payload` and `headers`; false if it has no reply subject.
+    virtual bool Respond(const NatsMessage& request, std::string_view payload, const Headers& headers = {}) = 0;
+    bool Subscribe(const std::string& subject,
+                   std::function<void(const std::string& subject, const nlohmann::json& message)> handler);
+    // Hands the received message to `handler` without copying subject or payload and without parsing it.
+    virtual bool SubscribeRaw(const std::string& subject, RawHandler handler) = 0;
+    virtual bool Unsubscribe(const std::string& subject) = 0;
+    // Waits until everything published before the call has reached the server and was confirmed by it.
+    // False on timeout, or if one of those messages couldn't be sent.
+    virtual bool Flush(std::chrono::milliseconds timeout) = 0;
+    // Like Flush(), but only waits for the way messages to `subject` take to the server (e.g. one connection
+    // of several), so unrelated traffic can't slow it down.
+    virtual bool Flush(const std::string& subject, std::chrono::milliseconds timeout) = 0;
+
+    // Messages published to subjects starting with `subject_prefix` are encoded with `encoding` (the longest
+    // matching prefix wins, JSON if none matches). Replies are decoded by their own content type, whatever
+    // was sent. Configure before any traffic - the table isn't guarded against concurrent use.
+    void SetSubjectEncoding(const std::string& subject_prefix, WireEncoding encoding);
+    WireEncoding EncodingFor(const std::string& subject) const;
+
+    // Publishes `message` with a reply subject of this transport and returns a future completed by the first
+    // response (or by Timeout once `deadline` passes).
+    // `group` tags the request so that CancelRequests() can fail it together with related ones.
+    PendingRequest Request(const std::string& subject,
+                           const nlohmann::json& message,
+                           Clock::time_point deadline = Clock::time_point::max(),
+                           const std::string& group = "");
+    // Continuation flavour of Request(): `on_reply` runs exactly once, on a delivery thread (or on the caller's
+    // thread if sending fails), so no thread has to block while the request is in flight.
+    // Returns the correlation id, or 0 if the request couldn't be sent.
+    virtual uint64_t AsyncRequest(const std::string& subject,
+                                  const nlohmann::json& message,
+                                  Clock::time_point deadline,
+                                  const std::string& group,
+                                  ReplyHandler on_reply) = 0;
+    // Like AsyncRequest(), but the response may come as a sequence of messages carrying kChunkSeqHeader
+    // (0, 1, 2, ...) with kChunkLastHeader set on the final one; a message without these headers is a
+    // complete response. `on_chunk` runs once per chunk, in order and never concurrently, with `more` set
+    // on all but the last call. A missing or reordered chunk fails the request.
+    virtual uint64_t AsyncStreamRequest(const std::string& subject,
+                                        const nlohmann::json& message,
+                                        Clock::time_point deadline,
+                                        const std::string& group,
+                                        ReplyHandler on_chunk) = 0;
+    // Completes a pending request with Status::Cancelled. Returns false if it was already completed.
+    virtual bool CancelRequest(uint64_t id, const std::string& reason) = 0;
+    // Cancels every pending request of `group`, waking exactly their waiters. Returns how many were cancelled.
+    virtual std::size_t CancelRequests(const std::string& group, const std::string& reason) = 0;
+
+    // Traffic counters of this transport. Returns false when not connected.
+    virtual bool GetStats(NatsStats& stats) const = 0;
+
+  protected:
+    // Headers announcing `encoding`: none for JSON, kContentTypeHeader otherwise.
+    static Headers HeadersFor(WireEncoding encoding);
+
+  private:
+    std::vector<std::pair<std::string, WireEncoding>> subject_encodings_;
+};
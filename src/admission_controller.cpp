@@ -0,0 +1,127 @@
+#include "admission_controller.h"
+
+#include <utility>
+#include <vector>
+
+AdmissionController::Ticket::~Ticket() { owner_.Release(endpoint_); }
+
+AdmissionController::AdmissionController(AdmissionLimits limits) :
+    limits_(std::move(limits)), timer_(&AdmissionController::RunTimer, this) {}
+
+AdmissionController::~AdmissionController() {
+    std::deque<Waiter> rejected;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        rejected.swap(waiters_);
+    }
+    timer_cv_.notify_all();
+    timer_.join();
+    for (auto& waiter : rejected) {
+        waiter.admitted(nullptr);
+    }
+}
+
+std::shared_ptr<AdmissionController::Ticket> AdmissionController::Admit(const std::string& endpoint) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!HasSlotLocked(endpoint)) {
+        return nullptr;
+    }
+    return TakeSlotLocked(endpoint);
+}
+
+bool AdmissionController::Park(const std::string& endpoint, Admitted admitted) {
+    std::shared_ptr<Ticket> ticket;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (HasSlotLocked(endpoint)) {
+            ticket = TakeSlotLocked(endpoint);  // freed since Admit()
+        } else {
+            if (stop_ || limits_.queue_timeout.count() <= 0 ||
+                static_cast<int>(waiters_.size()) >= limits_.max_queued) {
+                return false;
+            }
+            waiters_.push_back(Waiter{endpoint, Clock::now() + limits_.queue_timeout, std::move(admitted)});
+            if (waiters_.size() == 1) {
+                timer_cv_.notify_one();
+            }
+            return true;
+        }
+    }
+    admitted(std::move(ticket));
+    return true;
+}
+
+int AdmissionController::in_flight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_flight_;
+}
+
+int AdmissionController::queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int>(waiters_.size());
+}
+
+bool AdmissionController::HasSlotLocked(const std::string& endpoint) const {
+    if (limits_.max_in_flight > 0 && in_flight_ >= limits_.max_in_flight) {
+        return false;
+    }
+    auto limit = limits_.max_in_flight_per_endpoint.find(endpoint);
+    if (limit == limits_.max_in_flight_per_endpoint.end() || limit->second <= 0) {
+        return true;
+    }
+    auto current = in_flight_per_endpoint_.find(endpoint);
+    return current == in_flight_per_endpoint_.end() || current->second < limit->second;
+}
+
+std::shared_ptr<AdmissionController::Ticket> AdmissionController::TakeSlotLocked(const std::string& endpoint) {
+    ++in_flight_;
+    ++in_flight_per_endpoint_[endpoint];
+    return std::shared_ptr<Ticket>(new Ticket(*this, endpoint));
+}
+
+void AdmissionController::Release(const std::string& endpoint) {
+    std::vector<std::pair<Admitted, std::shared_ptr<Ticket>>> granted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --in_flight_;
+        --in_flight_per_endpoint_[endpoint];
+        // Waiters may be queued for different endpoints, so the oldest one isn't necessarily the one that fits.
+        for (auto it = waiters_.begin(); it != waiters_.end();) {
+            if (!HasSlotLocked(it->endpoint)) {
+                ++it;
+                continue;
+            }
+            granted.emplace_back(std::move(it->admitted), TakeSlotLocked(it->endpoint));
+            it = waiters_.erase(it);
+        }
+    }
+    for (auto& entry : granted) {
+        entry.first(std::move(entry.second));
+    }
+}
+
+void AdmissionController::RunTimer() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+        if (waiters_.empty()) {
+            timer_cv_.wait(lock);
+            continue;
+        }
+        const Clock::time_point now = Clock::now();
+        if (now < waiters_.front().deadline) {
+            timer_cv_.wait_until(lock, waiters_.front().deadline);
+            continue;
+        }
+        std::vector<Admitted> expired;
+        while (!waiters_.empty() && waiters_.front().deadline <= now) {
+            expired.push_back(std::move(waiters_.front().admitted));
+            waiters_.pop_front();
+        }
+        lock.unlock();
+        for (auto& admitted : expired) {
+            admitted(nullptr);
+        }
+        lock.lock();
+    }
+}
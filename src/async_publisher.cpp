@@ -0,0 +1,143 @@
+#include "async_publisher.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "logger.h"
+#include "metrics.h"
+
+namespace {
+
+struct PublisherMetrics {
+    // Shared by the publishers of all connections, so each one only adds and removes its own messages.
+    metrics::Gauge& queue_depth = metrics::Global().GetGauge(
+        "nats_connector_nats_publish_queue_depth", "Messages waiting for the NATS publisher threads");
+    metrics::Counter& rejected = metrics::Global().GetCounter(
+        "nats_connector_nats_publish_rejected_total", "Publishes that found the publish queue full");
+    metrics::Histogram& flush = metrics::Global().GetHistogram(
+        "nats_connector_nats_flush_seconds", "Flushes of the NATS connection until the server confirmed them");
+};
+
+PublisherMetrics& Metrics() {
+    static PublisherMetrics* publisher_metrics = new PublisherMetrics();
+    return *publisher_metrics;
+}
+
+}  // namespace
+
+AsyncPublisher::AsyncPublisher(AsyncPublishOptions options, PublishFn publish, FlushFn flush) :
+    options_(std::move(options)), publish_(std::move(publish)), flush_(std::move(flush)) {
+    thread_ = std::thread(&AsyncPublisher::Run, this);
+}
+
+AsyncPublisher::~AsyncPublisher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_.notify_one();
+    room_.notify_all();
+    thread_.join();
+}
+
+bool AsyncPublisher::Enqueue(Message message) {
+    const std::size_t size = message.payload.size();
+    // A message larger than max_queued_bytes still goes through once the queue is empty.
+    auto has_room = [this, size]() {
+        if (stop_ || queued_msgs_ == 0) {
+            return true;
+        }
+        bool msgs_ok = options_.max_queued == 0 || queued_msgs_ < options_.max_queued;
+        bool bytes_ok = options_.max_queued_bytes == 0 || queued_bytes_ + size <= options_.max_queued_bytes;
+        return msgs_ok && bytes_ok;
+    };
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!room_.wait_for(lock, options_.queue_timeout, has_room) || stop_) {
+        Metrics().rejected.Add();
+        LOG_WARN() << "Publish queue full (" << queued_msgs_ << " messages, " << queued_bytes_
+                   << " bytes), dropping message to " << message.subject << "\n";
+        return false;
+    }
+    queue_.push_back(Entry{std::move(message), nullptr});
+    ++queued_msgs_;
+    queued_bytes_ += size;
+    Metrics().queue_depth.Add(1);
+    work_.notify_one();
+    return true;
+}
+
+bool AsyncPublisher::Flush(std::chrono::milliseconds timeout) {
+    auto waiter = std::make_shared<FlushWaiter>();
+    waiter->deadline = std::chrono::steady_clock::now() + timeout;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stop_) {
+        return false;
+    }
+    queue_.push_back(Entry{{}, waiter});
+    work_.notify_one();
+    return flushed_.wait_until(lock, waiter->deadline, [&waiter]() { return waiter->done; }) && waiter->ok;
+}
+
+std::size_t AsyncPublisher::queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queued_msgs_;
+}
+
+void AsyncPublisher::Run() {
+    while (true) {
+        std::deque<Entry> batch;
+        std::size_t batch_msgs = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;  // stopping and drained
+            }
+            batch.swap(queue_);
+            batch_msgs = queued_msgs_;
+            queued_msgs_ = 0;
+            queued_bytes_ = 0;
+        }
+        Metrics().queue_depth.Add(-static_cast<int64_t>(batch_msgs));
+        room_.notify_all();
+
+        // Each marker remembers whether everything queued before it was accepted.
+        bool published = true;
+        std::vector<std::pair<std::shared_ptr<FlushWaiter>, bool>> waiters;
+        auto latest = std::chrono::steady_clock::time_point::min();
+        for (const Entry& entry : batch) {
+            if (entry.flush) {
+                waiters.emplace_back(entry.flush, published);
+                latest = std::max(latest, entry.flush->deadline);
+            } else if (!publish_(entry.message)) {
+                published = false;
+                if (entry.message.on_failure) {
+                    entry.message.on_failure();
+                }
+            }
+        }
+        if (waiters.empty()) {
+            continue;
+        }
+
+        // One flush covers every marker of the round; it waits as long as the most patient caller.
+        bool flushed = false;
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(latest - std::chrono::steady_clock::now());
+        if (timeout.count() > 0) {
+            const auto start = metrics::Histogram::Clock::now();
+            flushed = flush_(timeout);
+            Metrics().flush.RecordSince(start);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& waiter : waiters) {
+                waiter.first->done = true;
+                waiter.first->ok = waiter.second && flushed;
+            }
+        }
+        flushed_.notify_all();
+    }
+}
@@ -0,0 +1,61 @@
+#include "completion_pool.h"
+
+#include <exception>
+
+#include "logger.h"
+
+CompletionPool::CompletionPool(std::size_t threads) {
+    if (threads == 0) {
+        threads = 1;
+    }
+    threads_.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back(&CompletionPool::Run, this);
+    }
+}
+
+CompletionPool::~CompletionPool() { Stop(); }
+
+void CompletionPool::Post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!stop_) {
+            tasks_.push_back(std::move(task));
+            cv_.notify_one();
+            return;
+        }
+    }
+    task();
+}
+
+void CompletionPool::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+}
+
+void CompletionPool::Run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;  // stopping and drained
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        try {
+            task();
+        } catch (const std::exception& e) {
+            LOG_ERROR() << "Completion task failed: " << e.what() << std::endl;
+        }
+    }
+}
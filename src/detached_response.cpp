@@ -0,0 +1,145 @@
+#include "detached_response.h"
+
+#include <Poco/Net/HTTPServerRequestImpl.h>
+#include <Poco/Timespan.h>
+
+#include <cstdio>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+
+#include "logger.h"
+
+namespace {
+
+// A client that stopped reading must not pin a completion thread forever.
+const Poco::Timespan kSendTimeout(30, 0);
+
+}  // namespace
+
+std::shared_ptr<DetachedResponse> DetachedResponse::Detach(Poco::Net::HTTPServerRequest& request) {
+    auto* impl = dynamic_cast<Poco::Net::HTTPServerRequestImpl*>(&request);
+    if (!impl) {
+        return nullptr;
+    }
+    return std::shared_ptr<DetachedResponse>(new DetachedResponse(impl->detachSocket()));
+}
+
+DetachedResponse::~DetachedResponse() {
+    if (!sent_) {
+        Close();
+    }
+}
+
+void DetachedResponse::AddHeader(const std::string& name, const std::string& value) {
+    headers_.emplace_back(name, value);
+}
+
+void DetachedResponse::Send(Poco::Net::HTTPResponse::HTTPStatus status,
+                            const std::string& content_type,
+                            std::string_view body) {
+    if (sent_) {
+        return;
+    }
+    sent_ = true;
+
+    Poco::Net::HTTPResponse response(status);
+    response.setContentType(content_type);
+    response.setContentLength(static_cast<std::streamsize>(body.size()));
+
+    try {
+        socket_.setSendTimeout(kSendTimeout);
+        WriteHead(response);
+        SendAll(body.data(), body.size());
+        socket_.shutdownSend();
+    } catch (const std::exception& e) {
+        LOG_WARN() << "Failed to send parked response: " << e.what() << std::endl;
+    }
+    Close();
+}
+
+bool DetachedResponse::SendChunk(const std::string& content_type, std::string_view chunk) {
+    if (sent_ || failed_) {
+        return false;
+    }
+    if (!chunked_ && content_type_.empty()) {
+        content_type_ = content_type;
+    }
+    if (chunk.empty()) {
+        return true;  // an empty chunk would end the body
+    }
+
+    try {
+        if (!chunked_) {
+            Poco::Net::HTTPResponse response(Poco::Net::HTTPResponse::HTTP_OK);
+            response.setContentType(content_type);
+            response.setChunkedTransferEncoding(true);
+            socket_.setSendTimeout(kSendTimeout);
+            WriteHead(response);
+            chunked_ = true;
+        }
+        char size_line[32];
+        int size_len = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", chunk.size());
+        SendAll(size_line, static_cast<std::size_t>(size_len));
+        SendAll(chunk.data(), chunk.size());
+        SendAll("\r\n", 2);
+    } catch (const std::exception& e) {
+        LOG_WARN() << "Failed to send response chunk: " << e.what() << std::endl;
+        failed_ = true;
+        return false;
+    }
+    return true;
+}
+
+void DetachedResponse::FinishChunked(bool complete) {
+    if (sent_) {
+        return;
+    }
+    if (complete && !chunked_ && !failed_) {
+        // Every chunk was empty, so not even the headers are out.
+        Send(Poco::Net::HTTPResponse::HTTP_OK, content_type_, "");
+        return;
+    }
+    sent_ = true;
+
+    if (complete && chunked_ && !failed_) {
+        try {
+            SendAll("0\r\n\r\n", 5);
+            socket_.shutdownSend();
+        } catch (const std::exception& e) {
+            LOG_WARN() << "Failed to finish chunked response: " << e.what() << std::endl;
+        }
+    }
+    Close();
+}
+
+void DetachedResponse::Close() {
+    try {
+        socket_.close();
+    } catch (const std::exception&) {
+        // already gone
+    }
+}
+
+void DetachedResponse::WriteHead(Poco::Net::HTTPResponse& response) {
+    for (const auto& header : headers_) {
+        response.set(header.first, header.second);
+    }
+    // The socket can't go back to HTTPServer's keep-alive loop once detached.
+    response.setKeepAlive(false);
+    std::ostringstream head;
+    response.write(head);
+    const std::string head_str = head.str();
+    SendAll(head_str.data(), head_str.size());
+}
+
+void DetachedResponse::SendAll(const char* data, std::size_t size) {
+    while (size > 0) {
+        int sent = socket_.sendBytes(data, static_cast<int>(size));
+        if (sent <= 0) {
+            throw std::runtime_error("connection closed by peer");
+        }
+        data += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+}
@@ -1,15 +1,201 @@
 #include "http_handler.h"
 
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Timespan.h>
 #include <Poco/URI.h>
 
+#include <algorithm>
 #include <chrono>
+#include <deque>
 #include <fstream>
-#include <iomanip>
 #include <mutex>
 
+#include "detached_response.h"
 #include "logger.h"
+#include "metrics.h"
 #include "nats_manager.h"
 
+namespace {
+
+const char kMathAlivePrefix[] = "IsMathAlive.";
+
+struct Heartbeat {
+    std::string event;
+    double load = -1;  // negative - not reported
+};
+
+// Extracts the top-level "event" and "load" fields of a heartbeat. JSON heartbeats are parsed without building
+// the rest of the document; binary ones are decoded whole (no number formatting involved, so that's cheap).
+Heartbeat ParseHeartbeat(const NatsMessage& message) {
+    nlohmann::json parsed_heartbeat;
+    if (message.Encoding() == WireEncoding::Json) {
+        nlohmann::json::parser_callback_t keep_fields = [](int depth,
+                                                           nlohmann::json::parse_event_t event,
+                                                           nlohmann::json& parsed) {
+            if (event == nlohmann::json::parse_event_t::key && depth == 1) {
+                return parsed == "event" || parsed == "load";
+            }
+            return depth <= 1;
+        };
+        std::string_view payload = message.Data();
+        parsed_heartbeat = nlohmann::json::parse(payload.begin(), payload.end(), keep_fields, false);
+    } else {
+        try {
+            parsed_heartbeat = message.Json();
+        } catch (const nlohmann::json::exception&) {
+            return Heartbeat{};
+        }
+    }
+    Heartbeat heartbeat;
+    if (!parsed_heartbeat.is_object()) {
+        return heartbeat;
+    }
+    if (parsed_heartbeat.contains("event") && parsed_heartbeat["event"].is_string()) {
+        heartbeat.event = parsed_heartbeat["event"].get<std::string>();
+    }
+    if (parsed_heartbeat.contains("load") && parsed_heartbeat["load"].is_number()) {
+        heartbeat.load = std::max(0.0, parsed_heartbeat["load"].get<double>());
+    }
+    return heartbeat;
+}
+
+// Instance token of an IsMathAlive.<instance> subject.
+std::string HeartbeatInstance(std::string_view subject) {
+    if (subject.size() > sizeof(kMathAlivePrefix) - 1) {
+        subject.remove_prefix(sizeof(kMathAlivePrefix) - 1);
+    }
+    return std::string(subject);
+}
+
+// JSON text of a MathCore response for HTTP clients: JSON payloads are forwarded as they are, binary ones are
+// converted into `converted`. Throws nlohmann::json::exception for malformed binary payloads.
+std::string_view JsonBody(const NatsMessage& message, std::string& converted) {
+    if (message.Encoding() == WireEncoding::Json) {
+        return message.Data();
+    }
+    converted = message.Json().dump();
+    return converted;
+}
+
+// Chunks of one streamed log waiting for a slow client; past this the client is cut off, so memory per
+// /getlog request stays bounded whatever the size of the log.
+constexpr std::size_t kMaxBufferedLogChunks = 16;
+
+// Reads the whole request body straight into one buffer, sized up front when Content-Length is known.
+std::string ReadBody(Poco::Net::HTTPServerRequest& request) {
+    std::istream& stream = request.stream();
+    std::string body;
+    std::streamsize length = request.getContentLength();
+    if (length != Poco::Net::HTTPMessage::UNKNOWN_CONTENT_LENGTH) {
+        body.resize(static_cast<std::size_t>(length));
+        stream.read(body.data(), length);
+        body.resize(static_cast<std::size_t>(stream.gcount()));
+        return body;
+    }
+
+    // Chunked body - grow the buffer as data arrives.
+    char chunk[8192];
+    while (stream.read(chunk, sizeof(chunk)) || stream.gcount() > 0) {
+        body.append(chunk, static_cast<std::size_t>(stream.gcount()));
+    }
+    return body;
+}
+
+// Latency of the stages of one endpoint's requests.
+struct EndpointMetrics {
+    explicit EndpointMetrics(const char* endpoint) :
+        name(endpoint),
+        http(Get("nats_connector_http_request_seconds", "Request arrival to the response (or its last chunk) written")),
+        mathcore(Get("nats_connector_mathcore_wait_seconds", "MathCore request sent to its (first) reply received")),
+        queued(Get("nats_connector_completion_queue_seconds", "MathCore reply received to its continuation start")),
+        completion(Get("nats_connector_completion_seconds", "Continuation run time: decode, serialize, write")) {}
+
+    metrics::Histogram& Get(const char* metric, const char* help) const {
+        return metrics::Global().GetHistogram(metric, help, std::string("endpoint=\"") + name + "\"");
+    }
+
+    const char* name;
+    metrics::Histogram& http;
+    metrics::Histogram& mathcore;
+    metrics::Histogram& queued;
+    metrics::Histogram& completion;
+};
+
+// Metrics of `endpoint`; unknown names share "other". Lock-free after the first call.
+const EndpointMetrics& MetricsFor(std::string_view endpoint) {
+    static const EndpointMetrics all[] = {EndpointMetrics("start"),
+                                          EndpointMetrics("state"),
+                                          EndpointMetrics("logslist"),
+                                          EndpointMetrics("getlog"),
+                                          EndpointMetrics("loglevel"),
+                                          EndpointMetrics("metrics"),
+                                          EndpointMetrics("other")};
+    for (const EndpointMetrics& metrics : all) {
+        if (endpoint == metrics.name) {
+            return metrics;
+        }
+    }
+    return all[std::size(all) - 1];
+}
+
+constexpr const char* kPrometheusContentType = "text/plain; version=0.0.4; charset=utf-8";
+
+// Prints "<kind> ID=<id>" lazily, so disabled log statements don't pay for building the label.
+struct RequestLabel {
+    const char* kind;
+    const std::string& id;
+};
+
+std::ostream& operator<<(std::ostream& os, const RequestLabel& label) {
+    os << label.kind;
+    if (!label.id.empty()) {
+        os << " ID=" << label.id;
+    }
+    return os;
+}
+
+// Responders writing onto `detached`; `ticket` holds the admission slot until the last of them is gone.
+StreamResponder DetachedResponder(const std::shared_ptr<DetachedResponse>& detached,
+                                  const std::shared_ptr<AdmissionController::Ticket>& ticket,
+                                  ContentEncoding encoding,
+                                  const CompressionSettings& compression,
+                                  metrics::Histogram& latency,
+                                  metrics::Histogram::Clock::time_point received) {
+    // Streamed bodies are compressed piece by piece, whatever their size; created with the first piece.
+    auto stream_compressor = std::make_shared<std::unique_ptr<StreamCompressor>>();
+    StreamResponder responder;
+    responder.send = [detached, ticket, encoding, compression, &latency, received](std::string_view body) {
+        if (encoding != ContentEncoding::Identity && body.size() >= compression.min_size) {
+            std::string compressed = Compress(body, encoding, compression.level);
+            detached->AddHeader("Content-Encoding", ToString(encoding));
+            detached->Send(Poco::Net::HTTPResponse::HTTP_OK, "application/json", compressed);
+        } else {
+            detached->Send(Poco::Net::HTTPResponse::HTTP_OK, "application/json", body);
+        }
+        latency.RecordSince(received);
+    };
+    responder.write = [detached, ticket, encoding, compression, stream_compressor](std::string_view chunk) {
+        if (encoding == ContentEncoding::Identity) {
+            return detached->SendChunk("application/json", chunk);
+        }
+        if (!*stream_compressor) {
+            *stream_compressor = std::make_unique<StreamCompressor>(encoding, compression.level);
+            detached->AddHeader("Content-Encoding", ToString(encoding));
+        }
+        return detached->SendChunk("application/json", (*stream_compressor)->Compress(chunk));
+    };
+    responder.finish = [detached, ticket, stream_compressor, &latency, received](bool complete) {
+        if (complete && *stream_compressor) {
+            detached->SendChunk("application/json", (*stream_compressor)->Finish());
+        }
+        detached->FinishChunked(complete);
+        latency.RecordSince(received);
+    };
+    return responder;
+}
+
+}  // namespace
+
 inline std::string ToString(Status s) {
     switch (s) {
         case Status::Error: return "Error";
@@ -18,21 +204,25 @@ inline std::string ToString(Status s) {
     }
 }
 
-int FileRequestHandler::query_number_ = 0;
-std::unordered_map<std::string, int> FileRequestHandler::id_query_map_;
-std::unordered_map<std::string, int> FileRequestHandler::persisted_id_query_map_;
-std::mutex FileRequestHandler::state_mutex_;
-bool FileRequestHandler::state_loaded_ = false;
-const std::string FileRequestHandler::kStateFilePath = "query_state.json";
 std::atomic<bool> FileRequestHandler::mathcore_alive_{true};
-std::atomic<uint64_t> FileRequestHandler::mathcore_startup_epoch_{0};
 std::chrono::steady_clock::time_point FileRequestHandler::last_mathcore_heartbeat_ = std::chrono::steady_clock::now();
 std::mutex FileRequestHandler::health_mutex_;
+std::condition_variable FileRequestHandler::health_cv_;
 bool FileRequestHandler::mathcore_subscription_active_ = false;
+bool FileRequestHandler::watchdog_stop_ = false;
+std::thread FileRequestHandler::watchdog_;
+Transport* FileRequestHandler::watched_transport_ = nullptr;
+QueryRegistry* FileRequestHandler::watched_queries_ = nullptr;
+MathCoreInstances* FileRequestHandler::watched_instances_ = nullptr;
+CompletionPool* FileRequestHandler::watched_pool_ = nullptr;
 const std::chrono::seconds FileRequestHandler::kMathAliveTimeout(60);
 const std::string FileRequestHandler::kMathAliveSubject = "IsMathAlive.*";
+const std::string FileRequestHandler::kMathCoreRequestGroup = "mathcore";
 
-bool FileRequestHandler::StartMathAliveWatcher(NatsManager& nats_manager) {
+bool FileRequestHandler::StartMathAliveWatcher(Transport& transport,
+                                               QueryRegistry& queries,
+                                               MathCoreInstances& instances,
+                                               CompletionPool& pool) {
     std::lock_guard<std::mutex> lock(health_mutex_);
     if (mathcore_subscription_active_) {
         return true;
@@ -41,85 +231,165 @@ bool FileRequestHandler::StartMathAliveWatcher(NatsManager& nats_manager) {
     // Consider MathCore healthy until we miss the first heartbeat window.
     last_mathcore_heartbeat_ = std::chrono::steady_clock::now();
     mathcore_alive_.store(true, std::memory_order_relaxed);
-    mathcore_subscription_active_ =
-        nats_manager.Subscribe(kMathAliveSubject, [](const std::string&, const nlohmann::json& message) {
-            FileRequestHandler::RecordMathCoreHeartbeat(message);
-        });
+    watched_transport_ = &transport;
+    watched_queries_ = &queries;
+    watched_instances_ = &instances;
+    watched_pool_ = &pool;
+    mathcore_subscription_active_ = transport.SubscribeRaw(kMathAliveSubject, [](NatsMessage& message) {
+        Heartbeat heartbeat = ParseHeartbeat(message);
+        FileRequestHandler::RecordMathCoreHeartbeat(
+            HeartbeatInstance(message.Subject()), heartbeat.event, heartbeat.load);
+    });
 
     if (!mathcore_subscription_active_) {
         mathcore_alive_.store(false, std::memory_order_relaxed);
-        logger::log_error() << "Failed to subscribe to MathCore heartbeat subject: " << kMathAliveSubject << std::endl;
+        LOG_ERROR() << "Failed to subscribe to MathCore heartbeat subject: " << kMathAliveSubject << std::endl;
+        return false;
     }
 
-    return mathcore_subscription_active_;
+    watchdog_stop_ = false;
+    watchdog_ = std::thread(&FileRequestHandler::RunMathAliveWatchdog);
+    return true;
 }
 
-bool FileRequestHandler::IsMathCoreAlive() {
+void FileRequestHandler::StopMathAliveWatcher() {
+    {
+        std::lock_guard<std::mutex> lock(health_mutex_);
+        watchdog_stop_ = true;
+    }
+    health_cv_.notify_all();
+    if (watchdog_.joinable()) {
+        watchdog_.join();
+    }
+
     std::lock_guard<std::mutex> lock(health_mutex_);
-    auto now = std::chrono::steady_clock::now();
-    if (now - last_mathcore_heartbeat_ > kMathAliveTimeout) {
-        bool was_alive = mathcore_alive_.exchange(false, std::memory_order_relaxed);
-        if (was_alive) {
-            logger::log_error() << "MathCore heartbeat timeout" << std::endl;
-        }
+    if (mathcore_subscription_active_ && watched_transport_) {
+        watched_transport_->Unsubscribe(kMathAliveSubject);
     }
+    mathcore_subscription_active_ = false;
+    watched_transport_ = nullptr;
+    watched_queries_ = nullptr;
+    watched_instances_ = nullptr;
+    watched_pool_ = nullptr;
+}
+
+bool FileRequestHandler::IsMathCoreAlive() {
+    // Kept up to date by RecordMathCoreHeartbeat() and the watchdog thread.
     return mathcore_alive_.load(std::memory_order_relaxed);
 }
 
-void FileRequestHandler::RecordMathCoreHeartbeat(const nlohmann::json& payload) {
-    bool is_startup = false;
-    bool was_alive = true;
-    if (payload.contains("event") && payload["event"].is_string()) {
-        is_startup = (payload["event"].get<std::string>() == "startup");
+void FileRequestHandler::RunMathAliveWatchdog() {
+    std::unique_lock<std::mutex> lock(health_mutex_);
+    while (!watchdog_stop_) {
+        if (!mathcore_alive_.load(std::memory_order_relaxed)) {
+            // Nothing to time out until a heartbeat revives MathCore.
+            health_cv_.wait(lock);
+            continue;
+        }
+
+        // Every instance times out on its own; before the first heartbeat arrives, MathCore as a whole does.
+        MathCoreInstances* instances = watched_instances_;
+        auto deadline = last_mathcore_heartbeat_ + kMathAliveTimeout;
+        if (instances) {
+            deadline = std::min(deadline, instances->NextExpiry(kMathAliveTimeout));
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (now < deadline) {
+            // Heartbeats only move the deadline forward, so they don't need to wake us.
+            health_cv_.wait_until(lock, deadline);
+            continue;
+        }
+
+        std::vector<std::string> expired;
+        bool any_alive = false;
+        if (instances) {
+            expired = instances->Expire(now, kMathAliveTimeout);
+            any_alive = instances->alive_count() > 0;
+        }
+        const bool routing = instances && instances->routing();
+        if (!any_alive) {
+            mathcore_alive_.store(false, std::memory_order_relaxed);
+        }
+        Transport* transport = watched_transport_;
+        lock.unlock();
+        for (const std::string& instance : expired) {
+            LOG_WARN() << "MathCore instance " << instance << " heartbeat timeout" << std::endl;
+            if (routing && transport) {
+                transport->CancelRequests(RequestGroup(MathCoreInstances::Route{instance, 0}),
+                                          "MathCore is unavailable");
+            }
+        }
+        if (!any_alive) {
+            LOG_WARN() << "MathCore heartbeat timeout" << std::endl;
+            if (transport) {
+                transport->CancelRequests(kMathCoreRequestGroup, "MathCore is unavailable");
+            }
+        }
+        lock.lock();
     }
+}
+
+void FileRequestHandler::RecordMathCoreHeartbeat(const std::string& instance, const std::string& event, double load) {
+    bool was_alive = true;
+    MathCoreInstances::Update update;
+    bool routing = false;
+    Transport* transport = nullptr;
+    QueryRegistry* queries = nullptr;
+    CompletionPool* pool = nullptr;
 
     // strange block because of lock_guard scope (inside we're holding health_mutex_ and outside we're not)
     {
         std::lock_guard<std::mutex> lock(health_mutex_);
         last_mathcore_heartbeat_ = std::chrono::steady_clock::now();
         was_alive = mathcore_alive_.exchange(true, std::memory_order_relaxed);
-        if (is_startup) {
-            mathcore_startup_epoch_.fetch_add(1, std::memory_order_relaxed);
+        if (watched_instances_) {
+            update = watched_instances_->Record(instance, event, load, last_mathcore_heartbeat_);
+            routing = watched_instances_->routing();
         }
+        transport = watched_transport_;
+        queries = watched_queries_;
+        pool = watched_pool_;
+    }
+    if (!was_alive) {
+        health_cv_.notify_all();  // watchdog sleeps without a deadline while MathCore is down
     }
 
-    if (is_startup) {
-        logger::log() << "MathCore startup heartbeat received" << std::endl;
-        HandleMathCoreStartup();
+    if (update.restarted && routing) {
+        LOG_INFO() << "MathCore instance " << instance << " startup heartbeat received, " << update.lost_jobs.size()
+                   << " of its jobs lost" << std::endl;
+        // Jobs of the other instances are unaffected; replies about this one's will never come.
+        if (transport) {
+            transport->CancelRequests(RequestGroup(MathCoreInstances::Route{instance, 0}), "MathCore was restarted");
+        }
+        // In replica mode every Forget() is a round trip to the shared store - not for this delivery thread.
+        if (queries && pool) {
+            pool->Post([queries, lost_jobs = std::move(update.lost_jobs)]() {
+                for (const std::string& id : lost_jobs) {
+                    queries->Forget(id);
+                }
+            });
+        }
+    } else if (update.restarted) {
+        LOG_INFO() << "MathCore startup heartbeat received from instance " << instance << std::endl;
+        // Replies to requests sent before the restart will never come - wake their waiters right away.
+        if (transport) {
+            transport->CancelRequests(kMathCoreRequestGroup, "MathCore was restarted");
+        }
+        // Persisted pairs stay: their results can still be fetched after MathCore comes back. In replica mode
+        // the reset asks the shared store, so it runs on the pool.
+        if (queries && pool) {
+            pool->Post([queries]() { queries->ResetActive(); });
+        }
     } else if (!was_alive) {
-        logger::log() << "MathCore heartbeat received after timeout" << std::endl;
+        LOG_INFO() << "MathCore heartbeat received after timeout" << std::endl;
+    } else if (update.revived) {
+        LOG_INFO() << "MathCore instance " << instance << " is alive" << std::endl;
     }
 }
 
-void FileRequestHandler::HandleMathCoreStartup() {
-    std::lock_guard<std::mutex> lock(state_mutex_);
-    id_query_map_.clear();
-    query_number_ = 0;
-    state_loaded_ = true;
-    PersistStateLocked();
-}
-
 std::string FileRequestHandler::GenerateID() {
-    auto now = std::chrono::system_clock::now();
-    auto time_t_now = std::chrono::system_clock::to_time_t(now);
-    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count() % 1000000;
-
-    // Format: YYYYMMDD_HHMMSS
-    std::ostringstream oss;
-    oss << std::put_time(std::localtime(&time_t_now), "%Y%m%d_%H%M%S");
-
-    return oss.str();
-}
-
-std::string FileRequestHandler::GetID(int Query) {
-    std::lock_guard<std::mutex> lock(state_mutex_);
-    EnsureStateLoadedLocked();
-    for (const auto& pair : id_query_map_) {
-        if (pair.second == Query) {
-            return pair.first;
-        }
-    }
-    return "";
+    const IdGenerator::Id id = ids_.Next();
+    return std::string(id.view());
 }
 
 int FileRequestHandler::ParseQuery(std::string& uri) {
@@ -153,275 +423,652 @@ std::string FileRequestHandler::ParseLogId(const std::string& uri) {
     return "";
 }
 
-int FileRequestHandler::NextQuery(const std::string& ID) {
-    std::lock_guard<std::mutex> lock(state_mutex_);
-    EnsureStateLoadedLocked();
-    ++query_number_;
-    id_query_map_[ID] = query_number_;
-    persisted_id_query_map_[ID] = query_number_;
-    PersistStateLocked();
-    return query_number_;
-}
-
-void FileRequestHandler::WaitForResponse(uint64_t startup_epoch,
-                                         const std::string& response_subject,
-                                         const std::string& request_name,
-                                         std::future<nlohmann::json>& future,
-                                         const std::function<nlohmann::json(const std::string&)>& make_error,
-                                         const std::function<void()>& on_restart_cleanup,
-                                         nlohmann::json& response_json) {
-    bool done = false;
-    while (!done) {
-        if (startup_epoch != mathcore_startup_epoch_.load(std::memory_order_relaxed)) {
-            nats_manager_.Unsubscribe(response_subject);
-            response_json = make_error("MathCore was restarted");
-            if (on_restart_cleanup) {
-                on_restart_cleanup();
-            }
-            logger::log_error() << "MathCore restarted while waiting for " << request_name << " response" << std::endl;
-            done = true;
-            break;
+std::string FileRequestHandler::JobSubject(const char* prefix,
+                                           const MathCoreInstances::Route& route,
+                                           const std::string& id) {
+    std::string subject = prefix;
+    if (!route.instance.empty()) {
+        subject += route.instance;
+        subject += '.';
+    }
+    subject += id;
+    return subject;
+}
+
+std::string FileRequestHandler::RequestGroup(const MathCoreInstances::Route& route) {
+    return route.instance.empty() ? kMathCoreRequestGroup : kMathCoreRequestGroup + "." + route.instance;
+}
+
+bool FileRequestHandler::IsMathCoreAlive(const MathCoreInstances::Route& route) const {
+    return route.instance.empty() ? IsMathCoreAlive() : instances_.IsAlive(route);
+}
+
+void FileRequestHandler::CheckMissedMathCoreEvents(const MathCoreInstances::Route& route, uint64_t request_id) {
+    // Restart/timeout events cancel pending requests of the route's group, but one that happened
+    // before our request got registered couldn't - check for it once here.
+    if (instances_.Restarted(route)) {
+        transport_.CancelRequest(request_id, "MathCore was restarted");
+    } else if (!IsMathCoreAlive(route)) {
+        transport_.CancelRequest(request_id, "MathCore is unavailable");
+    }
+}
+
+bool FileRequestHandler::CompleteMathCoreRequest(const MathCoreInstances& instances,
+                                                 const MathCoreInstances::Route& route,
+                                                 NatsReply& reply,
+                                                 const char* request_kind,
+                                                 const std::string& request_id,
+                                                 const std::function<nlohmann::json(const std::string&)>& make_error,
+                                                 const std::function<void()>& on_restart_cleanup,
+                                                 nlohmann::json& error_json) {
+    // Called for the reply, a MathCore restart, the heartbeat watchdog or the request deadline.
+    if (reply.status == NatsReply::Status::Ok) {
+        LOG_DEBUG() << "Received MathCore response for " << RequestLabel{request_kind, request_id} << std::endl;
+        return true;
+    }
+
+    error_json = make_error(reply.error);
+    if (instances.Restarted(route)) {
+        if (on_restart_cleanup) {
+            on_restart_cleanup();
         }
+        LOG_WARN() << "MathCore restarted while waiting for " << RequestLabel{request_kind, request_id} << " response"
+                   << std::endl;
+    } else {
+        LOG_WARN() << RequestLabel{request_kind, request_id} << " failed: " << reply.error << std::endl;
+    }
+    return false;
+}
 
-        if (!IsMathCoreAlive()) {
-            nats_manager_.Unsubscribe(response_subject);
-            response_json = make_error("MathCore is unavailable");
-            logger::log_error() << "MathCore unavailable while waiting for " << request_name << " response"
-                                << std::endl;
-            done = true;
-            break;
+Transport::ReplyHandler FileRequestHandler::OnCompletionPool(const char* endpoint,
+                                                             std::function<void(NatsReply&)> continuation) {
+    CompletionPool& pool = completion_pool_;
+    const EndpointMetrics& stages = MetricsFor(endpoint);
+    const auto sent = metrics::Histogram::Clock::now();
+    return [&pool, &stages, sent, continuation = std::move(continuation)](NatsReply&& reply) {
+        stages.mathcore.RecordSince(sent);
+        const auto received = metrics::Histogram::Clock::now();
+        pool.Post([&stages, received, continuation, reply = std::move(reply)]() mutable {
+            stages.queued.RecordSince(received);
+            const auto started = metrics::Histogram::Clock::now();
+            continuation(reply);
+            stages.completion.RecordSince(started);
+        });
+    };
+}
+
+Transport::Clock::time_point FileRequestHandler::MathCoreDeadline() const {
+    // MathCore computations can take minutes; by default waiting ends on reply, restart or heartbeat loss only.
+    if (mathcore_request_timeout_.count() <= 0) {
+        return Transport::Clock::time_point::max();
+    }
+    return Transport::Clock::now() + mathcore_request_timeout_;
+}
+
+void FileRequestHandler::RejectOverloaded(Poco::Net::HTTPServerResponse& response, const std::string& endpoint) {
+    LOG_WARN() << "Rejecting " << endpoint << " request: too many MathCore requests in flight" << std::endl;
+    nlohmann::json errorJson;
+    errorJson["error"] = "Service overloaded, retry later";
+    response.setStatus(Poco::Net::HTTPResponse::HTTP_SERVICE_UNAVAILABLE);
+    response.setContentType("application/json");
+    response.set("Retry-After", std::to_string(admission_.limits().retry_after.count()));
+    response.send() << errorJson.dump();
+}
+
+void FileRequestHandler::RejectOverloaded(DetachedResponse& detached,
+                                          const std::string& endpoint,
+                                          std::chrono::seconds retry_after) {
+    LOG_WARN() << "Rejecting parked " << endpoint << " request: too many MathCore requests in flight" << std::endl;
+    nlohmann::json errorJson;
+    errorJson["error"] = "Service overloaded, retry later";
+    detached.AddHeader("Retry-After", std::to_string(retry_after.count()));
+    detached.Send(Poco::Net::HTTPResponse::HTTP_SERVICE_UNAVAILABLE, "application/json", errorJson.dump());
+}
+
+void FileRequestHandler::Dispatch(Poco::Net::HTTPServerRequest& request,
+                                  Poco::Net::HTTPServerResponse& response,
+                                  const std::string& endpoint,
+                                  const DispatchHandler& handler) {
+    // The ticket travels with the responders and frees the slot once the response is written.
+    std::shared_ptr<AdmissionController::Ticket> ticket = admission_.Admit(endpoint);
+    metrics::Histogram& latency = MetricsFor(endpoint).http;
+    const auto received = metrics::Histogram::Clock::now();
+    ContentEncoding encoding = ResponseEncoding(request);
+    std::shared_ptr<DetachedResponse> detached = DetachedResponse::Detach(request);
+    if (detached) {
+        if (compression_.enabled) {
+            detached->AddHeader("Vary", "Accept-Encoding");
+        }
+        if (ticket) {
+            handler(*this, DetachedResponder(detached, ticket, encoding, compression_, latency, received));
+            return;
+        }
+        // Over the limits: the request waits parked, not on this worker thread. This handler is gone by the time
+        // a slot frees up, so a new one serves the request on the completion pool.
+        auto parked = std::make_shared<FileRequestHandler>(context_);
+        CompletionPool& pool = completion_pool_;
+        const CompressionSettings compression = compression_;
+        const std::chrono::seconds retry_after = admission_.limits().retry_after;
+        auto resume = [=, &pool, &latency](std::shared_ptr<AdmissionController::Ticket> slot) {
+            pool.Post([=, &latency]() {
+                if (!slot) {
+                    RejectOverloaded(*detached, endpoint, retry_after);
+                    return;
+                }
+                handler(*parked, DetachedResponder(detached, slot, encoding, compression, latency, received));
+            });
+        };
+        if (!admission_.Park(endpoint, resume)) {
+            RejectOverloaded(*detached, endpoint, retry_after);
         }
+        return;
+    }
 
-        auto status = future.wait_for(std::chrono::seconds(1));
-        if (status == std::future_status::ready) {
-            response_json = future.get();
-            logger::log() << "Received MathCore response for " << request_name << std::endl;
-            done = true;
+    // Not a connection of Poco's HTTPServer (e.g. in tests) - block this thread until a slot frees up and the
+    // handler responds; chunks are collected and sent as one body.
+    if (!ticket) {
+        auto slot = std::make_shared<std::promise<std::shared_ptr<AdmissionController::Ticket>>>();
+        auto admitted = slot->get_future();
+        if (admission_.Park(endpoint, [slot](std::shared_ptr<AdmissionController::Ticket> t) {
+                slot->set_value(std::move(t));
+            })) {
+            ticket = admitted.get();
+        }
+        if (!ticket) {
+            RejectOverloaded(response, endpoint);
+            return;
         }
     }
+    struct Collected {
+        std::string body;
+        std::promise<std::string> done;
+    };
+    auto collected = std::make_shared<Collected>();
+    auto future = collected->done.get_future();
+    StreamResponder responder;
+    responder.send = [collected](std::string_view body) { collected->done.set_value(std::string(body)); };
+    responder.write = [collected](std::string_view chunk) {
+        collected->body.append(chunk);
+        return true;
+    };
+    responder.finish = [collected](bool) { collected->done.set_value(std::move(collected->body)); };
+    handler(*this, responder);
+    SendBody(response, encoding, future.get());
+    latency.RecordSince(received);
 }
 
-void FileRequestHandler::handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) {
+ContentEncoding FileRequestHandler::ResponseEncoding(const Poco::Net::HTTPServerRequest& request) const {
+    if (!compression_.enabled) {
+        return ContentEncoding::Identity;
+    }
+    return NegotiateEncoding(request.get("Accept-Encoding", ""));
+}
+
+void FileRequestHandler::SendBody(Poco::Net::HTTPServerResponse& response,
+                                  ContentEncoding encoding,
+                                  std::string_view body,
+                                  const char* content_type) {
     response.setStatus(Poco::Net::HTTPResponse::HTTP_OK);
-    response.setContentType("application/json");
+    response.setContentType(content_type);
+    if (compression_.enabled) {
+        response.set("Vary", "Accept-Encoding");
+    }
+    if (encoding != ContentEncoding::Identity && body.size() >= compression_.min_size) {
+        std::string compressed = Compress(body, encoding, compression_.level);
+        response.set("Content-Encoding", ToString(encoding));
+        response.sendBuffer(compressed.data(), compressed.size());
+        return;
+    }
+    response.sendBuffer(body.data(), body.size());
+}
 
-    std::ostream& ostr = response.send();
+void FileRequestHandler::handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) {
+    const auto received = metrics::Histogram::Clock::now();
     std::string uri = request.getURI();
     nlohmann::json errorJson;
 
-    if (uri.find("/start") == 0) {
-        HandleStart(request, ostr);
-    } else if (uri.find("/state") == 0) {
+    // MathCore queries can take minutes: they're parked and answered from the completion pool,
+    // so they don't hold this worker thread.
+    if (uri.find("/state") == 0) {
         int Query = ParseQuery(uri);
-        if (Query == 0) {
-            errorJson["error"] = "invalid or missing query number";
-            ostr << errorJson.dump();
-        } else {
-            HandleState(ostr, Query);
+        if (Query != 0) {
+            Dispatch(request, response, "state", [Query](FileRequestHandler& self, const StreamResponder& respond) {
+                self.HandleState(Query, respond.send);
+            });
+            return;
         }
+        errorJson["error"] = "invalid or missing query number";
     } else if (uri.find("/logslist") == 0 || uri.find("/loglist") == 0) {
-        HandleLogsList(ostr);
+        Dispatch(request, response, "logslist", [](FileRequestHandler& self, const StreamResponder& respond) {
+            self.HandleLogsList(respond.send);
+        });
+        return;
     } else if (uri.find("/getlog") == 0) {
         std::string id = ParseLogId(uri);
-        if (id.empty()) {
-            errorJson["error"] = "invalid or missing id";
-            ostr << errorJson.dump();
-        } else {
-            HandleGetLog(ostr, id);
+        if (!id.empty()) {
+            Dispatch(request, response, "getlog", [id](FileRequestHandler& self, const StreamResponder& respond) {
+                self.HandleGetLog(id, respond);
+            });
+            return;
         }
+        errorJson["error"] = "invalid or missing id";
+    }
+
+    if (errorJson.is_null() && uri.find("/metrics") == 0) {
+        SendBody(response, ResponseEncoding(request), HandleMetrics(), kPrometheusContentType);
+        MetricsFor("metrics").http.RecordSince(received);
+        return;
+    }
+
+    std::ostringstream ostr;
+    const char* endpoint = "other";
+    if (!errorJson.is_null()) {
+        ostr << errorJson.dump();
+    } else if (uri.find("/start") == 0) {
+        endpoint = "start";
+        HandleStart(request, ostr);
+    } else if (uri.find("/loglevel") == 0) {
+        endpoint = "loglevel";
+        HandleLogLevel(request, ostr);
     } else {
-        nlohmann::json errorJson;
         errorJson["error"] = "unknown command";
         ostr << errorJson.dump();
     }
+    SendBody(response, ResponseEncoding(request), ostr.str());
+    MetricsFor(endpoint).http.RecordSince(received);
 }
 
 void FileRequestHandler::HandleStart(Poco::Net::HTTPServerRequest& request, std::ostream& ostr) {
-    std::ostringstream body;
-    std::istream& stream = request.stream();
-    body << stream.rdbuf();
+    std::string body = ReadBody(request);
     nlohmann::json responseJson;
 
     if (!IsMathCoreAlive()) {
         responseJson = GenerateErrorResponse(0, "MathCore is unavailable");
-        logger::log_error() << "Received Start request while MathCore is unavailable" << std::endl;
-    } else if (!body.str().empty()) {
+        LOG_WARN() << "Received Start request while MathCore is unavailable" << std::endl;
+    } else if (instances_.routing() && instances_.alive_count() == 0) {
+        // Alive only by the grace period before the first heartbeat: there's no instance to send the job to.
+        responseJson = GenerateErrorResponse(0, "MathCore is unavailable");
+        LOG_WARN() << "Received Start request before any MathCore instance sent a heartbeat" << std::endl;
+    } else if (body.empty()) {
+        responseJson["error"] = "Message is empty";
+        LOG_WARN() << "Received Start request with empty body" << std::endl;
+    } else if (validate_start_body_ && !nlohmann::json::accept(body)) {
+        responseJson["error"] = "Message is not valid JSON";
+        LOG_WARN() << "Received Start request with malformed body (" << body.size() << " bytes)" << std::endl;
+    } else {
         std::string ID = GenerateID();
-        int Query = NextQuery(ID);
-        std::string start_subject = "Start.";
-        start_subject += ID;
-        logger::log() << "Received Start request with ID=" << ID << " (query=" << Query << ")" << std::endl;
-
-        nlohmann::json message = nlohmann::json::parse(body.str());
-        bool published = nats_manager_.Publish(start_subject, message);
+        MathCoreInstances::Route route;
+        bool routed = true;
+        if (instances_.routing()) {
+            // The last live instance may have timed out since the check above; then the job fails like a publish.
+            route = instances_.Assign(ID);
+            routed = !route.instance.empty();
+        }
+        // 0 if the pair couldn't be persisted (journal write failed, or the shared store is unreachable).
+        int Query = queries_.Register(ID);
+        std::string start_subject = JobSubject("Start.", route, ID);
+        LOG_DEBUG() << "Received Start request with ID=" << ID << " (query=" << Query << ")" << std::endl;
+
+        bool published = false;
+        if (!routed) {
+            LOG_WARN() << "No live MathCore instance for Start request with ID=" << ID << std::endl;
+        } else if (Query == 0) {
+            LOG_ERROR() << "No query number for Start request with ID=" << ID << std::endl;
+        } else if (transport_.EncodingFor(start_subject) == WireEncoding::Json) {
+            // The job is forwarded exactly as received.
+            published = transport_.PublishRaw(start_subject, body);
+        } else {
+            // A binary encoding needs the document; a malformed body (validation off) fails like a publish would.
+            nlohmann::json message = nlohmann::json::parse(body, nullptr, false);
+            published = !message.is_discarded() && transport_.Publish(start_subject, message);
+        }
+        // Only the connection carrying the job is waited for; concurrent /start requests on it share its flushes.
+        if (published && start_flush_timeout_.count() > 0 && !transport_.Flush(start_subject, start_flush_timeout_)) {
+            published = false;
+        }
 
         if (published) {
             responseJson = GenerateResponse(Query, ID, Status::Ok, "BUFFERED");
         } else {
-            std::lock_guard<std::mutex> lock(state_mutex_);
-            RemovePairLocked(ID);
-            responseJson = GenerateResponse(Query, ID, Status::Error, "Failed to publish message to NATS");
-            logger::log_error() << "Failed to publish Start request with ID=" << ID << std::endl;
+            queries_.Forget(ID);
+            instances_.Release(ID);
+            const char* desc = Query == 0 ? "Failed to register query number" : "Failed to publish message to NATS";
+            responseJson = GenerateResponse(Query, ID, Status::Error, desc);
+            LOG_ERROR() << "Failed to publish Start request with ID=" << ID << std::endl;
         }
-    } else {
-        responseJson["error"] = "Message is empty";
-        logger::log_error() << "Received Start request with empty body" << std::endl;
     }
 
-    logger::log() << "Sent Start response" << std::endl;
+    LOG_DEBUG() << "Sent Start response" << std::endl;
     ostr << responseJson.dump();
 }
 
-void FileRequestHandler::HandleState(std::ostream& ostr, int Query) {
-    std::string ID = GetID(Query);
+void FileRequestHandler::HandleState(int Query, Responder respond) {
+    std::string ID = queries_.FindId(Query);
     nlohmann::json responseJson;
 
     if (ID.empty()) {
         responseJson =
             GenerateResponse(Query, ID, Status::Error, "Wrong query number (either not found or not generated yet)");
-        logger::log_error() << "Received State request with invalid query=" << Query << std::endl;
-        ostr << responseJson.dump();
+        LOG_WARN() << "Received State request with invalid query=" << Query << std::endl;
+        respond(responseJson.dump());
         return;
     }
 
-    std::string state_request_subject = "State.Request." + ID;
-    std::string state_response_subject = "State.Response." + ID;
-    uint64_t startup_epoch = mathcore_startup_epoch_.load(std::memory_order_relaxed);
-    logger::log() << "Received State request with ID=" << ID << " (query=" << Query << ")" << std::endl;
+    // Asked on the instance the job went to.
+    const MathCoreInstances::Route route = instances_.Find(ID);
+    std::string state_request_subject = JobSubject("State.Request.", route, ID);
+    LOG_DEBUG() << "Received State request with ID=" << ID << " (query=" << Query << ")" << std::endl;
 
-    if (!IsMathCoreAlive()) {
+    if (!IsMathCoreAlive(route)) {
         responseJson = GenerateResponse(Query, ID, Status::Error, "MathCore is unavailable");
-        std::lock_guard<std::mutex> lock(state_mutex_);
-        EnsureStateLoadedLocked();
-        logger::log_error() << "MathCore unavailable for State request ID=" << ID << std::endl;
-        ostr << responseJson.dump();
+        LOG_WARN() << "MathCore unavailable for State request ID=" << ID << std::endl;
+        respond(responseJson.dump());
         return;
     }
 
-    std::promise<nlohmann::json> promise;
-    auto future = promise.get_future();
-
-    auto sub = nats_manager_.Subscribe(
-        state_response_subject,
-        [this, &promise, Query](const std::string& msg_subject, const nlohmann::json& message) mutable {
-            nlohmann::json state;
-            this->OnMessageState(msg_subject, message, state, Query);
-            promise.set_value(std::move(state));
-            nats_manager_.Unsubscribe(msg_subject);  // unsubscribe right after we get our message
-        });
+    if (!coalescer_.Join(state_request_subject, std::move(respond))) {
+        LOG_DEBUG() << "State request ID=" << ID << " joined the one in flight" << std::endl;
+        return;
+    }
 
-    if (!sub) {
-        responseJson = GenerateResponse(Query, ID, Status::Error, "Failed to subscribe to NATS subject");
-    } else {
-        nlohmann::json request = {{"id", ID}};
-        if (!nats_manager_.Publish(state_request_subject, request)) {
-            nats_manager_.Unsubscribe(state_response_subject);
-            responseJson = GenerateResponse(Query, ID, Status::Error, "Failed to publish message to NATS");
-        } else {
-            auto make_error = [Query, &ID, this](const std::string& message) {
+    nlohmann::json request = {{"id", ID}};
+    LOG_DEBUG() << "Waiting for MathCore response to State request ID=" << ID << std::endl;
+    uint64_t request_id = transport_.AsyncRequest(
+        state_request_subject,
+        request,
+        MathCoreDeadline(),
+        RequestGroup(route),
+        OnCompletionPool("state", [Query, ID, route, state_request_subject, &queries = queries_,
+                          &instances = instances_, &coalescer = coalescer_](NatsReply& reply) {
+            nlohmann::json responseJson;
+            auto make_error = [Query, &ID](const std::string& message) {
                 return GenerateResponse(Query, ID, Status::Error, message);
             };
-            auto on_restart_cleanup = [this, &ID]() {
-                std::lock_guard<std::mutex> lock(state_mutex_);
-                EnsureStateLoadedLocked();
-                RemovePairLocked(ID);
-            };
-            logger::log() << "Waiting for MathCore response to State request ID=" << ID << std::endl;
-            WaitForResponse(startup_epoch,
-                            state_response_subject,
-                            "State request ID=" + ID,
-                            future,
-                            make_error,
-                            on_restart_cleanup,
-                            responseJson);
-        }
-    }
-
-    logger::log() << "Sent State response for ID=" << ID << std::endl;
-    ostr << responseJson.dump();
+            auto on_restart_cleanup = [&ID, &queries]() { queries.Forget(ID); };
+            if (CompleteMathCoreRequest(instances, route, reply, "State request", ID, make_error, on_restart_cleanup,
+                                        responseJson)) {
+                try {
+                    OnMessageState(reply.message->Json(), responseJson, Query, ID);
+                    queries.Complete(ID);
+                } catch (const std::exception& e) {
+                    LOG_ERROR() << "Malformed State response for ID=" << ID << ": " << e.what() << std::endl;
+                    responseJson = make_error("Malformed response from MathCore");
+                }
+            }
+            LOG_DEBUG() << "Sent State response for ID=" << ID << std::endl;
+            coalescer.Complete(state_request_subject, responseJson.dump(), std::chrono::milliseconds(0));
+        }));
+    CheckMissedMathCoreEvents(route, request_id);
 }
 
-void FileRequestHandler::HandleLogsList(std::ostream& ostr) {
+void FileRequestHandler::HandleLogsList(Responder respond) {
     nlohmann::json responseJson;
-    uint64_t startup_epoch = mathcore_startup_epoch_.load(std::memory_order_relaxed);
+    const MathCoreInstances::Route route = instances_.Shared();
     const std::string request_subject = "LogsList.Request";
-    const std::string response_subject = "LogsList.Response";
-    logger::log() << "Received LogsList request" << std::endl;
+    LOG_DEBUG() << "Received LogsList request" << std::endl;
 
     if (!IsMathCoreAlive()) {
         responseJson = GenerateErrorResponse(0, "MathCore is unavailable");
-        logger::log_error() << "MathCore unavailable for LogsList request" << std::endl;
-        ostr << responseJson.dump();
+        LOG_WARN() << "MathCore unavailable for LogsList request" << std::endl;
+        respond(responseJson.dump());
         return;
     }
 
-    std::promise<nlohmann::json> promise;
-    auto future = promise.get_future();
-
-    auto sub = nats_manager_.Subscribe(
-        response_subject, [&promise, this](const std::string& msg_subject, const nlohmann::json& message) mutable {
-            promise.set_value(message);
-            nats_manager_.Unsubscribe(msg_subject);  // unsubscribe right after we get our message
-        });
-
-    if (!sub) {
-        responseJson = GenerateErrorResponse(0, "Failed to subscribe to NATS subject");
-    } else if (!nats_manager_.Publish(request_subject, nlohmann::json::object())) {
-        nats_manager_.Unsubscribe(response_subject);
-        responseJson = GenerateErrorResponse(0, "Failed to publish message to NATS");
-    } else {
-        auto make_error = [this](const std::string& message) {
-            return GenerateErrorResponse(0, message);
-        };
-        logger::log() << "Waiting for MathCore response to LogsList request" << std::endl;
-        WaitForResponse(startup_epoch, response_subject, "LogsList request", future, make_error, nullptr, responseJson);
+    if (!coalescer_.Join(request_subject, std::move(respond))) {
+        LOG_DEBUG() << "LogsList request joined the one in flight (or was answered from cache)" << std::endl;
+        return;
     }
 
-    logger::log() << "Sent LogsList response" << std::endl;
-    ostr << responseJson.dump();
+    LOG_DEBUG() << "Waiting for MathCore response to LogsList request" << std::endl;
+    uint64_t request_id = transport_.AsyncRequest(
+        request_subject,
+        nlohmann::json::object(),
+        MathCoreDeadline(),
+        RequestGroup(route),
+        OnCompletionPool("logslist", [route, request_subject, cache_ttl = logslist_cache_ttl_,
+                          &instances = instances_, &coalescer = coalescer_](NatsReply& reply) {
+            nlohmann::json responseJson;
+            auto make_error = [](const std::string& message) {
+                return GenerateErrorResponse(0, message);
+            };
+            bool ok = CompleteMathCoreRequest(
+                instances, route, reply, "LogsList request", "", make_error, nullptr, responseJson);
+            std::string converted;
+            std::string_view body;
+            if (ok) {
+                try {
+                    // JSON lists are forwarded exactly as MathCore sent them.
+                    body = JsonBody(*reply.message, converted);
+                } catch (const nlohmann::json::exception& e) {
+                    LOG_WARN() << "Malformed LogsList response from MathCore: " << e.what() << std::endl;
+                    responseJson = make_error("Malformed response from MathCore");
+                    ok = false;
+                }
+            }
+            LOG_DEBUG() << "Sent LogsList response" << std::endl;
+            // Only successful lists are worth reusing; errors go to the current waiters alone.
+            if (ok) {
+                coalescer.Complete(request_subject, body, cache_ttl);
+            } else {
+                coalescer.Complete(request_subject, responseJson.dump(), std::chrono::milliseconds(0));
+            }
+        }));
+    CheckMissedMathCoreEvents(route, request_id);
 }
 
-void FileRequestHandler::HandleGetLog(std::ostream& ostr, const std::string& id) {
+void FileRequestHandler::HandleGetLog(const std::string& id, StreamResponder respond) {
     nlohmann::json responseJson;
-    uint64_t startup_epoch = mathcore_startup_epoch_.load(std::memory_order_relaxed);
-    const std::string request_subject = "GetLog.Request." + id;
-    const std::string response_subject = "GetLog.Response." + id;
-    logger::log() << "Received GetLog request with ID=" << id << std::endl;
+    const MathCoreInstances::Route route = instances_.Find(id);
+    const std::string request_subject = JobSubject("GetLog.Request.", route, id);
+    LOG_DEBUG() << "Received GetLog request with ID=" << id << std::endl;
 
-    if (!IsMathCoreAlive()) {
+    if (!IsMathCoreAlive(route)) {
         responseJson = GenerateErrorResponse(0, "MathCore is unavailable");
-        logger::log_error() << "MathCore unavailable for GetLog request ID=" << id << std::endl;
-        ostr << responseJson.dump();
+        LOG_WARN() << "MathCore unavailable for GetLog request ID=" << id << std::endl;
+        respond.send(responseJson.dump());
         return;
     }
 
-    std::promise<nlohmann::json> promise;
-    auto future = promise.get_future();
+    // Chunks arrive on the NATS delivery thread and are written on the completion pool; the relay keeps them
+    // in order and bounds how many wait for a slow client.
+    struct ChunkRelay {
+        std::mutex mutex;
+        std::deque<NatsReply> queue;
+        bool draining = false;
+        bool dropped = false;  // the client is cut off, later chunks are discarded
+        bool started = false;  // chunked body started; touched by the draining task only
+        bool replied = false;  // first reply (or chunk) arrived
+    };
+    auto relay = std::make_shared<ChunkRelay>();
+
+    auto process = [id, route, respond, relay, &instances = instances_](NatsReply& reply) {
+        if (reply.status == NatsReply::Status::Ok && (reply.more || relay->started)) {
+            // Pieces of a binary document can't be converted one by one - streamed logs have to be JSON text.
+            bool json_chunk = reply.message->Encoding() == WireEncoding::Json;
+            if (!json_chunk) {
+                LOG_WARN() << "Dropping GetLog stream for ID=" << id << ": chunks must be JSON, got "
+                           << ToString(reply.message->Encoding()) << std::endl;
+            }
+            if (!json_chunk || !respond.write(reply.message->Data())) {
+                {
+                    std::lock_guard<std::mutex> lock(relay->mutex);
+                    relay->dropped = true;
+                    relay->queue.clear();
+                }
+                if (!relay->started && !json_chunk) {
+                    respond.send(GenerateErrorResponse(0, "Unsupported log encoding from MathCore").dump());
+                } else {
+                    respond.finish(false);
+                }
+                return;
+            }
+            relay->started = true;
+            if (!reply.more) {
+                LOG_DEBUG() << "Sent streamed GetLog response for ID=" << id << std::endl;
+                respond.finish(true);
+            }
+            return;
+        }
 
-    auto sub = nats_manager_.Subscribe(
-        response_subject, [&promise, this](const std::string& msg_subject, const nlohmann::json& message) mutable {
-            promise.set_value(message);
-            nats_manager_.Unsubscribe(msg_subject);  // unsubscribe right after we get our message
+        nlohmann::json responseJson;
+        auto make_error = [](const std::string& message) {
+            return GenerateErrorResponse(0, message);
+        };
+        bool ok = CompleteMathCoreRequest(
+            instances, route, reply, "GetLog request", id, make_error, nullptr, responseJson);
+        if (relay->started) {
+            // Headers and part of the log are out already - all that's left is cutting the transfer short.
+            respond.finish(false);
+            return;
+        }
+        std::string converted;
+        std::string_view body;
+        if (ok) {
+            try {
+                // Logs can be large: JSON ones are forwarded without parsing and re-serializing them.
+                body = JsonBody(*reply.message, converted);
+            } catch (const nlohmann::json::exception& e) {
+                LOG_WARN() << "Malformed GetLog response from MathCore for ID=" << id << ": " << e.what() << std::endl;
+                responseJson = make_error("Malformed response from MathCore");
+                ok = false;
+            }
+        }
+        LOG_DEBUG() << "Sent GetLog response for ID=" << id << std::endl;
+        std::string error_body = ok ? std::string() : responseJson.dump();
+        respond.send(ok ? body : std::string_view(error_body));
+    };
+    auto drain = [relay, process]() mutable {
+        for (;;) {
+            NatsReply reply;
+            {
+                std::lock_guard<std::mutex> lock(relay->mutex);
+                if (relay->queue.empty()) {
+                    relay->draining = false;
+                    return;
+                }
+                reply = std::move(relay->queue.front());
+                relay->queue.pop_front();
+            }
+            process(reply);
+        }
+    };
+
+    nlohmann::json request = {{"id", id}};
+    LOG_DEBUG() << "Waiting for MathCore response to GetLog request ID=" << id << std::endl;
+    CompletionPool& pool = completion_pool_;
+    metrics::Histogram& mathcore_wait = MetricsFor("getlog").mathcore;
+    const auto sent = metrics::Histogram::Clock::now();
+    uint64_t request_id = transport_.AsyncStreamRequest(
+        request_subject,
+        request,
+        MathCoreDeadline(),
+        RequestGroup(route),
+        [id, relay, drain, &pool, &mathcore_wait, sent](NatsReply&& reply) {
+            std::lock_guard<std::mutex> lock(relay->mutex);
+            if (!relay->replied) {
+                relay->replied = true;
+                mathcore_wait.RecordSince(sent);
+            }
+            if (relay->dropped) {
+                return;
+            }
+            if (reply.more && relay->queue.size() >= kMaxBufferedLogChunks) {
+                LOG_WARN() << "GetLog client for ID=" << id << " doesn't keep up with the log stream, dropping it"
+                           << std::endl;
+                relay->queue.clear();
+                relay->dropped = true;
+                reply = NatsReply();
+                reply.status = NatsReply::Status::Failed;
+                reply.error = "Client doesn't keep up with the log stream";
+            }
+            relay->queue.push_back(std::move(reply));
+            if (!relay->draining) {
+                relay->draining = true;
+                pool.Post(drain);
+            }
         });
+    CheckMissedMathCoreEvents(route, request_id);
+}
 
-    if (!sub) {
-        responseJson = GenerateErrorResponse(0, "Failed to subscribe to NATS subject");
-    } else {
-        nlohmann::json request = {{"id", id}};
-        if (!nats_manager_.Publish(request_subject, request)) {
-            nats_manager_.Unsubscribe(response_subject);
-            responseJson = GenerateErrorResponse(0, "Failed to publish message to NATS");
-        } else {
-            auto make_error = [this](const std::string& message) {
-                return GenerateErrorResponse(0, message);
-            };
-            logger::log() << "Waiting for MathCore response to GetLog request ID=" << id << std::endl;
-            WaitForResponse(
-                startup_epoch, response_subject, "GetLog request ID=" + id, future, make_error, nullptr, responseJson);
+std::string FileRequestHandler::HandleMetrics() {
+    std::string out = metrics::Global().Render();
+
+    NatsStats stats;
+    if (transport_.GetStats(stats)) {
+        metrics::AppendSample(out, "nats_connector_nats_in_msgs_total", "counter", "Messages received by nats.c",
+                              static_cast<double>(stats.in_msgs));
+        metrics::AppendSample(out, "nats_connector_nats_in_bytes_total", "counter", "Bytes received by nats.c",
+                              static_cast<double>(stats.in_bytes));
+        metrics::AppendSample(out, "nats_connector_nats_out_msgs_total", "counter", "Messages sent by nats.c",
+                              static_cast<double>(stats.out_msgs));
+        metrics::AppendSample(out, "nats_connector_nats_out_bytes_total", "counter", "Bytes sent by nats.c",
+                              static_cast<double>(stats.out_bytes));
+        metrics::AppendSample(out, "nats_connector_nats_reconnects_total", "counter", "Reconnections to NATS",
+                              static_cast<double>(stats.reconnects));
+    }
+
+    std::chrono::steady_clock::time_point last_heartbeat;
+    {
+        std::lock_guard<std::mutex> lock(health_mutex_);
+        last_heartbeat = last_mathcore_heartbeat_;
+    }
+    std::chrono::duration<double> heartbeat_age = std::chrono::steady_clock::now() - last_heartbeat;
+    metrics::AppendSample(out, "nats_connector_mathcore_alive", "gauge", "1 while MathCore heartbeats arrive",
+                          IsMathCoreAlive() ? 1 : 0);
+    metrics::AppendSample(out, "nats_connector_mathcore_heartbeat_age_seconds", "gauge",
+                          "Time since the last MathCore heartbeat", heartbeat_age.count());
+    metrics::AppendSample(out, "nats_connector_mathcore_startups_total", "counter", "MathCore startups seen",
+                          static_cast<double>(instances_.startups()));
+    metrics::AppendSample(out, "nats_connector_mathcore_instances_alive", "gauge",
+                          "MathCore instances whose heartbeats arrive", static_cast<double>(instances_.alive_count()));
+    metrics::AppendSample(out, "nats_connector_mathcore_jobs_routed", "gauge",
+                          "Jobs pinned to the MathCore instance they were routed to",
+                          static_cast<double>(instances_.pinned_size()));
+
+    metrics::AppendSample(out, "nats_connector_admission_in_flight", "gauge", "Admitted MathCore requests",
+                          admission_.in_flight());
+    metrics::AppendSample(out, "nats_connector_admission_queued", "gauge", "Requests waiting for admission",
+                          admission_.queued());
+    metrics::AppendSample(out, "nats_connector_coalescer_in_flight", "gauge", "Distinct MathCore requests in flight",
+                          static_cast<double>(coalescer_.in_flight()));
+    metrics::AppendSample(out, "nats_connector_coalesced_total", "counter",
+                          "Requests answered by another request's flight or the cache",
+                          static_cast<double>(coalescer_.coalesced()));
+    metrics::AppendSample(out, "nats_connector_queries_active", "gauge", "Query numbers given since MathCore start",
+                          static_cast<double>(queries_.active_size()));
+    metrics::AppendSample(out, "nats_connector_queries_persisted", "gauge", "Queries kept in the query state",
+                          static_cast<double>(queries_.persisted_size()));
+    return out;
+}
+
+void FileRequestHandler::HandleLogLevel(Poco::Net::HTTPServerRequest& request, std::ostream& ostr) {
+    Poco::URI parsedUri(request.getURI());
+    nlohmann::json responseJson;
+    // GET must stay safe: crawlers and link prefetchers follow links without asking.
+    const bool may_change = request.getMethod() == Poco::Net::HTTPRequest::HTTP_POST ||
+                            request.getMethod() == Poco::Net::HTTPRequest::HTTP_PUT;
+
+    for (const auto& p : parsedUri.getQueryParameters()) {
+        if (p.first != "level") {
+            continue;
         }
+        if (!may_change) {
+            responseJson["error"] = "use POST or PUT to change the log level";
+            ostr << responseJson.dump();
+            return;
+        }
+        logger::Level level;
+        if (!logger::ParseLevel(p.second, level)) {
+            responseJson["error"] = "unknown log level";
+            ostr << responseJson.dump();
+            return;
+        }
+        logger::SetLevel(level);
+        LOG_WARN() << "Log level changed to " << logger::ToString(level) << std::endl;
+        break;
     }
 
-    logger::log() << "Sent GetLog response for ID=" << id << std::endl;
+    responseJson["level"] = logger::ToString(logger::GetLevel());
     ostr << responseJson.dump();
 }
 
@@ -443,11 +1090,10 @@ nlohmann::json FileRequestHandler::GenerateErrorResponse(const int query, const
     return GenerateResponse(query, "null", Status::Error, desc);
 }
 
-void FileRequestHandler::OnMessageState(const std::string& msg_subject,
-                                        const nlohmann::json& message,
+void FileRequestHandler::OnMessageState(const nlohmann::json& message,
                                         nlohmann::json& state,
-                                        const int Query) {
-    std::string ID = GetID(Query);
+                                        const int Query,
+                                        const std::string& ID) {
     if (message.contains("message") || message.contains("error")) {
         state["solutions"] = nlohmann::json::array();
         std::string desc;
@@ -462,98 +1108,94 @@ void FileRequestHandler::OnMessageState(const std::string& msg_subject,
         state = message;
         state["state"]["query"] = Query;
     }
-
-    std::lock_guard<std::mutex> lock(state_mutex_);
-    EnsureStateLoadedLocked();
-    RemovePersistedPairLocked(ID);
 }
 
-void FileRequestHandler::EnsureStateLoadedLocked() {
-    if (state_loaded_) {
-        return;
-    }
-
-    std::ifstream input(kStateFilePath);
-    if (input.is_open()) {
-        try {
-            nlohmann::json persisted;
-            input >> persisted;
-            if (persisted.is_array()) {
-                for (const auto& entry : persisted) {
-                    if (entry.contains("id") && entry.contains("query")) {
-                        std::string id = entry["id"].get<std::string>();
-                        int query = entry["query"].get<int>();
-                        id_query_map_[id] = query;
-                        persisted_id_query_map_[id] = query;
-                        if (query > query_number_) {
-                            query_number_ = query;
-                        }
-                    }
-                }
-            }
-        } catch (const std::exception& e) {
-            logger::log_error() << "Failed to load persisted query state: " << e.what() << std::endl;
-        }
-    }
-    state_loaded_ = true;
+void ServerApp::initialize(Poco::Util::Application& self) {
+    loadConfiguration();  // nats-connector.properties next to the executable, if present
+    ServerApplication::initialize(self);
 }
 
-void FileRequestHandler::PersistStateLocked() {
-    nlohmann::json persisted = nlohmann::json::array();
-    for (const auto& entry : persisted_id_query_map_) {
-        persisted.push_back({{"id", entry.first}, {"query", entry.second}});
-    }
-
-    std::ofstream output(kStateFilePath, std::ios::trunc);
-    if (!output.is_open()) {
-        logger::log_error() << "Failed to open state file for writing: " << kStateFilePath << std::endl;
-        return;
-    }
+int ServerApp::main(const std::vector<std::string>&) {
+    const ServerConfig server_config = ServerConfig::Load(config());
+    logger::SetLevel(server_config.log_level);
 
-    output << persisted.dump();
-}
+    // Request handlers log several lines per request - keep file I/O off their threads.
+    logger::StartAsync();
 
-void FileRequestHandler::RemovePairLocked(const std::string& id) {
-    if (id.empty()) {
-        return;
+    // Outlives everything that may still finish a /start request.
+    QueryJournal query_journal(server_config.query_state);
+    QueryRegistry queries;
+    if (!server_config.replica.enabled) {
+        queries.Open(query_journal);
     }
-
-    // Remove from both in-memory and persisted maps (used for failed starts).
-    id_query_map_.erase(id);
-    RemovePersistedPairLocked(id);
-}
-
-void FileRequestHandler::RemovePersistedPairLocked(const std::string& id) {
-    if (id.empty()) {
-        return;
+    MathCoreInstances instances(server_config.mathcore_routing);
+    IdGenerator ids(server_config.node_id);
+    RequestCoalescer coalescer;
+
+    // Declared before nats_manager: replies cancelled by its Disconnect() still get answered through the pool.
+    // See the shutdown below for why admission must not go away before the pool is drained.
+    CompletionPool completion_pool(server_config.completion_threads);
+    AdmissionController admission(server_config.admission);
+    NatsManager nats_manager;
+    nats_manager.SetOptions(server_config.nats);
+    for (const auto& entry : server_config.subject_encodings) {
+        nats_manager.SetSubjectEncoding(entry.first, entry.second);
     }
-
-    auto it = persisted_id_query_map_.find(id);
-    if (it == persisted_id_query_map_.end()) {
-        return;
+    bool status = nats_manager.Connect(server_config.nats_url);
+    // Declared after nats_manager: it goes away before the connection it uses.
+    JetStreamQueryStore shared_queries;
+    if (status && server_config.replica.enabled) {
+        status = shared_queries.Open(nats_manager.get_connection(), server_config.replica);
+        if (status) {
+            queries.Share(shared_queries, server_config.replica.query_block);
+            LOG_INFO() << "Replica mode: query numbers are shared through bucket " << server_config.replica.bucket
+                       << std::endl;
+        }
+        if (server_config.mathcore_routing) {
+            LOG_WARN() << "mathcore.routing with replicas: jobs routed by another replica are asked about on the "
+                          "shared subjects"
+                       << std::endl;
+        }
     }
-
-    persisted_id_query_map_.erase(it);
-    PersistStateLocked();
-}
-
-int ServerApp::main(const std::vector<std::string>&) {
-    std::string nats_server_url = "nats://localhost:4222";
-    int port = 9000;
-
-    NatsManager nats_manager;
-    bool status = nats_manager.Connect(nats_server_url);
     if (!status) {
+        queries.Close();
+        logger::StopAsync();
         return Application::EXIT_SOFTWARE;
     }
-    FileRequestHandler::StartMathAliveWatcher(nats_manager);
-
-    Poco::Net::ServerSocket svs(port);
-    Poco::Net::HTTPServer srv(new FileRequestHandlerFactory(nats_manager), svs, new Poco::Net::HTTPServerParams);
+    FileRequestHandler::StartMathAliveWatcher(nats_manager, queries, instances, completion_pool);
+
+    auto* params = new Poco::Net::HTTPServerParams;
+    params->setMaxThreads(server_config.http_max_threads);
+    params->setMaxQueued(server_config.http_max_queued);
+    params->setTimeout(Poco::Timespan(server_config.http_timeout.count() * Poco::Timespan::MILLISECONDS));
+    params->setKeepAlive(server_config.http_keep_alive);
+
+    HandlerContext context{nats_manager,
+                           completion_pool,
+                           admission,
+                           queries,
+                           instances,
+                           ids,
+                           coalescer,
+                           server_config.mathcore_request_timeout,
+                           server_config.logslist_cache_ttl,
+                           server_config.start_validate_json,
+                           server_config.start_flush_timeout,
+                           server_config.http_compression};
+    Poco::Net::ServerSocket svs(static_cast<Poco::UInt16>(server_config.http_port), server_config.http_backlog);
+    Poco::Net::HTTPServer srv(new FileRequestHandlerFactory(context), svs, params);
     srv.start();
-    logger::log() << "HTTP Server started on port " << port << std::endl;
+    LOG_INFO() << "HTTP Server started on port " << server_config.http_port << std::endl;
     waitForTerminationRequest();  // wait for CTRL-C
     srv.stop();
+    FileRequestHandler::StopMathAliveWatcher();
+    // Responders of requests still in flight hold admission tickets. Cancel the requests and run their
+    // continuations now, so every ticket is released while `admission` is alive; requests still parked are
+    // rejected by its destructor, inline since the pool is stopped.
+    nats_manager.Disconnect();
+    completion_pool.Stop();
+    queries.Close();
+    logger::StopAsync();
 
     return Application::EXIT_OK;
-}
\ No newline at end of file
+}
@@ -0,0 +1,76 @@
+#include "id_generator.h"
+
+#include <chrono>
+
+namespace {
+
+constexpr unsigned kSequenceBits = 16;
+constexpr uint64_t kSequenceMask = (uint64_t(1) << kSequenceBits) - 1;
+
+// Writes `value` as exactly `width` decimal digits.
+char* WriteDigits(char* out, uint64_t value, int width) {
+    for (int i = width - 1; i >= 0; --i) {
+        out[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    return out + width;
+}
+
+// Days since 1970-01-01 to a proleptic Gregorian date (H. Hinnant's civil_from_days).
+void CivilFromDays(int64_t days, int64_t& year, unsigned& month, unsigned& day) {
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned day_of_era = static_cast<unsigned>(days - era * 146097);
+    const unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const unsigned shifted_month = (5 * day_of_year + 2) / 153;
+    day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+    month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+    year = static_cast<int64_t>(year_of_era) + era * 400 + (month <= 2 ? 1 : 0);
+}
+
+}  // namespace
+
+IdGenerator::IdGenerator(unsigned node) : node_(node > kMaxNode ? kMaxNode : node) {}
+
+IdGenerator::Id IdGenerator::Next() {
+    const uint64_t now_ms = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+            .count());
+
+    // Take the current millisecond with sequence 0, or the next value after the last ID if that's not behind us
+    // (same millisecond, clock stepped back, or a sequence overflow that borrowed from the next millisecond).
+    uint64_t last = last_.load(std::memory_order_relaxed);
+    uint64_t next = 0;
+    do {
+        next = (now_ms << kSequenceBits) > last ? (now_ms << kSequenceBits) : last + 1;
+    } while (!last_.compare_exchange_weak(last, next, std::memory_order_relaxed));
+
+    const uint64_t ms = next >> kSequenceBits;
+    const uint64_t sequence = next & kSequenceMask;
+    const int64_t seconds = static_cast<int64_t>(ms / 1000);
+    const int64_t days = seconds / 86400;
+    const int64_t second_of_day = seconds % 86400;
+    int64_t year = 0;
+    unsigned month = 0;
+    unsigned day = 0;
+    CivilFromDays(days, year, month, day);
+
+    Id id;
+    char* out = id.data;
+    out = WriteDigits(out, static_cast<uint64_t>(year), 4);
+    out = WriteDigits(out, month, 2);
+    out = WriteDigits(out, day, 2);
+    *out++ = '_';
+    out = WriteDigits(out, static_cast<uint64_t>(second_of_day / 3600), 2);
+    out = WriteDigits(out, static_cast<uint64_t>(second_of_day / 60 % 60), 2);
+    out = WriteDigits(out, static_cast<uint64_t>(second_of_day % 60), 2);
+    *out++ = '_';
+    out = WriteDigits(out, ms % 1000, 3);
+    *out++ = '_';
+    out = WriteDigits(out, node_, 3);
+    *out++ = '_';
+    out = WriteDigits(out, sequence, 5);
+    *out = '\0';
+    return id;
+}
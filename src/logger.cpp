@@ -1,109 +1,425 @@
 #include "logger.h"
 
-#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <ctime>
 #include <filesystem>
-#include <iomanip>
-#include <sstream>
-#include <stdexcept>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 
 namespace logger {
 
-static bool g_latest_log_truncated = false;
+std::atomic<int> g_runtime_level{static_cast<int>(Level::Info)};
 
-static std::string GetDateFileName() {
-    const auto now = std::chrono::system_clock::now();
-    const std::time_t now_time = std::chrono::system_clock::to_time_t(now);
+namespace {
+
+bool g_latest_log_truncated = false;
+std::mutex g_sync_mutex;  // serializes file access in synchronous mode
+
+const std::filesystem::path kLogDir = "logs";
+
+std::tm LocalTime(std::time_t time) {
     std::tm local_tm{};
 #if defined(_WIN32)
-    localtime_s(&local_tm, &now_time);
+    localtime_s(&local_tm, &time);
 #else
-    localtime_r(&now_time, &local_tm);
+    localtime_r(&time, &local_tm);
 #endif
-    std::ostringstream filename;
-    filename << std::put_time(&local_tm, "%Y-%m-%d") << ".log";
-    return filename.str();
+    return local_tm;
 }
 
-static std::string CreateDateLogFilePath() {
-    const std::string date_file = GetDateFileName();
-    const std::filesystem::path dir_path = std::filesystem::path("logs");
-    std::filesystem::create_directories(dir_path);
-    return (dir_path / date_file).string();
+std::string GetDateFileName(std::time_t now_time) {
+    const std::tm local_tm = LocalTime(now_time);
+    char name[32];
+    std::strftime(name, sizeof(name), "%Y-%m-%d.log", &local_tm);
+    return name;
 }
 
-static std::string CreateLatestLogFilePath() {
-    const std::filesystem::path dir_path = std::filesystem::path("logs");
-    std::filesystem::create_directories(dir_path);
-    const std::filesystem::path latest_path = dir_path / "latest.log";
-    return latest_path.string();
+std::string CreateDateLogFilePath(std::time_t now_time) {
+    std::filesystem::create_directories(kLogDir);
+    return (kLogDir / GetDateFileName(now_time)).string();
 }
 
-LogStream::LogStream(const std::string& filename, std::ostream& stream) :
-    file_(filename, std::ios::out | std::ios::app), stream_(&stream) {}
+std::string CreateLatestLogFilePath() {
+    std::filesystem::create_directories(kLogDir);
+    return (kLogDir / "latest.log").string();
+}
 
-LogStream::LogStream(const std::string& filename, const std::string& latest_filename, std::ostream& stream) :
-    file_(filename, std::ios::out | std::ios::app),
-    latest_file_(latest_filename, std::ios::out | (g_latest_log_truncated ? std::ios::app : std::ios::trunc)),
-    stream_(&stream) {
+std::ios::openmode LatestLogOpenMode() {
+    std::ios::openmode mode = std::ios::out | (g_latest_log_truncated ? std::ios::app : std::ios::trunc);
     g_latest_log_truncated = true;
+    return mode;
 }
 
-LogStream::~LogStream() {
-    if (file_.is_open()) {
-        file_.flush();
+// One formatted log statement travelling from a producer to the writer thread.
+struct Record {
+    std::string text;
+    std::string filename;  // empty means daily log + latest.log
+    std::ostream* stream = nullptr;
+    Level level = Level::Info;
+};
+
+// Intrusive multi-producer single-consumer queue (D. Vyukov's algorithm).
+// Push() is wait-free for producers, Pop() is only called by the writer thread.
+class MpscQueue {
+  public:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        Record record;
+    };
+
+    MpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+    void Push(Node* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
     }
-    if (latest_file_.is_open()) {
+
+    // Returns nullptr when the queue is empty (or a producer is half-way through Push()).
+    Node* Pop() {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (!next) {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+        if (tail != head_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        Push(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    // True when every pushed node has been popped; consumer side only.
+    bool Empty() const { return tail_ == &stub_ && head_.load(std::memory_order_acquire) == &stub_; }
+
+  private:
+    std::atomic<Node*> head_;
+    Node* tail_;
+    Node stub_;
+};
+
+class AsyncBackend {
+  public:
+    void Start(const AsyncOptions& options) {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        if (writer_.joinable()) {
+            return;
+        }
+        options_ = options;
+        stop_ = false;
+        writer_ = std::thread(&AsyncBackend::Run, this);
+        running_.store(true);
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            if (!writer_.joinable()) {
+                return;
+            }
+            running_.store(false);
+            stop_ = true;
+        }
+        wake_cv_.notify_one();
+        writer_.join();
+    }
+
+    // Queues `record` for the writer thread; false (with `record` untouched) once the backend is stopped.
+    bool TryPush(Record& record) {
+        // Paired with Stop(): either it sees this producer or the producer sees running_ already false.
+        producers_.fetch_add(1);
+        if (!running_.load()) {
+            producers_.fetch_sub(1, std::memory_order_release);
+            return false;
+        }
+        const bool urgent = record.level >= Level::Error;
+        auto* node = new MpscQueue::Node();
+        node->record = std::move(record);
+        queue_.Push(node);
+
+        std::size_t pending = pending_.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (urgent || pending >= options_.max_batch) {
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex_);
+                wake_requested_ = true;
+            }
+            wake_cv_.notify_one();
+        }
+        producers_.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+  private:
+    void Run() {
+        bool stopping = false;
+        while (!stopping) {
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex_);
+                wake_cv_.wait_for(lock, options_.flush_interval, [this]() { return stop_ || wake_requested_; });
+                wake_requested_ = false;
+                stopping = stop_;
+            }
+            WriteBatch();
+        }
+        // Producers that got past the running_ check before Stop() finish their Push() first; everyone
+        // later writes synchronously. Pop() gives up on a half-linked node, so keep going until it's empty.
+        while (producers_.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+        WriteBatch();
+        while (!queue_.Empty()) {
+            std::this_thread::yield();
+            WriteBatch();
+        }
+        daily_file_.close();
+        latest_file_.close();
+        custom_files_.clear();
+    }
+
+    void WriteBatch() {
+        bool console_out = false;
+        bool console_err = false;
+        bool rolled = false;
+        while (MpscQueue::Node* node = queue_.Pop()) {
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+            Record& record = node->record;
+            if (!rolled) {
+                RollDailyFileIfNeeded();
+                rolled = true;
+            }
+            (*record.stream) << record.text;
+            console_out |= (record.stream == &std::cout);
+            console_err |= (record.stream != &std::cout);
+            if (record.filename.empty()) {
+                daily_file_ << record.text;
+                latest_file_ << record.text;
+            } else {
+                std::ofstream& file = custom_files_[record.filename];
+                if (!file.is_open()) {
+                    file.open(record.filename, std::ios::out | std::ios::app);
+                }
+                file << record.text;
+            }
+            delete node;
+        }
+        if (!rolled) {
+            return;
+        }
+        daily_file_.flush();
         latest_file_.flush();
+        for (auto& entry : custom_files_) {
+            entry.second.flush();
+        }
+        if (console_out) std::cout.flush();
+        if (console_err) std::cerr.flush();
+    }
+
+    void RollDailyFileIfNeeded() {
+        const std::time_t now_time = std::chrono::system_clock::to_time_t(options_.clock());
+        std::string date_file = GetDateFileName(now_time);
+        if (date_file == current_date_file_ && daily_file_.is_open()) {
+            return;
+        }
+        try {
+            std::filesystem::create_directories(kLogDir);
+        } catch (const std::exception&) {
+            // leave files closed; records still reach the console
+        }
+        daily_file_.close();
+        daily_file_.clear();
+        daily_file_.open((kLogDir / date_file).string(), std::ios::out | std::ios::app);
+        current_date_file_ = std::move(date_file);
+        if (!latest_file_.is_open()) {
+            std::lock_guard<std::mutex> lock(g_sync_mutex);
+            latest_file_.open((kLogDir / "latest.log").string(), LatestLogOpenMode());
+        }
+    }
+
+    AsyncOptions options_;
+    MpscQueue queue_;
+    std::atomic<std::size_t> pending_{0};
+    std::atomic<bool> running_{false};
+    std::atomic<int> producers_{0};  // threads between the running_ check and the end of Push()
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    bool wake_requested_ = false;
+    bool stop_ = false;
+    std::thread writer_;
+
+    // Owned by the writer thread.
+    std::ofstream daily_file_;
+    std::ofstream latest_file_;
+    std::string current_date_file_;
+    std::unordered_map<std::string, std::ofstream> custom_files_;
+};
+
+// Intentionally never destroyed: statements logged during static destruction must not touch a dead backend.
+AsyncBackend& Backend() {
+    static AsyncBackend* backend = new AsyncBackend();
+    return *backend;
+}
+
+// Per-thread formatting buffer, reused between statements to avoid reallocations.
+thread_local std::ostringstream t_buffer;
+thread_local bool t_buffer_in_use = false;
+
+// Per-thread cache of the "[HH:MM:SS] " prefix - it only changes once a second.
+thread_local std::time_t t_stamp_time = -1;
+thread_local char t_stamp[16];
+
+void WriteSync(const std::string& text, const std::string& filename, std::ostream& stream) {
+    std::lock_guard<std::mutex> lock(g_sync_mutex);
+    stream << text;
+    stream.flush();
+    if (filename.empty()) {
+        const std::time_t now_time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        std::ofstream file(CreateDateLogFilePath(now_time), std::ios::out | std::ios::app);
+        std::ofstream latest_file(CreateLatestLogFilePath(), LatestLogOpenMode());
+        file << text;
+        latest_file << text;
+    } else {
+        std::ofstream file(filename, std::ios::out | std::ios::app);
+        file << text;
+    }
+}
+
+}  // namespace
+
+LogStream::LogStream(const std::string& filename, std::ostream& stream, Level level) :
+    filename_(filename), stream_(&stream), level_(level) {
+    if (!t_buffer_in_use) {
+        t_buffer_in_use = true;
+        owns_thread_buffer_ = true;
+        t_buffer.str(std::string());
+        t_buffer.clear();
+        buffer_ = &t_buffer;
+    } else {
+        own_buffer_ = std::make_unique<std::ostringstream>();
+        buffer_ = own_buffer_.get();
+    }
+}
+
+LogStream::LogStream(std::ostream& stream, Level level) : LogStream(std::string(), stream, level) {}
+
+LogStream::~LogStream() {
+    std::string text = buffer_->str();
+    if (owns_thread_buffer_) {
+        t_buffer_in_use = false;
+    }
+    if (text.empty()) {
+        return;
+    }
+
+    if (!IsEnabled(level_)) {
+        return;  // log()/log_error() statements don't go through the LOG_* check
+    }
+    try {
+        Record record{std::move(text), std::move(filename_), stream_, level_};
+        if (!Backend().TryPush(record)) {
+            WriteSync(record.text, record.filename, *record.stream);
+        }
+    } catch (...) {
+        // logging must never throw out of a destructor
     }
-    stream_->flush();
 }
 
 void LogStream::WritePrefixIfNeeded() {
     if (!at_line_start_) {
         return;
     }
-    const auto now = std::chrono::system_clock::now();
-    const std::time_t now_time = std::chrono::system_clock::to_time_t(now);
-    std::tm local_tm{};
-#if defined(_WIN32)
-    localtime_s(&local_tm, &now_time);
-#else
-    localtime_r(&now_time, &local_tm);
-#endif
-    std::ostringstream stamp;
-    stamp << "[" << std::put_time(&local_tm, "%H:%M:%S") << "] ";
-    (*stream_) << stamp.str();
-    if (file_.is_open()) {
-        file_ << stamp.str();
-    }
-    if (latest_file_.is_open()) {
-        latest_file_ << stamp.str();
+    const std::time_t now_time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    if (now_time != t_stamp_time) {
+        const std::tm local_tm = LocalTime(now_time);
+        std::strftime(t_stamp, sizeof(t_stamp), "[%H:%M:%S] ", &local_tm);
+        t_stamp_time = now_time;
     }
+    (*buffer_) << t_stamp;
     at_line_start_ = false;
 }
 
 LogStream& LogStream::operator<<(std::ostream& (*manip)(std::ostream&)) {
     WritePrefixIfNeeded();
-    manip(*stream_);
-    if (file_.is_open()) {
-        manip(file_);
-    }
-    if (latest_file_.is_open()) {
-        manip(latest_file_);
-    }
     if (manip == static_cast<std::ostream& (*)(std::ostream&)>(std::endl<char, std::char_traits<char>>)) {
+        // flushing is the backend's business - just end the line
+        (*buffer_) << '\n';
         at_line_start_ = true;
+    } else {
+        manip(*buffer_);
     }
     return *this;
 }
 
 LogStream log(const std::string& filename) { return LogStream(filename, std::cout); }
 
-LogStream log() { return LogStream(CreateDateLogFilePath(), CreateLatestLogFilePath(), std::cout); }
+LogStream log() { return LogStream(std::cout); }
+
+LogStream log_error(const std::string& filename) { return LogStream(filename, std::cerr, Level::Error); }
+
+LogStream log_error() { return LogStream(std::cerr, Level::Error); }
+
+LogStream log(Level level) { return LogStream(level >= Level::Warn ? std::cerr : std::cout, level); }
+
+void SetLevel(Level level) { g_runtime_level.store(static_cast<int>(level), std::memory_order_relaxed); }
+
+Level GetLevel() { return static_cast<Level>(g_runtime_level.load(std::memory_order_relaxed)); }
+
+const char* ToString(Level level) {
+    switch (level) {
+        case Level::Trace: return "trace";
+        case Level::Debug: return "debug";
+        case Level::Info: return "info";
+        case Level::Warn: return "warn";
+        case Level::Error: return "error";
+        case Level::Off: return "off";
+        default: return "undefined";
+    }
+}
+
+bool ParseLevel(const std::string& name, Level& level) {
+    std::string lowered(name);
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    if (lowered == "trace") {
+        level = Level::Trace;
+    } else if (lowered == "debug") {
+        level = Level::Debug;
+    } else if (lowered == "info") {
+        level = Level::Info;
+    } else if (lowered == "warn" || lowered == "warning") {
+        level = Level::Warn;
+    } else if (lowered == "error") {
+        level = Level::Error;
+    } else if (lowered == "off") {
+        level = Level::Off;
+    } else {
+        return false;
+    }
+    return true;
+}
 
-LogStream log_error(const std::string& filename) { return LogStream(filename, std::cerr); }
+void StartAsync(const AsyncOptions& options) { Backend().Start(options); }
 
-LogStream log_error() { return LogStream(CreateDateLogFilePath(), CreateLatestLogFilePath(), std::cerr); }
+void StopAsync() { Backend().Stop(); }
 
-}  // namespace logger
\ No newline at end of file
+}  // namespace logger
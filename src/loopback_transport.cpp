@@ -0,0 +1,233 @@
+#include "loopback_transport.h"
+
+#include <iterator>
+#include <mutex>
+#include <utility>
+
+#include "logger.h"
+
+namespace {
+
+// Reply subjects of requests: "<kInboxPrefix><correlation id>".
+constexpr std::string_view kInboxPrefix = "_LOOPBACK_INBOX.";
+
+natsMsg* CreateMessage(const std::string& subject,
+                       const char* reply_subject,
+                       std::string_view payload,
+                       const Transport::Headers& headers) {
+    natsMsg* msg = nullptr;
+    natsStatus status =
+        natsMsg_Create(&msg, subject.c_str(), reply_subject, payload.data(), static_cast<int>(payload.size()));
+    for (const auto& header : headers) {
+        if (status == NATS_OK) {
+            status = natsMsgHeader_Set(msg, header.first.c_str(), header.second.c_str());
+        }
+    }
+    if (status != NATS_OK) {
+        LOG_ERROR() << "Failed to create message: " << natsStatus_GetText(status) << "\n";
+        natsMsg_Destroy(msg);
+        return nullptr;
+    }
+    return msg;
+}
+
+}  // namespace
+
+LoopbackTransport::LoopbackTransport() { pending_.Start(); }
+
+LoopbackTransport::~LoopbackTransport() {
+    pending_.Stop("Loopback transport closed");
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    subs_.clear();
+}
+
+bool LoopbackTransport::Publish(const std::string& subject, const nlohmann::json& message) {
+    WireEncoding encoding = EncodingFor(subject);
+    return Send(subject, nullptr, EncodePayload(message, encoding), HeadersFor(encoding));
+}
+
+bool LoopbackTransport::PublishRaw(const std::string& subject, std::string_view payload) {
+    return Send(subject, nullptr, payload, {});
+}
+
+bool LoopbackTransport::Respond(const NatsMessage& request, std::string_view payload, const Headers& headers) {
+    std::string_view reply_subject = request.Reply();
+    if (reply_subject.empty()) {
+        return false;
+    }
+    return Send(std::string(reply_subject), nullptr, payload, headers);
+}
+
+bool LoopbackTransport::SubscribeRaw(const std::string& subject, RawHandler handler) {
+    if (!IsValidSubject(subject, true)) {
+        LOG_ERROR() << "Subscribe failed: invalid subject '" << subject << "'\n";
+        return false;
+    }
+    auto subscription = std::make_shared<const Subscription>(Subscription{subject, std::move(handler)});
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    subs_.push_back(std::move(subscription));
+    return true;
+}
+
+bool LoopbackTransport::Unsubscribe(const std::string& subject) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (auto it = subs_.rbegin(); it != subs_.rend(); ++it) {
+        if ((*it)->pattern == subject) {
+            subs_.erase(std::next(it).base());
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LoopbackTransport::Flush(std::chrono::milliseconds) { return true; }
+
+bool LoopbackTransport::Flush(const std::string&, std::chrono::milliseconds) { return true; }
+
+uint64_t LoopbackTransport::AsyncRequest(const std::string& subject,
+                                         const nlohmann::json& message,
+                                         Clock::time_point deadline,
+                                         const std::string& group,
+                                         ReplyHandler on_reply) {
+    return StartRequest(subject, message, deadline, group, std::move(on_reply), false);
+}
+
+uint64_t LoopbackTransport::AsyncStreamRequest(const std::string& subject,
+                                               const nlohmann::json& message,
+                                               Clock::time_point deadline,
+                                               const std::string& group,
+                                               ReplyHandler on_chunk) {
+    return StartRequest(
+        subject, message, deadline, group, PendingRequests::SerializeChunks(std::move(on_chunk)), true);
+}
+
+bool LoopbackTransport::CancelRequest(uint64_t id, const std::string& reason) { return pending_.Cancel(id, reason); }
+
+std::size_t LoopbackTransport::CancelRequests(const std::string& group, const std::string& reason) {
+    return pending_.CancelGroup(group, reason);
+}
+
+bool LoopbackTransport::GetStats(NatsStats& stats) const {
+    stats.in_msgs = in_msgs_.load(std::memory_order_relaxed);
+    stats.in_bytes = in_bytes_.load(std::memory_order_relaxed);
+    stats.out_msgs = out_msgs_.load(std::memory_order_relaxed);
+    stats.out_bytes = out_bytes_.load(std::memory_order_relaxed);
+    stats.reconnects = 0;
+    return true;
+}
+
+uint64_t LoopbackTransport::StartRequest(const std::string& subject,
+                                         const nlohmann::json& message,
+                                         Clock::time_point deadline,
+                                         const std::string& group,
+                                         ReplyHandler on_reply,
+                                         bool streamed) {
+    // Registered first: with synchronous delivery the reply usually arrives before Send() returns.
+    uint64_t id = pending_.Add(std::move(on_reply), deadline, group, streamed);
+    std::string reply_subject = std::string(kInboxPrefix) + std::to_string(id);
+    WireEncoding encoding = EncodingFor(subject);
+    if (!Send(subject, reply_subject.c_str(), EncodePayload(message, encoding), HeadersFor(encoding))) {
+        NatsReply failure;
+        failure.status = NatsReply::Status::Failed;
+        failure.error = "Failed to publish message";
+        pending_.Complete(id, std::move(failure));
+        return 0;
+    }
+    return id;
+}
+
+bool LoopbackTransport::Send(const std::string& subject,
+                             const char* reply_subject,
+                             std::string_view payload,
+                             const Headers& headers) {
+    if (!IsValidSubject(subject, false)) {
+        LOG_ERROR() << "Publish failed: invalid subject '" << subject << "'\n";
+        return false;
+    }
+    out_msgs_.fetch_add(1, std::memory_order_relaxed);
+    out_bytes_.fetch_add(payload.size(), std::memory_order_relaxed);
+
+    if (subject.compare(0, kInboxPrefix.size(), kInboxPrefix) == 0) {
+        natsMsg* msg = CreateMessage(subject, reply_subject, payload, headers);
+        if (!msg) {
+            return false;
+        }
+        in_msgs_.fetch_add(1, std::memory_order_relaxed);
+        in_bytes_.fetch_add(payload.size(), std::memory_order_relaxed);
+        auto message = std::make_shared<NatsMessage>(msg);
+        pending_.Deliver(PendingRequests::IdFromSubject(subject), std::move(message));
+        return true;
+    }
+
+    // Handlers run outside the lock, so they may publish, subscribe or unsubscribe themselves.
+    std::vector<std::shared_ptr<const Subscription>> matched;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (const auto& subscription : subs_) {
+            if (SubjectMatches(subscription->pattern, subject)) {
+                matched.push_back(subscription);
+            }
+        }
+    }
+    for (const auto& subscription : matched) {
+        natsMsg* msg = CreateMessage(subject, reply_subject, payload, headers);
+        if (!msg) {
+            return false;
+        }
+        in_msgs_.fetch_add(1, std::memory_order_relaxed);
+        in_bytes_.fetch_add(payload.size(), std::memory_order_relaxed);
+        NatsMessage message(msg);  // destroys msg at scope exit unless the handler takes it over
+        subscription->handler(message);
+    }
+    return true;
+}
+
+bool LoopbackTransport::SubjectMatches(std::string_view pattern, std::string_view subject) {
+    std::size_t p = 0;
+    std::size_t s = 0;
+    while (true) {
+        std::size_t p_end = pattern.find('.', p);
+        std::size_t s_end = subject.find('.', s);
+        if (p_end == std::string_view::npos) p_end = pattern.size();
+        if (s_end == std::string_view::npos) s_end = subject.size();
+
+        std::string_view token = pattern.substr(p, p_end - p);
+        if (token == ">") {
+            return true;  // the subject still has at least this token left
+        }
+        if (token != "*" && token != subject.substr(s, s_end - s)) {
+            return false;
+        }
+        bool pattern_done = p_end == pattern.size();
+        bool subject_done = s_end == subject.size();
+        if (pattern_done || subject_done) {
+            return pattern_done && subject_done;
+        }
+        p = p_end + 1;
+        s = s_end + 1;
+    }
+}
+
+bool LoopbackTransport::IsValidSubject(std::string_view subject, bool wildcards) {
+    if (subject.empty()) {
+        return false;
+    }
+    std::size_t start = 0;
+    while (true) {
+        std::size_t end = subject.find('.', start);
+        bool last = end == std::string_view::npos;
+        std::string_view token = subject.substr(start, last ? std::string_view::npos : end - start);
+        if (token.empty() || token.find_first_of(" \t\r\n") != std::string_view::npos) {
+            return false;
+        }
+        if (token == "*" || token == ">") {
+            if (!wildcards || (token == ">" && !last)) {
+                return false;
+            }
+        }
+        if (last) {
+            return true;
+        }
+        start = end + 1;
+    }
+}
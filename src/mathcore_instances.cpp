@@ -0,0 +1,149 @@
+#include "mathcore_instances.h"
+
+#include <algorithm>
+
+MathCoreInstances::Update MathCoreInstances::Record(const std::string& instance,
+                                                    const std::string& event,
+                                                    double load,
+                                                    Clock::time_point now) {
+    Update update;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto inserted = instances_.try_emplace(instance);
+    Instance& state = inserted.first->second;
+    update.revived = inserted.second || !state.alive;
+    state.alive = true;
+    state.last_heartbeat = now;
+
+    if (event == "startup") {
+        update.restarted = true;
+        ++state.epoch;
+        ++startups_;
+        state.load = 0;
+        state.routed = 0;
+        // The instance forgot its jobs; requests about them have nowhere to go anymore.
+        for (auto it = jobs_.begin(); it != jobs_.end();) {
+            if (it->second.instance == instance) {
+                update.lost_jobs.push_back(it->first);
+                it = jobs_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (load >= 0) {
+        state.load = load;
+        state.routed = 0;
+    }
+    return update;
+}
+
+std::vector<std::string> MathCoreInstances::Expire(Clock::time_point now, Clock::duration timeout) {
+    std::vector<std::string> expired;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : instances_) {
+        if (entry.second.alive && now - entry.second.last_heartbeat >= timeout) {
+            entry.second.alive = false;
+            expired.push_back(entry.first);
+        }
+    }
+    return expired;
+}
+
+MathCoreInstances::Clock::time_point MathCoreInstances::NextExpiry(Clock::duration timeout) const {
+    Clock::time_point next = Clock::time_point::max();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& entry : instances_) {
+        if (entry.second.alive) {
+            next = std::min(next, entry.second.last_heartbeat + timeout);
+        }
+    }
+    return next;
+}
+
+MathCoreInstances::Route MathCoreInstances::Assign(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Instance* best = nullptr;
+    const std::string* best_name = nullptr;
+    double best_load = 0;
+    for (auto& entry : instances_) {
+        if (!entry.second.alive) {
+            continue;
+        }
+        const double load = entry.second.load + static_cast<double>(entry.second.routed);
+        if (!best || load < best_load) {
+            best = &entry.second;
+            best_name = &entry.first;
+            best_load = load;
+        }
+    }
+    if (!best) {
+        return Route{};
+    }
+    ++best->routed;
+    Route route{*best_name, best->epoch};
+    jobs_[id] = route;
+    return route;
+}
+
+void MathCoreInstances::Release(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(id);
+    if (it == jobs_.end()) {
+        return;
+    }
+    auto instance = instances_.find(it->second.instance);
+    if (instance != instances_.end() && instance->second.routed > 0) {
+        --instance->second.routed;
+    }
+    jobs_.erase(it);
+}
+
+MathCoreInstances::Route MathCoreInstances::Find(const std::string& id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(id);
+    return it != jobs_.end() ? it->second : Route{"", startups_};
+}
+
+MathCoreInstances::Route MathCoreInstances::Shared() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Route{"", startups_};
+}
+
+bool MathCoreInstances::Restarted(const Route& route) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (route.instance.empty()) {
+        return !routing_ && route.epoch != startups_;
+    }
+    auto it = instances_.find(route.instance);
+    return it != instances_.end() && it->second.epoch != route.epoch;
+}
+
+bool MathCoreInstances::IsAlive(const Route& route) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (route.instance.empty()) {
+        return std::any_of(instances_.begin(), instances_.end(), [](const auto& entry) { return entry.second.alive; });
+    }
+    auto it = instances_.find(route.instance);
+    return it != instances_.end() && it->second.alive;
+}
+
+std::size_t MathCoreInstances::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return instances_.size();
+}
+
+std::size_t MathCoreInstances::alive_count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<std::size_t>(
+        std::count_if(instances_.begin(), instances_.end(), [](const auto& entry) { return entry.second.alive; }));
+}
+
+std::size_t MathCoreInstances::pinned_size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jobs_.size();
+}
+
+uint64_t MathCoreInstances::startups() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return startups_;
+}
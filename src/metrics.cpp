@@ -0,0 +1,232 @@
+#include "metrics.h"
+
+#include <cmath>
+#include <cstdio>
+
+namespace metrics {
+
+namespace {
+
+const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+std::atomic<std::size_t> g_next_shard{0};
+
+int HighestBit(uint64_t value) {
+    int bit = 0;
+    while (value >>= 1) {
+        ++bit;
+    }
+    return bit;
+}
+
+void AppendNumber(std::string& out, double value) {
+    char buffer[32];
+    int length = std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+    if (length > 0) {
+        out.append(buffer, static_cast<std::size_t>(length));
+    }
+}
+
+void AppendHeader(std::string& out, const std::string& name, const char* type, const std::string& help) {
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+// `name{labels}` or `name{labels,extra}`, without braces if both are empty.
+void AppendName(std::string& out, const std::string& name, const std::string& labels, const std::string& extra = "") {
+    out += name;
+    if (labels.empty() && extra.empty()) {
+        out += ' ';
+        return;
+    }
+    out += '{';
+    out += labels;
+    if (!labels.empty() && !extra.empty()) {
+        out += ',';
+    }
+    out += extra;
+    out += "} ";
+}
+
+}  // namespace
+
+std::size_t ThisThreadShard() {
+    thread_local const std::size_t shard = g_next_shard.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return shard;
+}
+
+uint64_t Counter::Value() const {
+    uint64_t total = 0;
+    for (const Shard& shard : shards_) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+Histogram::Histogram() : shards_(new Shard[kShards]) {
+    for (std::size_t s = 0; s < kShards; ++s) {
+        for (auto& bucket : shards_[s].buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+std::size_t Histogram::BucketOf(uint64_t micros) {
+    if (micros < kLinearBuckets) {
+        return static_cast<std::size_t>(micros);
+    }
+    const unsigned exponent = static_cast<unsigned>(HighestBit(micros));
+    if (exponent >= kMaxExponent) {
+        return kBuckets - 1;
+    }
+    const unsigned shift = exponent - kSubBucketBits;
+    const uint64_t sub_bucket = (micros >> shift) & ((uint64_t(1) << kSubBucketBits) - 1);
+    return kLinearBuckets + (exponent - kSubBucketBits - 1) * (std::size_t(1) << kSubBucketBits) + sub_bucket;
+}
+
+uint64_t Histogram::UpperBound(std::size_t bucket) {
+    if (bucket < kLinearBuckets) {
+        return bucket;
+    }
+    const std::size_t sub_buckets = std::size_t(1) << kSubBucketBits;
+    const unsigned shift = static_cast<unsigned>((bucket - kLinearBuckets) / sub_buckets) + 1;
+    const uint64_t sub_bucket = (bucket - kLinearBuckets) % sub_buckets;
+    return ((sub_buckets + sub_bucket + 1) << shift) - 1;
+}
+
+void Histogram::Record(uint64_t micros) {
+    Shard& shard = shards_[ThisThreadShard()];
+    shard.buckets[BucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(micros, std::memory_order_relaxed);
+}
+
+void Histogram::RecordSince(Clock::time_point start) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    Record(elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0);
+}
+
+Histogram::Snapshot Histogram::Collect() const {
+    Snapshot snapshot;
+    snapshot.buckets.assign(kBuckets, 0);
+    for (std::size_t s = 0; s < kShards; ++s) {
+        const Shard& shard = shards_[s];
+        for (std::size_t b = 0; b < kBuckets; ++b) {
+            snapshot.buckets[b] += shard.buckets[b].load(std::memory_order_relaxed);
+        }
+        snapshot.count += shard.count.load(std::memory_order_relaxed);
+        snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+uint64_t Histogram::Snapshot::ValueAt(double quantile) const {
+    // Shards are read one after another while others record, so count may differ a bit from the buckets' sum.
+    uint64_t total = 0;
+    for (uint64_t in_bucket : buckets) {
+        total += in_bucket;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(quantile * static_cast<double>(total)));
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (std::size_t b = 0; b < buckets.size(); ++b) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            return UpperBound(b);
+        }
+    }
+    return UpperBound(buckets.size() - 1);
+}
+
+template <typename Metric>
+Metric& Registry::GetLocked(std::map<std::string, Family<Metric>>& families,
+                            const std::string& name,
+                            const std::string& help,
+                            const std::string& labels) {
+    Family<Metric>& family = families[name];
+    if (family.help.empty()) {
+        family.help = help;
+    }
+    std::unique_ptr<Metric>& metric = family.by_labels[labels];
+    if (!metric) {
+        metric = std::make_unique<Metric>();
+    }
+    return *metric;
+}
+
+Counter& Registry::GetCounter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return GetLocked(counters_, name, help, labels);
+}
+
+Gauge& Registry::GetGauge(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return GetLocked(gauges_, name, help, labels);
+}
+
+Histogram& Registry::GetHistogram(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return GetLocked(histograms_, name, help, labels);
+}
+
+std::string Registry::Render() const {
+    std::string out;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& family : counters_) {
+        AppendHeader(out, family.first, "counter", family.second.help);
+        for (const auto& metric : family.second.by_labels) {
+            AppendName(out, family.first, metric.first);
+            AppendNumber(out, static_cast<double>(metric.second->Value()));
+            out += '\n';
+        }
+    }
+    for (const auto& family : gauges_) {
+        AppendHeader(out, family.first, "gauge", family.second.help);
+        for (const auto& metric : family.second.by_labels) {
+            AppendName(out, family.first, metric.first);
+            AppendNumber(out, static_cast<double>(metric.second->Value()));
+            out += '\n';
+        }
+    }
+    for (const auto& family : histograms_) {
+        AppendHeader(out, family.first, "summary", family.second.help);
+        for (const auto& metric : family.second.by_labels) {
+            const Histogram::Snapshot snapshot = metric.second->Collect();
+            for (double quantile : kQuantiles) {
+                std::string label = "quantile=\"";
+                AppendNumber(label, quantile);
+                label += '"';
+                AppendName(out, family.first, metric.first, label);
+                AppendNumber(out, static_cast<double>(snapshot.ValueAt(quantile)) / 1e6);
+                out += '\n';
+            }
+            AppendName(out, family.first + "_sum", metric.first);
+            AppendNumber(out, static_cast<double>(snapshot.sum) / 1e6);
+            out += '\n';
+            AppendName(out, family.first + "_count", metric.first);
+            AppendNumber(out, static_cast<double>(snapshot.count));
+            out += '\n';
+        }
+    }
+    return out;
+}
+
+// Intentionally never destroyed: metrics may still be recorded by threads finishing during static destruction.
+Registry& Global() {
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+void AppendSample(std::string& out, const std::string& name, const char* type, const std::string& help, double value) {
+    AppendHeader(out, name, type, help);
+    AppendName(out, name, "");
+    AppendNumber(out, value);
+    out += '\n';
+}
+
+}  // namespace metrics
@@ -1,108 +1,578 @@
 #include "nats_manager.h"
 
+#include <functional>
+#include <memory>
+#include <utility>
+
 #include "logger.h"
+#include "metrics.h"
+
+namespace {
+
+// Metrics of the NATS paths, looked up once.
+struct NatsMetrics {
+    metrics::Histogram& publish =
+        metrics::Global().GetHistogram("nats_connector_nats_publish_seconds", "Time spent handing a message to nats.c");
+    metrics::Counter& publish_failures = metrics::Global().GetCounter(
+        "nats_connector_nats_publish_failures_total", "Messages nats.c refused to publish");
+    metrics::Counter& received_subscription = metrics::Global().GetCounter(
+        "nats_connector_nats_received_total", "Messages received from NATS", "path=\"subscription\"");
+    metrics::Counter& received_inbox = metrics::Global().GetCounter(
+        "nats_connector_nats_received_total", "Messages received from NATS", "path=\"inbox\"");
+    metrics::Histogram& callback = metrics::Global().GetHistogram(
+        "nats_connector_nats_callback_seconds", "Run time of subscription handlers on NATS delivery threads");
+    metrics::Histogram& reply_dispatch = metrics::Global().GetHistogram(
+        "nats_connector_nats_reply_dispatch_seconds", "Routing a reply to its request, handler included");
+    metrics::Counter& slow_consumer_subscription = metrics::Global().GetCounter(
+        "nats_connector_nats_slow_consumer_total", "Slow consumer reports: nats.c dropped messages",
+        "path=\"subscription\"");
+    metrics::Counter& slow_consumer_inbox = metrics::Global().GetCounter(
+        "nats_connector_nats_slow_consumer_total", "Slow consumer reports: nats.c dropped messages",
+        "path=\"inbox\"");
+    metrics::Counter& async_errors = metrics::Global().GetCounter(
+        "nats_connector_nats_async_errors_total", "Other asynchronous errors reported by nats.c");
+    metrics::Counter& disconnects =
+        metrics::Global().GetCounter("nats_connector_nats_disconnects_total", "Connections lost to the NATS server");
+};
 
-NatsManager::NatsManager() : conn_(nullptr) {}
+// How long Close() waits for nats.c to finish the callbacks of a connection.
+constexpr std::chrono::seconds kCloseTimeout(5);
+
+NatsMetrics& Metrics() {
+    static NatsMetrics* nats_metrics = new NatsMetrics();
+    return *nats_metrics;
+}
+
+}  // namespace
+
+NatsManager::NatsManager() = default;
 
 NatsManager::~NatsManager() { Disconnect(); }
 
 bool NatsManager::Connect(const std::string& server_url) {
-    natsStatus status = natsConnection_ConnectTo(&conn_, server_url.c_str());
+    if (options_.delivery_threads > 0) {
+        natsStatus status = nats_SetMessageDeliveryPoolSize(options_.delivery_threads);
+        if (status != NATS_OK) {
+            LOG_ERROR() << "Failed to size the message delivery pool: " << natsStatus_GetText(status) << "\n";
+            return false;
+        }
+    }
+
+    const std::size_t count = options_.connections == 0 ? 1 : options_.connections;
+    for (std::size_t i = 0; i < count; ++i) {
+        connections_.push_back(std::make_unique<Connection>());
+        connections_.back()->owner = this;
+        connections_.back()->index = i;
+        if (!Open(*connections_.back(), server_url)) {
+            Disconnect();
+            return false;
+        }
+    }
+
+    pending_.Start();
+    return true;
+}
+
+bool NatsManager::Open(Connection& connection, const std::string& server_url) {
+    natsStatus status = ConnectWithOptions(connection, server_url);
+    if (status != NATS_OK) {
+        LOG_ERROR() << "NATS connect failed: " << natsStatus_GetText(status) << "\n";
+        return false;
+    }
+
+    natsInbox* inbox = nullptr;
+    status = natsInbox_Create(&inbox);
+    if (status == NATS_OK) {
+        connection.inbox_prefix = inbox;
+        natsInbox_Destroy(inbox);
+        std::string inbox_subject = connection.inbox_prefix + ".*";
+        status = natsConnection_Subscribe(
+            &connection.inbox_sub, connection.conn, inbox_subject.c_str(), InboxCallback, this);
+    }
+    if (status == NATS_OK) {
+        SetPendingLimits(connection.inbox_sub);
+    }
     if (status != NATS_OK) {
-        logger::log_error() << "NATS connect failed: " << natsStatus_GetText(status) << "\n";
+        LOG_ERROR() << "Failed to set up reply inbox: " << natsStatus_GetText(status) << "\n";
         return false;
     }
+
+    if (options_.async_publish.enabled) {
+        natsConnection* conn = connection.conn;
+        connection.publisher = std::make_unique<AsyncPublisher>(
+            options_.async_publish,
+            [conn](const AsyncPublisher::Message& message) {
+                natsStatus status = PublishMsg(conn,
+                                               message.subject,
+                                               message.reply.empty() ? nullptr : message.reply.c_str(),
+                                               message.payload,
+                                               message.headers);
+                if (status != NATS_OK) {
+                    LOG_ERROR() << "Publish failed: " << natsStatus_GetText(status) << "\n";
+                }
+                return status == NATS_OK;
+            },
+            [conn](std::chrono::milliseconds timeout) {
+                natsStatus status = natsConnection_FlushTimeout(conn, static_cast<int64_t>(timeout.count()));
+                if (status != NATS_OK) {
+                    LOG_WARN() << "Flush failed: " << natsStatus_GetText(status) << "\n";
+                }
+                return status == NATS_OK;
+            });
+    }
     return true;
 }
 
+natsStatus NatsManager::ConnectWithOptions(Connection& connection, const std::string& server_url) {
+    natsOptions* opts = nullptr;
+    natsStatus status = natsOptions_Create(&opts);
+    if (status == NATS_OK) {
+        status = natsOptions_SetURL(opts, server_url.c_str());
+    }
+    if (status == NATS_OK && options_.delivery_threads > 0) {
+        status = natsOptions_UseGlobalMessageDelivery(opts, true);
+    }
+    if (status == NATS_OK && options_.io_buffer_size > 0) {
+        status = natsOptions_SetIOBufSize(opts, options_.io_buffer_size);
+    }
+    if (status == NATS_OK) {
+        status = natsOptions_SetSendAsap(opts, options_.send_asap);
+    }
+    if (status == NATS_OK) {
+        status = natsOptions_SetErrorHandler(opts, OnAsyncError, &connection);
+    }
+    if (status == NATS_OK) {
+        status = natsOptions_SetDisconnectedCB(opts, OnDisconnected, &connection);
+    }
+    if (status == NATS_OK) {
+        status = natsOptions_SetClosedCB(opts, OnClosed, &connection);
+    }
+    if (status == NATS_OK) {
+        status = natsConnection_Connect(&connection.conn, opts);
+    }
+    natsOptions_Destroy(opts);
+    return status;
+}
+
+void NatsManager::SetPendingLimits(natsSubscription* sub) const {
+    if (options_.pending_msgs <= 0 && options_.pending_bytes <= 0) {
+        return;
+    }
+    int msgs = 0;
+    int bytes = 0;
+    natsStatus status = natsSubscription_GetPendingLimits(sub, &msgs, &bytes);
+    if (status == NATS_OK) {
+        status = natsSubscription_SetPendingLimits(sub,
+                                                   options_.pending_msgs > 0 ? options_.pending_msgs : msgs,
+                                                   options_.pending_bytes > 0 ? options_.pending_bytes : bytes);
+    }
+    if (status != NATS_OK) {
+        LOG_WARN() << "Failed to set pending limits: " << natsStatus_GetText(status) << "\n";
+    }
+}
+
+void NatsManager::Close(Connection& connection) {
+    connection.publisher.reset();  // hands over what's still queued while the connection is alive
+    if (connection.inbox_sub) {
+        natsSubscription_Unsubscribe(connection.inbox_sub);
+        natsSubscription_Destroy(connection.inbox_sub);
+        connection.inbox_sub = nullptr;
+    }
+    if (connection.conn) {
+        // The connection callbacks refer to `connection`: wait for the last one before it goes away.
+        natsConnection_Close(connection.conn);
+        std::unique_lock<std::mutex> lock(connection.mutex);
+        if (!connection.closed_cv.wait_for(lock, kCloseTimeout, [&connection]() { return connection.closed; })) {
+            LOG_WARN() << "NATS connection didn't report being closed\n";
+        }
+        lock.unlock();
+        natsConnection_Destroy(connection.conn);
+        connection.conn = nullptr;
+    }
+}
+
+std::size_t NatsManager::ShardOf(std::string_view subject) const {
+    if (connections_.size() <= 1) {
+        return 0;
+    }
+    std::size_t dot = subject.rfind('.');
+    std::string_view key = dot == std::string_view::npos ? subject : subject.substr(dot + 1);
+    return std::hash<std::string_view>()(key) % connections_.size();
+}
+
+natsConnection* NatsManager::get_connection(std::size_t index) const {
+    return index < connections_.size() ? connections_[index]->conn : nullptr;
+}
+
 bool NatsManager::Publish(const std::string& subject, const nlohmann::json& message) {
-    if (!conn_) {
-        logger::log_error() << "Not connected to NATS server.\n";
+    if (connections_.empty()) {
+        LOG_ERROR() << "Not connected to NATS server.\n";
         return false;
     }
 
-    std::string msg_str = message.dump();
-    natsStatus status = natsConnection_Publish(conn_, subject.c_str(), msg_str.c_str(), msg_str.size());
+    WireEncoding encoding = EncodingFor(subject);
+    return Send(*connections_[ShardOf(subject)],
+                subject,
+                nullptr,
+                EncodePayload(message, encoding),
+                HeadersFor(encoding));
+}
+
+bool NatsManager::PublishRaw(const std::string& subject, std::string_view payload) {
+    if (connections_.empty()) {
+        LOG_ERROR() << "Not connected to NATS server.\n";
+        return false;
+    }
+
+    return Send(*connections_[ShardOf(subject)], subject, nullptr, payload, {});
+}
+
+bool NatsManager::Send(Connection& connection,
+                       const std::string& subject,
+                       const char* reply_subject,
+                       std::string_view payload,
+                       Headers headers,
+                       std::function<void()> on_failure) {
+    if (connection.publisher) {
+        return connection.publisher->Enqueue(AsyncPublisher::Message{subject,
+                                                                     reply_subject ? reply_subject : "",
+                                                                     std::string(payload),
+                                                                     std::move(headers),
+                                                                     std::move(on_failure)});
+    }
+
+    natsStatus status = PublishMsg(connection.conn, subject, reply_subject, payload, headers);
     if (status != NATS_OK) {
-        logger::log_error() << "Publish failed: " << natsStatus_GetText(status) << "\n";
+        LOG_ERROR() << "Publish failed: " << natsStatus_GetText(status) << "\n";
         return false;
     }
     return true;
 }
 
-bool NatsManager::Subscribe(const std::string& subject,
-                            std::function<void(const std::string&, const nlohmann::json&)> handler) {
-    if (!conn_) {
-        logger::log_error() << "Not connected to NATS server.\n";
+natsStatus NatsManager::PublishMsg(natsConnection* conn,
+                                   const std::string& subject,
+                                   const char* reply_subject,
+                                   std::string_view payload,
+                                   const Headers& headers) {
+    const auto start = metrics::Histogram::Clock::now();
+    natsStatus status = NATS_OK;
+    // JSON keeps the header-less fast path, which MathCore builds without header support understand too.
+    if (headers.empty()) {
+        if (reply_subject) {
+            status = natsConnection_PublishRequest(
+                conn, subject.c_str(), reply_subject, payload.data(), static_cast<int>(payload.size()));
+        } else {
+            status = natsConnection_Publish(conn, subject.c_str(), payload.data(), static_cast<int>(payload.size()));
+        }
+    } else {
+        natsMsg* msg = nullptr;
+        status = natsMsg_Create(&msg, subject.c_str(), reply_subject, payload.data(), static_cast<int>(payload.size()));
+        for (const auto& header : headers) {
+            if (status == NATS_OK) {
+                status = natsMsgHeader_Set(msg, header.first.c_str(), header.second.c_str());
+            }
+        }
+        if (status == NATS_OK) {
+            status = natsConnection_PublishMsg(conn, msg);
+        }
+        natsMsg_Destroy(msg);
+    }
+
+    Metrics().publish.RecordSince(start);
+    if (status != NATS_OK) {
+        Metrics().publish_failures.Add();
+    }
+    return status;
+}
+
+bool NatsManager::Flush(std::chrono::milliseconds timeout) {
+    if (connections_.empty()) {
         return false;
     }
+    const auto deadline = Clock::now() + timeout;
+    for (const auto& connection : connections_) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+        if (remaining.count() <= 0 || !FlushConnection(*connection, remaining)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NatsManager::Flush(const std::string& subject, std::chrono::milliseconds timeout) {
+    if (connections_.empty()) {
+        return false;
+    }
+    return FlushConnection(*connections_[ShardOf(subject)], timeout);
+}
+
+bool NatsManager::FlushConnection(Connection& connection, std::chrono::milliseconds timeout) {
+    if (connection.publisher) {
+        return connection.publisher->Flush(timeout);
+    }
+    natsStatus status = natsConnection_FlushTimeout(connection.conn, static_cast<int64_t>(timeout.count()));
+    if (status != NATS_OK) {
+        LOG_WARN() << "Flush failed: " << natsStatus_GetText(status) << "\n";
+        return false;
+    }
+    return true;
+}
 
+bool NatsManager::SubscribeRaw(const std::string& subject, RawHandler handler) {
+    return AddSubscription(subject, "", std::move(handler));
+}
+
+bool NatsManager::QueueSubscribeRaw(const std::string& subject, const std::string& queue, RawHandler handler) {
+    return AddSubscription(subject, queue, std::move(handler));
+}
+
+bool NatsManager::AddSubscription(const std::string& subject, const std::string& queue, RawHandler handler) {
+    if (connections_.empty()) {
+        LOG_ERROR() << "Not connected to NATS server.\n";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(subs_mutex_);
+    Connection* connection = connections_.front().get();
+    for (const auto& candidate : connections_) {
+        if (candidate->subscriptions < connection->subscriptions) {
+            connection = candidate.get();
+        }
+    }
+
+    // The handler travels with the subscription as its closure, so delivering a message needs no lookup and
+    // no lock. nats.c hands it back to OnSubscriptionComplete() once no more messages can be delivered.
+    auto* closure = new RawHandler(std::move(handler));
     natsSubscription* sub = nullptr;
-    natsStatus status = natsConnection_Subscribe(&sub, conn_, subject.c_str(), Callback, this);
-    // We pass 'this' so that, inside the callback, we can get back the current object instance (NatsSubscriber*).
-    // This gives us access to private member like callback_ or other methods.
-    // for more information - google "bridging C callbacks with C++ member functions".
-    // Basically in our case - it allows us pass down whatever function we want to deal with the messages.
+    natsStatus status =
+        queue.empty()
+            ? natsConnection_Subscribe(&sub, connection->conn, subject.c_str(), Callback, closure)
+            : natsConnection_QueueSubscribe(&sub, connection->conn, subject.c_str(), queue.c_str(), Callback, closure);
     if (status != NATS_OK) {
-        logger::log_error() << "Subscribe failed: " << natsStatus_GetText(status) << "\n";
+        delete closure;
+        LOG_ERROR() << "Subscribe failed: " << natsStatus_GetText(status) << "\n";
+        return false;
+    }
+    status = natsSubscription_SetOnCompleteCB(sub, OnSubscriptionComplete, closure);
+    if (status != NATS_OK) {
+        // Only fails if the subscription is closed already; the closure may still be in use, so it's leaked.
+        LOG_ERROR() << "Subscribe failed: " << natsStatus_GetText(status) << "\n";
+        natsSubscription_Destroy(sub);
         return false;
     }
 
-    subs_[subject] = sub;
-    callbacks_[sub] = handler;
+    SetPendingLimits(sub);
+    subs_[subject].push_back(SubscriptionEntry{sub, connection});
+    ++connection->subscriptions;
     return true;
 }
 
 bool NatsManager::Unsubscribe(const std::string& subject) {
+    std::lock_guard<std::mutex> lock(subs_mutex_);
     auto it = subs_.find(subject);
     if (it == subs_.end()) {
         return false;
     }
 
-    natsSubscription* sub = it->second;
-    natsStatus status = natsSubscription_Unsubscribe(sub);
+    // The most recent subscription to `subject` goes first.
+    SubscriptionEntry entry = it->second.back();
+    natsStatus status = natsSubscription_Unsubscribe(entry.sub);
     if (status != NATS_OK) {
-        logger::log_error() << "Unsubscribe failed: " << natsStatus_GetText(status) << "\n";
+        LOG_ERROR() << "Unsubscribe failed: " << natsStatus_GetText(status) << "\n";
         return false;
     }
+    // Safe even from inside its own handler: nats.c keeps the subscription until the callback returns.
+    natsSubscription_Destroy(entry.sub);
 
-    callbacks_.erase(sub);
-    subs_.erase(it);
+    --entry.connection->subscriptions;
+    it->second.pop_back();
+    if (it->second.empty()) {
+        subs_.erase(it);
+    }
     return true;
 }
 
 void NatsManager::Callback(natsConnection* nc, natsSubscription* sub, natsMsg* msg, void* closure) {
-    MsgGuard guard{msg};  // will auto-destroy msg at scope exit
+    NatsMessage message(msg);  // destroys msg at scope exit unless the handler takes it over
+    RawHandler* handler = static_cast<RawHandler*>(closure);
+
+    if (!handler) return;
+
+    Metrics().received_subscription.Add();
+    const auto start = metrics::Histogram::Clock::now();
+    (*handler)(message);
+    Metrics().callback.RecordSince(start);
+}
+
+void NatsManager::OnSubscriptionComplete(void* closure) { delete static_cast<RawHandler*>(closure); }
+
+bool NatsManager::Respond(const NatsMessage& request, std::string_view payload, const Headers& headers) {
+    const std::string reply_subject(request.Reply());
+    if (connections_.empty() || reply_subject.empty()) {
+        return false;
+    }
+
+    return Send(*connections_[ShardOf(reply_subject)], reply_subject, nullptr, payload, headers);
+}
+
+bool NatsManager::CancelRequest(uint64_t id, const std::string& reason) { return pending_.Cancel(id, reason); }
+
+std::size_t NatsManager::CancelRequests(const std::string& group, const std::string& reason) {
+    return pending_.CancelGroup(group, reason);
+}
+
+uint64_t NatsManager::AsyncRequest(const std::string& subject,
+                                   const nlohmann::json& message,
+                                   Clock::time_point deadline,
+                                   const std::string& group,
+                                   ReplyHandler on_reply) {
+    return StartRequest(subject, message, deadline, group, std::move(on_reply), false);
+}
+
+uint64_t NatsManager::AsyncStreamRequest(const std::string& subject,
+                                         const nlohmann::json& message,
+                                         Clock::time_point deadline,
+                                         const std::string& group,
+                                         ReplyHandler on_chunk) {
+    return StartRequest(
+        subject, message, deadline, group, PendingRequests::SerializeChunks(std::move(on_chunk)), true);
+}
+
+uint64_t NatsManager::StartRequest(const std::string& subject,
+                                   const nlohmann::json& message,
+                                   Clock::time_point deadline,
+                                   const std::string& group,
+                                   ReplyHandler on_reply,
+                                   bool streamed) {
+    NatsReply failure;
+    failure.status = NatsReply::Status::Failed;
+    if (connections_.empty()) {
+        LOG_ERROR() << "Not connected to NATS server.\n";
+        failure.error = "Not connected to NATS server";
+        on_reply(std::move(failure));
+        return 0;
+    }
+
+    // The reply comes back over the connection the request went out on.
+    Connection& connection = *connections_[ShardOf(subject)];
+    // Register before publishing: the reply may arrive before natsConnection_PublishRequest() returns.
+    uint64_t id = pending_.Add(std::move(on_reply), deadline, group, streamed, connection.index);
+    std::string reply_subject = connection.inbox_prefix + "." + std::to_string(id);
+    WireEncoding encoding = EncodingFor(subject);
+    failure.error = "Failed to publish message to NATS";
+    // In async mode the publisher thread may still drop the message; nothing would answer it then.
+    auto on_failure = [this, id, failure]() mutable { pending_.Complete(id, std::move(failure)); };
+    if (!Send(connection,
+              subject,
+              reply_subject.c_str(),
+              EncodePayload(message, encoding),
+              HeadersFor(encoding),
+              on_failure)) {
+        on_failure();
+        return 0;
+    }
+    return id;
+}
+
+void NatsManager::InboxCallback(natsConnection* nc, natsSubscription* sub, natsMsg* msg, void* closure) {
+    auto message = std::make_shared<NatsMessage>(msg);
     NatsManager* self = static_cast<NatsManager*>(closure);
 
     if (!self) return;
 
-    auto it = self->callbacks_.find(sub);
-    if (it != self->callbacks_.end()) {
-        std::string subject = natsMsg_GetSubject(msg);
-        std::string data(natsMsg_GetData(msg), natsMsg_GetDataLength(msg));
-        try {
-            nlohmann::json json_data = nlohmann::json::parse(data);
-            it->second(subject, json_data);
-        } catch (const std::exception& e) {
-            logger::log_error() << "Failed to parse JSON message: " << e.what() << "\n";
+    // Subject is "<inbox prefix>.<correlation id>".
+    uint64_t id = PendingRequests::IdFromSubject(message->Subject());
+    Metrics().received_inbox.Add();
+    const auto start = metrics::Histogram::Clock::now();
+    self->pending_.Deliver(id, std::move(message));
+    Metrics().reply_dispatch.RecordSince(start);
+}
+
+void NatsManager::OnAsyncError(natsConnection* nc, natsSubscription* sub, natsStatus error, void* closure) {
+    Connection* connection = static_cast<Connection*>(closure);
+    if (error != NATS_SLOW_CONSUMER) {
+        Metrics().async_errors.Add();
+        LOG_ERROR() << "NATS error: " << natsStatus_GetText(error) << "\n";
+        return;
+    }
+    if (sub != connection->inbox_sub) {
+        Metrics().slow_consumer_subscription.Add();
+        LOG_WARN() << "NATS slow consumer: messages to a subscription were dropped\n";
+        return;
+    }
+    // There's no telling which replies were dropped, and a request missing its reply would wait until its
+    // deadline (or forever) - fail all requests of this inbox so their clients can retry.
+    Metrics().slow_consumer_inbox.Add();
+    std::size_t failed =
+        connection->owner->pending_.FailInbox(connection->index, "NATS dropped replies (slow consumer)");
+    LOG_WARN() << "NATS slow consumer: replies were dropped, failed " << failed << " pending requests\n";
+}
+
+void NatsManager::OnDisconnected(natsConnection* nc, void* closure) {
+    Connection* connection = static_cast<Connection*>(closure);
+    Metrics().disconnects.Add();
+    // Replies in flight are lost with the connection; nats.c resubscribes the inbox once it reconnects.
+    std::size_t failed = connection->owner->pending_.FailInbox(connection->index, "Lost connection to NATS server");
+    LOG_WARN() << "Disconnected from NATS server, failed " << failed << " pending requests\n";
+}
+
+void NatsManager::OnClosed(natsConnection* nc, void* closure) {
+    Connection* connection = static_cast<Connection*>(closure);
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        connection->closed = true;
+    }
+    connection->closed_cv.notify_all();
+}
+
+bool NatsManager::GetStats(NatsStats& stats) const {
+    if (connections_.empty()) {
+        return false;
+    }
+    natsStatistics* nats_stats = nullptr;
+    natsStatus status = natsStatistics_Create(&nats_stats);
+    stats = NatsStats();
+    for (const auto& connection : connections_) {
+        NatsStats counts;
+        if (status == NATS_OK) {
+            status = natsConnection_GetStats(connection->conn, nats_stats);
         }
-    } else {
-        logger::log_error() << "No callback found for subscription.\n";
+        if (status == NATS_OK) {
+            status = natsStatistics_GetCounts(nats_stats, &counts.in_msgs, &counts.in_bytes, &counts.out_msgs,
+                                              &counts.out_bytes, &counts.reconnects);
+        }
+        stats.in_msgs += counts.in_msgs;
+        stats.in_bytes += counts.in_bytes;
+        stats.out_msgs += counts.out_msgs;
+        stats.out_bytes += counts.out_bytes;
+        stats.reconnects += counts.reconnects;
     }
+    natsStatistics_Destroy(nats_stats);
+    return status == NATS_OK;
 }
 
 void NatsManager::Disconnect() {
-    if (conn_) {
-        natsConnection_Destroy(conn_);
-        conn_ = nullptr;
-    }
-    // Unsubscribe all subscriptions
-    for (auto& pair : callbacks_) {
-        natsSubscription* sub = pair.first;
-        if (sub) {
-            natsSubscription_Unsubscribe(sub);  // stop receiving messages
-            natsSubscription_Destroy(sub);      // free the subscription object
+    // Queued messages are handed over first, while the connections are still alive.
+    for (auto& connection : connections_) {
+        connection->publisher.reset();
+    }
+    pending_.Stop("Disconnected from NATS server");
+
+    // Unsubscribe all subscriptions while the connections are still alive
+    std::unordered_map<std::string, std::vector<SubscriptionEntry>> subs;
+    {
+        std::lock_guard<std::mutex> lock(subs_mutex_);
+        subs.swap(subs_);
+    }
+    for (auto& pair : subs) {
+        for (auto& entry : pair.second) {
+            natsSubscription_Unsubscribe(entry.sub);  // stop receiving messages
+            natsSubscription_Destroy(entry.sub);      // free the subscription object
         }
     }
-}
\ No newline at end of file
+
+    for (auto& connection : connections_) {
+        Close(*connection);
+    }
+    connections_.clear();
+}
@@ -0,0 +1,253 @@
+#include "pending_requests.h"
+
+#include <charconv>
+#include <utility>
+#include <vector>
+
+#include "logger.h"
+#include "metrics.h"
+
+namespace {
+
+metrics::Counter& CompletedCounter(NatsReply::Status status) {
+    static metrics::Counter* counters[4] = {
+        &metrics::Global().GetCounter(
+            "nats_connector_nats_requests_total", "Completed NATS requests by outcome", "status=\"ok\""),
+        &metrics::Global().GetCounter(
+            "nats_connector_nats_requests_total", "Completed NATS requests by outcome", "status=\"timeout\""),
+        &metrics::Global().GetCounter(
+            "nats_connector_nats_requests_total", "Completed NATS requests by outcome", "status=\"cancelled\""),
+        &metrics::Global().GetCounter(
+            "nats_connector_nats_requests_total", "Completed NATS requests by outcome", "status=\"failed\"")};
+    return *counters[static_cast<int>(status)];
+}
+
+}  // namespace
+
+PendingRequests::~PendingRequests() { Stop("Transport closed"); }
+
+void PendingRequests::Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (reaper_.joinable()) {
+        return;
+    }
+    reaper_stop_ = false;
+    reaper_ = std::thread(&PendingRequests::RunDeadlineReaper, this);
+}
+
+void PendingRequests::Stop(const std::string& reason) {
+    std::thread reaper;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reaper_stop_ = true;
+        reaper.swap(reaper_);
+    }
+    cv_.notify_one();
+    if (reaper.joinable()) {
+        reaper.join();
+    }
+    CancelAll(reason);
+}
+
+uint64_t PendingRequests::Add(ReplyHandler on_reply,
+                              Clock::time_point deadline,
+                              const std::string& group,
+                              bool streamed,
+                              std::size_t inbox) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t id = next_id_++;
+    Entry entry{std::move(on_reply), deadline, group};
+    entry.streamed = streamed;
+    entry.inbox = inbox;
+    pending_.emplace(id, std::move(entry));
+    if (deadline != Clock::time_point::max()) {
+        bool earliest = deadlines_.empty() || deadline < deadlines_.begin()->first;
+        deadlines_.emplace(deadline, id);
+        if (earliest) {
+            cv_.notify_one();
+        }
+    }
+    return id;
+}
+
+void PendingRequests::Deliver(uint64_t id, std::shared_ptr<NatsMessage> message) {
+    // The reply keeps the message itself: the payload is neither copied nor parsed here.
+    NatsReply reply;
+    reply.status = NatsReply::Status::Ok;
+    reply.message = std::move(message);
+
+    ReplyHandler chunk_handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = pending_.find(id);
+        if (it == pending_.end()) {
+            LOG_DEBUG() << "Dropping reply for unknown or completed request " << id << "\n";
+            return;
+        }
+        Entry& entry = it->second;
+        std::string_view seq_header = reply.message->Header(Transport::kChunkSeqHeader);
+        if (entry.streamed && !seq_header.empty()) {
+            uint64_t seq = 0;
+            auto parsed = std::from_chars(seq_header.data(), seq_header.data() + seq_header.size(), seq);
+            if (parsed.ec != std::errc() || seq != entry.next_chunk) {
+                LOG_WARN() << "Request " << id << " expected chunk " << entry.next_chunk << ", got '" << seq_header
+                           << "'\n";
+                reply.status = NatsReply::Status::Failed;
+                reply.error = "Streamed response lost a chunk";
+                reply.message.reset();
+            } else if (reply.message->Header(Transport::kChunkLastHeader) != "true") {
+                ++entry.next_chunk;
+                reply.more = true;
+                chunk_handler = entry.handler;  // the entry stays pending until the last chunk
+            }
+        } else if (entry.streamed && entry.next_chunk != 0) {
+            reply.status = NatsReply::Status::Failed;
+            reply.error = "Streamed response lost a chunk";
+            reply.message.reset();
+        }
+    }
+
+    if (chunk_handler) {
+        chunk_handler(std::move(reply));
+    } else {
+        Complete(id, std::move(reply));
+    }
+}
+
+bool PendingRequests::Complete(uint64_t id, NatsReply&& reply) {
+    ReplyHandler handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = pending_.find(id);
+        if (it == pending_.end()) {
+            return false;
+        }
+        handler = std::move(it->second.handler);
+        EraseDeadlineLocked(id, it->second.deadline);
+        pending_.erase(it);
+    }
+    CompletedCounter(reply.status).Add();
+    handler(std::move(reply));
+    return true;
+}
+
+bool PendingRequests::Cancel(uint64_t id, const std::string& reason) {
+    NatsReply reply;
+    reply.status = NatsReply::Status::Cancelled;
+    reply.error = reason;
+    return Complete(id, std::move(reply));
+}
+
+std::size_t PendingRequests::CancelGroup(const std::string& group, const std::string& reason) {
+    return CompleteAll(
+        [&group](const Entry& entry) { return entry.group == group; }, NatsReply::Status::Cancelled, reason);
+}
+
+std::size_t PendingRequests::FailInbox(std::size_t inbox, const std::string& reason) {
+    return CompleteAll([inbox](const Entry& entry) { return entry.inbox == inbox; }, NatsReply::Status::Failed, reason);
+}
+
+template <typename Predicate>
+std::size_t PendingRequests::CompleteAll(Predicate matches, NatsReply::Status status, const std::string& reason) {
+    std::vector<ReplyHandler> completed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            if (!matches(it->second)) {
+                ++it;
+                continue;
+            }
+            completed.push_back(std::move(it->second.handler));
+            EraseDeadlineLocked(it->first, it->second.deadline);
+            it = pending_.erase(it);
+        }
+    }
+    for (auto& handler : completed) {
+        NatsReply reply;
+        reply.status = status;
+        reply.error = reason;
+        CompletedCounter(status).Add();
+        handler(std::move(reply));
+    }
+    return completed.size();
+}
+
+PendingRequests::ReplyHandler PendingRequests::SerializeChunks(ReplyHandler on_chunk) {
+    // Chunks are delivered from the reply subscription while the final call may come from the reaper or a
+    // cancellation; the sink serializes them and drops chunks that lose the race against the final call.
+    struct ChunkSink {
+        std::mutex mutex;
+        ReplyHandler handler;
+        bool done = false;
+    };
+    auto sink = std::make_shared<ChunkSink>();
+    sink->handler = std::move(on_chunk);
+    return [sink](NatsReply&& reply) {
+        std::lock_guard<std::mutex> lock(sink->mutex);
+        if (sink->done) {
+            return;
+        }
+        sink->done = !reply.more;
+        sink->handler(std::move(reply));
+    };
+}
+
+uint64_t PendingRequests::IdFromSubject(std::string_view subject) {
+    std::size_t dot = subject.rfind('.');
+    uint64_t id = 0;
+    if (dot != std::string_view::npos) {
+        std::from_chars(subject.data() + dot + 1, subject.data() + subject.size(), id);
+    }
+    return id;
+}
+
+void PendingRequests::EraseDeadlineLocked(uint64_t id, Clock::time_point deadline) {
+    if (deadline == Clock::time_point::max()) {
+        return;
+    }
+    auto range = deadlines_.equal_range(deadline);
+    for (auto d = range.first; d != range.second; ++d) {
+        if (d->second == id) {
+            deadlines_.erase(d);
+            return;
+        }
+    }
+}
+
+void PendingRequests::CancelAll(const std::string& reason) {
+    std::unordered_map<uint64_t, Entry> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled.swap(pending_);
+        deadlines_.clear();
+    }
+    for (auto& entry : cancelled) {
+        NatsReply reply;
+        reply.status = NatsReply::Status::Cancelled;
+        reply.error = reason;
+        entry.second.handler(std::move(reply));
+    }
+}
+
+void PendingRequests::RunDeadlineReaper() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!reaper_stop_) {
+        if (deadlines_.empty()) {
+            cv_.wait(lock);
+            continue;
+        }
+        // Copied: the entry may be erased while we wait.
+        const Clock::time_point deadline = deadlines_.begin()->first;
+        if (Clock::now() < deadline) {
+            cv_.wait_until(lock, deadline);
+            continue;
+        }
+        uint64_t id = deadlines_.begin()->second;
+        lock.unlock();
+        NatsReply reply;
+        reply.status = NatsReply::Status::Timeout;
+        reply.error = "Request timed out";
+        Complete(id, std::move(reply));
+        lock.lock();
+    }
+}
@@ -0,0 +1,308 @@
+#include "query_journal.h"
+
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <utility>
+
+#if defined(_WIN32)
+    #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#include "logger.h"
+#include "nlohmann/json.hpp"
+
+namespace {
+
+// Journal records are text lines: "+\t<query>\t<id>\n" and "-\t<id>\n".
+constexpr char kAddTag = '+';
+constexpr char kRemoveTag = '-';
+// Failed batches remembered for WaitCommitted(); sequence numbers of older ones all count as failed.
+constexpr std::size_t kMaxFailedBatches = 64;
+
+bool SyncFile(std::FILE* file) {
+    if (std::fflush(file) != 0) {
+        return false;
+    }
+#if defined(_WIN32)
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Makes a rename within `path`'s directory durable; without it a crash can bring the old directory entry back.
+bool SyncParentDirectory(const std::string& path) {
+#if defined(_WIN32)
+    (void)path;
+    return true;  // NTFS journals renames itself, and directories can't be opened for fsync here
+#else
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    if (dir.empty()) {
+        dir = ".";
+    }
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+#endif
+}
+
+}  // namespace
+
+QueryJournal::QueryJournal(QueryJournalOptions options) :
+    options_(std::move(options)), journal_path_(options_.snapshot_path + ".journal") {}
+
+QueryJournal::~QueryJournal() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    queued_cv_.notify_one();
+    if (writer_.joinable()) {
+        writer_.join();
+    }
+    if (journal_) {
+        std::fclose(journal_);
+    }
+}
+
+std::unordered_map<std::string, int> QueryJournal::Open() {
+    std::ifstream snapshot(options_.snapshot_path);
+    if (snapshot.is_open()) {
+        try {
+            nlohmann::json persisted;
+            snapshot >> persisted;
+            if (persisted.is_array()) {
+                for (const auto& entry : persisted) {
+                    if (entry.contains("id") && entry.contains("query")) {
+                        live_[entry["id"].get<std::string>()] = entry["query"].get<int>();
+                    }
+                }
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR() << "Failed to load query state snapshot " << options_.snapshot_path << ": " << e.what()
+                        << std::endl;
+        }
+    }
+
+    bool torn = false;
+    if (std::FILE* journal = std::fopen(journal_path_.c_str(), "rb")) {
+        torn = !Replay(journal);
+        std::fclose(journal);
+    }
+    LOG_INFO() << "Loaded " << live_.size() << " queries (" << journal_records_ << " journal records replayed)"
+               << std::endl;
+
+    // Fold what was replayed into a fresh snapshot, so the next start reads a single file again.
+    if (journal_records_ > 0 || torn) {
+        Compact();
+    }
+    if (!journal_) {
+        // Compaction failed: keep appending, after ending a torn record so it can't swallow the next one.
+        // Without a journal every batch tries compacting instead.
+        if (OpenJournal("ab") && torn && std::fputc('\n', journal_) == EOF) {
+            std::fclose(journal_);
+            journal_ = nullptr;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer_ = std::thread(&QueryJournal::Run, this);
+    return live_;
+}
+
+uint64_t QueryJournal::Add(const std::string& id, int query) { return Queue(Record{true, id, query}); }
+
+uint64_t QueryJournal::Remove(const std::string& id) { return Queue(Record{false, id, 0}); }
+
+uint64_t QueryJournal::Queue(Record&& record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_.push_back(std::move(record));
+    if (queued_.size() == 1) {
+        queued_cv_.notify_one();
+    }
+    return ++last_queued_;
+}
+
+bool QueryJournal::WaitCommitted(uint64_t seq) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!writer_.joinable()) {
+        return false;  // not opened, nothing will ever be committed
+    }
+    committed_cv_.wait(lock, [this, seq]() { return last_committed_ >= seq; });
+    if (seq <= forgotten_failures_) {
+        return false;
+    }
+    for (const auto& batch : failed_batches_) {
+        if (seq >= batch.first && seq <= batch.second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void QueryJournal::Run() {
+    std::vector<Record> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        queued_cv_.wait(lock, [this]() { return stop_ || !queued_.empty(); });
+        if (queued_.empty()) {
+            return;  // stopping, everything is committed
+        }
+        // Everything queued while the previous batch was being written goes out with one write + fsync.
+        batch.swap(queued_);
+        const uint64_t batch_end = last_queued_;
+        const uint64_t batch_begin = batch_end - batch.size() + 1;
+        lock.unlock();
+
+        bool written = WriteBatch(batch);
+        for (const Record& record : batch) {
+            if (record.add) {
+                live_[record.id] = record.query;
+            } else {
+                live_.erase(record.id);
+            }
+        }
+        journal_records_ += batch.size();
+        batch.clear();
+        if (!written) {
+            // A snapshot holds the batch just as well and starts a clean journal, dropping whatever part of the
+            // batch made it into this one. Until one succeeds every batch takes this way.
+            if (journal_) {
+                std::fclose(journal_);
+                journal_ = nullptr;
+            }
+            written = Compact();
+        } else if (journal_records_ >= options_.compact_after) {
+            Compact();
+        }
+
+        lock.lock();
+        last_committed_ = batch_end;
+        if (!written) {
+            failed_batches_.emplace_back(batch_begin, batch_end);
+            if (failed_batches_.size() > kMaxFailedBatches) {
+                forgotten_failures_ = failed_batches_.front().second;
+                failed_batches_.pop_front();
+            }
+        }
+        committed_cv_.notify_all();
+    }
+}
+
+bool QueryJournal::WriteBatch(const std::vector<Record>& batch) {
+    if (!journal_) {
+        return false;
+    }
+    std::string buffer;
+    for (const Record& record : batch) {
+        if (record.add) {
+            buffer += kAddTag;
+            buffer += '\t';
+            buffer += std::to_string(record.query);
+        } else {
+            buffer += kRemoveTag;
+        }
+        buffer += '\t';
+        buffer += record.id;
+        buffer += '\n';
+    }
+
+    bool written = std::fwrite(buffer.data(), 1, buffer.size(), journal_) == buffer.size();
+    written = written && (options_.sync ? SyncFile(journal_) : std::fflush(journal_) == 0);
+    if (!written) {
+        LOG_ERROR() << "Failed to write query state journal " << journal_path_ << std::endl;
+    }
+    return written;
+}
+
+bool QueryJournal::Compact() {
+    nlohmann::json persisted = nlohmann::json::array();
+    for (const auto& entry : live_) {
+        persisted.push_back({{"id", entry.first}, {"query", entry.second}});
+    }
+    const std::string data = persisted.dump();
+
+    // Write a complete new snapshot first; a crash before the rename leaves the old snapshot + journal intact.
+    const std::string temp_path = options_.snapshot_path + ".tmp";
+    std::FILE* temp = std::fopen(temp_path.c_str(), "wb");
+    bool written = temp && std::fwrite(data.data(), 1, data.size(), temp) == data.size();
+    written = written && (options_.sync ? SyncFile(temp) : std::fflush(temp) == 0);
+    if (temp) {
+        written = (std::fclose(temp) == 0) && written;
+    }
+    std::error_code error;
+    if (written) {
+        std::filesystem::rename(temp_path, options_.snapshot_path, error);
+        written = !error && (!options_.sync || SyncParentDirectory(options_.snapshot_path));
+    }
+    if (!written) {
+        LOG_ERROR() << "Failed to write query state snapshot " << options_.snapshot_path << std::endl;
+        return false;
+    }
+
+    // Replaying records already in the snapshot is harmless, so truncating the journal only now is safe.
+    if (journal_) {
+        std::fclose(journal_);
+        journal_ = nullptr;
+    }
+    if (OpenJournal("wb")) {
+        journal_records_ = 0;
+    }
+    return true;
+}
+
+bool QueryJournal::Replay(std::FILE* journal) {
+    std::string data;
+    char buffer[65536];
+    std::size_t read = 0;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), journal)) > 0) {
+        data.append(buffer, read);
+    }
+
+    std::string_view rest(data);
+    std::size_t skipped = 0;
+    for (std::size_t end = rest.find('\n'); end != std::string_view::npos; end = rest.find('\n')) {
+        // A record without its newline is the torn tail of a crashed write and never gets here.
+        std::string_view line = rest.substr(0, end);
+        rest.remove_prefix(end + 1);
+
+        if (line.size() > 2 && line[0] == kRemoveTag && line[1] == '\t') {
+            live_.erase(std::string(line.substr(2)));
+            ++journal_records_;
+            continue;
+        }
+        std::size_t tab = line.find('\t', 2);
+        int query = 0;
+        if (line.size() > 2 && line[0] == kAddTag && line[1] == '\t' && tab != std::string_view::npos &&
+            std::from_chars(line.data() + 2, line.data() + tab, query).ec == std::errc() && tab + 1 < line.size()) {
+            live_[std::string(line.substr(tab + 1))] = query;
+            ++journal_records_;
+            continue;
+        }
+        ++skipped;
+    }
+    if (skipped > 0 || !rest.empty()) {
+        LOG_WARN() << "Skipped " << skipped << " malformed and " << (rest.empty() ? 0 : 1)
+                   << " torn records of query state journal " << journal_path_ << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool QueryJournal::OpenJournal(const char* mode) {
+    journal_ = std::fopen(journal_path_.c_str(), mode);
+    if (!journal_) {
+        LOG_ERROR() << "Failed to open query state journal " << journal_path_ << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,216 @@
+#include "query_registry.h"
+
+#include <iterator>
+#include <mutex>
+
+#include "logger.h"
+#include "shared_query_store.h"
+
+namespace {
+
+constexpr std::chrono::seconds kMissCacheTtl(1);
+constexpr std::size_t kMaxCachedMisses = 4096;
+
+}  // namespace
+
+void QueryRegistry::Open(QueryJournal& journal) {
+    std::unordered_map<std::string, int> persisted = journal.Open();
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (const auto& entry : persisted) {
+        query_by_id_[entry.first] = entry.second;
+        id_by_query_[entry.second] = entry.first;
+        persisted_.insert(entry.first);
+        if (entry.second > last_query_) {
+            last_query_ = entry.second;
+        }
+    }
+    journal_ = &journal;
+}
+
+void QueryRegistry::Share(SharedQueryStore& store, int block) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    store_ = &store;
+    block_ = block > 0 ? block : 1;
+}
+
+void QueryRegistry::Close() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    journal_ = nullptr;
+    store_ = nullptr;
+}
+
+int QueryRegistry::Register(const std::string& id) {
+    SharedQueryStore* store = nullptr;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        store = store_;
+    }
+    if (store) {
+        return RegisterShared(*store, id);
+    }
+
+    int query = 0;
+    uint64_t record = 0;
+    QueryJournal* journal = nullptr;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        query = ++last_query_;
+        query_by_id_[id] = query;
+        id_by_query_[query] = id;
+        persisted_.insert(id);
+        journal = journal_;
+        if (journal) {
+            record = journal->Add(id, query);
+        }
+    }
+
+    // Wait for the disk outside of the lock, so concurrent registrations share one commit.
+    if (journal && !journal->WaitCommitted(record)) {
+        LOG_ERROR() << "Failed to persist query=" << query << " for ID=" << id << std::endl;
+        return 0;  // the caller forgets `id`, a number that wouldn't survive a restart isn't handed out
+    }
+    return query;
+}
+
+int QueryRegistry::RegisterShared(SharedQueryStore& store, const std::string& id) {
+    int query = 0;
+    {
+        std::lock_guard<std::mutex> lock(block_mutex_);
+        if (next_shared_ == shared_end_) {
+            int first = 0;
+            if (!store.Reserve(block_, first)) {
+                return 0;
+            }
+            next_shared_ = first;
+            shared_end_ = first + block_;
+        }
+        query = next_shared_++;
+    }
+
+    // Stored before it's handed out: another replica may be asked about it right away.
+    if (!store.Put(query, id)) {
+        return 0;
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    query_by_id_[id] = query;
+    id_by_query_[query] = id;
+    return query;
+}
+
+std::string QueryRegistry::FindId(int query) {
+    SharedQueryStore* store = nullptr;
+    uint64_t since = 0;
+    const Clock::time_point now = Clock::now();
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = id_by_query_.find(query);
+        if (it != id_by_query_.end()) {
+            return it->second;
+        }
+        auto miss = misses_.find(query);
+        if (miss != misses_.end() && now < miss->second) {
+            return "";
+        }
+        store = store_;
+        since = restart_checkpoint_;
+    }
+    if (!store || query <= 0) {
+        return "";
+    }
+
+    // Issued by another replica, or by this one before it restarted.
+    std::string id = store->Get(query, since);
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (id.empty()) {
+        CacheMissLocked(query, now);
+    } else if (since == restart_checkpoint_) {  // otherwise MathCore restarted during the lookup
+        query_by_id_[id] = query;
+        id_by_query_[query] = id;
+        misses_.erase(query);
+    }
+    return id;
+}
+
+int QueryRegistry::FindQuery(const std::string& id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = query_by_id_.find(id);
+    return it != query_by_id_.end() ? it->second : 0;
+}
+
+void QueryRegistry::Complete(const std::string& id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    CompleteLocked(id);
+}
+
+void QueryRegistry::Forget(const std::string& id) {
+    int query = 0;
+    SharedQueryStore* store = nullptr;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = query_by_id_.find(id);
+        if (it != query_by_id_.end()) {
+            query = it->second;
+            auto reverse = id_by_query_.find(it->second);
+            if (reverse != id_by_query_.end() && reverse->second == id) {
+                id_by_query_.erase(reverse);
+            }
+            query_by_id_.erase(it);
+        }
+        CompleteLocked(id);
+        store = store_;
+    }
+    if (store && query != 0) {
+        store->Remove(query);
+    }
+}
+
+void QueryRegistry::ResetActive() {
+    SharedQueryStore* store = nullptr;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        store = store_;
+    }
+    // Pairs stored before this point belong to jobs the restarted MathCore forgot.
+    const uint64_t checkpoint = store ? store->StartupCheckpoint() : 0;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    query_by_id_.clear();
+    id_by_query_.clear();
+    misses_.clear();
+    if (!store_) {
+        last_query_ = 0;
+    } else if (checkpoint != 0) {
+        restart_checkpoint_ = checkpoint;
+    }
+}
+
+std::size_t QueryRegistry::active_size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return query_by_id_.size();
+}
+
+std::size_t QueryRegistry::persisted_size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return persisted_.size();
+}
+
+void QueryRegistry::CacheMissLocked(int query, Clock::time_point now) {
+    // Bounded however many different numbers are asked for.
+    if (misses_.size() >= kMaxCachedMisses) {
+        for (auto it = misses_.begin(); it != misses_.end();) {
+            it = it->second <= now ? misses_.erase(it) : std::next(it);
+        }
+        if (misses_.size() >= kMaxCachedMisses) {
+            misses_.clear();
+        }
+    }
+    misses_[query] = now + kMissCacheTtl;
+}
+
+void QueryRegistry::CompleteLocked(const std::string& id) {
+    // Nobody waits for removals: one lost in a crash only leaves a stale pair behind.
+    if (persisted_.erase(id) > 0 && journal_) {
+        journal_->Remove(id);
+    }
+}
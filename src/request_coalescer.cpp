@@ -0,0 +1,55 @@
+#include "request_coalescer.h"
+
+#include <utility>
+
+bool RequestCoalescer::Join(const std::string& key, Waiter waiter) {
+    std::string cached_body;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto cached = cache_.find(key);
+        if (cached != cache_.end() && cached->second.expires <= Clock::now()) {
+            cache_.erase(cached);
+            cached = cache_.end();
+        }
+        if (cached == cache_.end()) {
+            auto inserted = flights_.try_emplace(key);
+            inserted.first->second.push_back(std::move(waiter));
+            if (!inserted.second) {
+                ++coalesced_;
+            }
+            return inserted.second;
+        }
+        ++coalesced_;
+        cached_body = cached->second.body;
+    }
+    waiter(cached_body);
+    return false;
+}
+
+void RequestCoalescer::Complete(const std::string& key, std::string_view body, std::chrono::milliseconds cache_for) {
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto flight = flights_.find(key);
+        if (flight != flights_.end()) {
+            waiters = std::move(flight->second);
+            flights_.erase(flight);
+        }
+        if (cache_for.count() > 0) {
+            cache_[key] = Cached{std::string(body), Clock::now() + cache_for};
+        }
+    }
+    for (auto& waiter : waiters) {
+        waiter(body);
+    }
+}
+
+std::size_t RequestCoalescer::in_flight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return flights_.size();
+}
+
+std::size_t RequestCoalescer::coalesced() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return coalesced_;
+}
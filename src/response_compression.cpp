@@ -0,0 +1,109 @@
+#include "response_compression.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+namespace {
+
+Poco::DeflatingStreamBuf::StreamType StreamType(ContentEncoding encoding) {
+    // HTTP "deflate" is the zlib format (RFC 9110), not a raw deflate stream.
+    return encoding == ContentEncoding::Gzip ? Poco::DeflatingStreamBuf::STREAM_GZIP
+                                             : Poco::DeflatingStreamBuf::STREAM_ZLIB;
+}
+
+std::string Trim(const std::string& value) {
+    std::size_t begin = value.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    std::size_t end = value.find_last_not_of(" \t");
+    return value.substr(begin, end - begin + 1);
+}
+
+}  // namespace
+
+ContentEncoding NegotiateEncoding(const std::string& accept_encoding) {
+    double gzip_q = 0.0;
+    double deflate_q = 0.0;
+    double any_q = -1.0;  // "*", if listed
+    bool gzip_listed = false;
+    bool deflate_listed = false;
+
+    std::size_t pos = 0;
+    while (pos <= accept_encoding.size()) {
+        std::size_t comma = accept_encoding.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = accept_encoding.size();
+        }
+        std::string item = accept_encoding.substr(pos, comma - pos);
+        pos = comma + 1;
+
+        double q = 1.0;
+        std::size_t semicolon = item.find(';');
+        if (semicolon != std::string::npos) {
+            std::string params = Trim(item.substr(semicolon + 1));
+            if (params.size() > 2 && (params[0] == 'q' || params[0] == 'Q') && params[1] == '=') {
+                q = std::strtod(params.c_str() + 2, nullptr);
+            }
+            item = item.substr(0, semicolon);
+        }
+        std::string coding = Trim(item);
+        std::transform(coding.begin(), coding.end(), coding.begin(), [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+
+        if (coding == "gzip" || coding == "x-gzip") {
+            gzip_q = q;
+            gzip_listed = true;
+        } else if (coding == "deflate") {
+            deflate_q = q;
+            deflate_listed = true;
+        } else if (coding == "*") {
+            any_q = q;
+        }
+    }
+
+    if (!gzip_listed && any_q >= 0.0) gzip_q = any_q;
+    if (!deflate_listed && any_q >= 0.0) deflate_q = any_q;
+    if (gzip_q <= 0.0 && deflate_q <= 0.0) {
+        return ContentEncoding::Identity;
+    }
+    return gzip_q >= deflate_q ? ContentEncoding::Gzip : ContentEncoding::Deflate;
+}
+
+const char* ToString(ContentEncoding encoding) {
+    switch (encoding) {
+        case ContentEncoding::Gzip: return "gzip";
+        case ContentEncoding::Deflate: return "deflate";
+        default: return "";
+    }
+}
+
+std::string Compress(std::string_view body, ContentEncoding encoding, int level) {
+    std::ostringstream sink;
+    Poco::DeflatingOutputStream deflater(sink, StreamType(encoding), level);
+    deflater.write(body.data(), static_cast<std::streamsize>(body.size()));
+    deflater.close();
+    return sink.str();
+}
+
+StreamCompressor::StreamCompressor(ContentEncoding encoding, int level) :
+    stream_(sink_, StreamType(encoding), level) {}
+
+std::string StreamCompressor::Compress(std::string_view piece) {
+    stream_.write(piece.data(), static_cast<std::streamsize>(piece.size()));
+    stream_.flush();  // Z_SYNC_FLUSH: everything written so far becomes decodable
+    return TakeOutput();
+}
+
+std::string StreamCompressor::Finish() {
+    stream_.close();
+    return TakeOutput();
+}
+
+std::string StreamCompressor::TakeOutput() {
+    std::string output = sink_.str();
+    sink_.str(std::string());
+    return output;
+}
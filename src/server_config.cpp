@@ -0,0 +1,125 @@
+#include "server_config.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "id_generator.h"
+
+namespace {
+
+const char* const kAdmissionEndpoints[] = {"state", "getlog", "logslist"};
+
+// nats.encoding.<key> settings and the subjects they apply to.
+const std::pair<const char*, const char*> kEncodingSubjects[] = {
+    {"start", "Start."},
+    {"state", "State.Request."},
+    {"getlog", "GetLog.Request."},
+    {"logslist", "LogsList.Request"},
+};
+
+void ReadEncoding(const Poco::Util::AbstractConfiguration& config,
+                  const std::string& key,
+                  const std::string& subject_prefix,
+                  std::map<std::string, WireEncoding>& encodings) {
+    if (!config.has(key)) {
+        return;
+    }
+    const std::string name = config.getString(key, "");
+    WireEncoding encoding;
+    if (ParseWireEncoding(name, encoding)) {
+        encodings[subject_prefix] = encoding;
+    } else {
+        LOG_WARN() << "Ignoring unknown encoding in " << key << ": " << name << std::endl;
+    }
+}
+
+}  // namespace
+
+ServerConfig ServerConfig::Load(const Poco::Util::AbstractConfiguration& config) {
+    ServerConfig result;
+
+    result.nats_url = config.getString("nats.url", result.nats_url);
+    ReadEncoding(config, "nats.encoding", "", result.subject_encodings);
+    for (const auto& entry : kEncodingSubjects) {
+        ReadEncoding(config, std::string("nats.encoding.") + entry.first, entry.second, result.subject_encodings);
+    }
+
+    NatsOptions& nats = result.nats;
+    nats.connections =
+        static_cast<std::size_t>(std::max(1, config.getInt("nats.connections", static_cast<int>(nats.connections))));
+    nats.delivery_threads = config.getInt("nats.delivery_threads", nats.delivery_threads);
+    nats.pending_msgs = config.getInt("nats.pending_msgs", nats.pending_msgs);
+    nats.pending_bytes = config.getInt("nats.pending_bytes", nats.pending_bytes);
+    nats.io_buffer_size = config.getInt("nats.io_buffer_size", nats.io_buffer_size);
+    nats.send_asap = config.getBool("nats.send_asap", nats.send_asap);
+
+    AsyncPublishOptions& publish = nats.async_publish;
+    publish.enabled = config.getBool("nats.publish.async", publish.enabled);
+    publish.max_queued =
+        static_cast<std::size_t>(config.getInt("nats.publish.max_queued", static_cast<int>(publish.max_queued)));
+    publish.max_queued_bytes = static_cast<std::size_t>(
+        config.getInt("nats.publish.max_queued_bytes", static_cast<int>(publish.max_queued_bytes)));
+    publish.queue_timeout = std::chrono::milliseconds(
+        config.getInt("nats.publish.queue_timeout_ms", static_cast<int>(publish.queue_timeout.count())));
+
+    result.http_port = config.getInt("http.port", result.http_port);
+    result.http_backlog = config.getInt("http.backlog", result.http_backlog);
+    result.http_max_threads = config.getInt("http.max_threads", result.http_max_threads);
+    result.http_max_queued = config.getInt("http.max_queued", result.http_max_queued);
+    result.http_timeout =
+        std::chrono::milliseconds(config.getInt("http.timeout_ms", static_cast<int>(result.http_timeout.count())));
+    result.http_keep_alive = config.getBool("http.keep_alive", result.http_keep_alive);
+
+    CompressionSettings& compression = result.http_compression;
+    compression.enabled = config.getBool("http.compression.enabled", compression.enabled);
+    compression.min_size = static_cast<std::size_t>(
+        config.getInt("http.compression.min_size", static_cast<int>(compression.min_size)));
+    compression.level = std::clamp(config.getInt("http.compression.level", compression.level), 1, 9);
+
+    result.completion_threads = static_cast<std::size_t>(
+        config.getInt("completion.threads", static_cast<int>(result.completion_threads)));
+    result.mathcore_request_timeout = std::chrono::milliseconds(
+        config.getInt("mathcore.request_timeout_ms", static_cast<int>(result.mathcore_request_timeout.count())));
+    result.mathcore_routing = config.getBool("mathcore.routing", result.mathcore_routing);
+    result.logslist_cache_ttl = std::chrono::milliseconds(
+        config.getInt("logslist.cache_ttl_ms", static_cast<int>(result.logslist_cache_ttl.count())));
+
+    result.start_validate_json = config.getBool("start.validate_json", result.start_validate_json);
+    result.start_flush_timeout = std::chrono::milliseconds(
+        config.getInt("start.flush_timeout_ms", static_cast<int>(result.start_flush_timeout.count())));
+    const int node_id = config.getInt("start.node_id", static_cast<int>(result.node_id));
+    result.node_id = static_cast<unsigned>(std::clamp(node_id, 0, static_cast<int>(IdGenerator::kMaxNode)));
+
+    QueryJournalOptions& query_state = result.query_state;
+    query_state.snapshot_path = config.getString("state.path", query_state.snapshot_path);
+    query_state.compact_after = static_cast<std::size_t>(
+        config.getInt("state.compact_after", static_cast<int>(query_state.compact_after)));
+    query_state.sync = config.getBool("state.sync", query_state.sync);
+
+    SharedQueryOptions& replica = result.replica;
+    replica.enabled = config.getBool("replica.enabled", replica.enabled);
+    replica.bucket = config.getString("replica.bucket", replica.bucket);
+    replica.query_block = std::max(1, config.getInt("replica.query_block", replica.query_block));
+    replica.ttl = std::chrono::seconds(config.getInt("replica.ttl_s", static_cast<int>(replica.ttl.count())));
+
+    logger::Level level;
+    if (logger::ParseLevel(config.getString("log.level", logger::ToString(result.log_level)), level)) {
+        result.log_level = level;
+    }
+
+    AdmissionLimits& admission = result.admission;
+    admission.max_in_flight = config.getInt("admission.max_in_flight", admission.max_in_flight);
+    for (const char* endpoint : kAdmissionEndpoints) {
+        int limit = config.getInt(std::string("admission.max_in_flight.") + endpoint, 0);
+        if (limit > 0) {
+            admission.max_in_flight_per_endpoint[endpoint] = limit;
+        }
+    }
+    admission.max_queued = config.getInt("admission.max_queued", admission.max_queued);
+    admission.queue_timeout = std::chrono::milliseconds(
+        config.getInt("admission.queue_timeout_ms", static_cast<int>(admission.queue_timeout.count())));
+    admission.retry_after =
+        std::chrono::seconds(config.getInt("admission.retry_after_s", static_cast<int>(admission.retry_after.count())));
+
+    return result;
+}
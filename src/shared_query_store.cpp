@@ -0,0 +1,171 @@
+#include "shared_query_store.h"
+
+#include <cstdlib>
+
+#include "logger.h"
+
+namespace {
+
+const char kNextQueryKey[] = "next_query";
+const char kCounterBucketSuffix[] = "_counter";
+const char kStartupKey[] = "mathcore_startup";
+// Compare-and-set rounds lost to other replicas before Reserve() or StartupCheckpoint() give up.
+constexpr int kMaxCompareAndSetAttempts = 16;
+// A startup marker younger than this was written for the startup at hand: every replica gets its copy of the
+// heartbeat within milliseconds, and MathCore takes longer than this to go down and come back.
+constexpr std::chrono::seconds kSameStartupWindow(10);
+
+std::string QueryKey(int query) { return "query." + std::to_string(query); }
+
+std::string ValueOf(kvEntry* entry) {
+    const char* value = static_cast<const char*>(kvEntry_Value(entry));
+    return std::string(value, static_cast<std::size_t>(kvEntry_ValueLen(entry)));
+}
+
+}  // namespace
+
+bool JetStreamQueryStore::Open(natsConnection* conn, const SharedQueryOptions& options) {
+    Close();
+    if (!conn) {
+        LOG_ERROR() << "Not connected to NATS server.\n";
+        return false;
+    }
+    natsStatus status = natsConnection_JetStream(&js_, conn, nullptr);
+    if (status != NATS_OK) {
+        LOG_ERROR() << "Failed to get a JetStream context: " << natsStatus_GetText(status) << std::endl;
+        Close();
+        return false;
+    }
+    if (!OpenBucket(&kv_, options.bucket, options.ttl) ||
+        !OpenBucket(&counter_, options.bucket + kCounterBucketSuffix, std::chrono::seconds(0))) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool JetStreamQueryStore::OpenBucket(kvStore** kv, const std::string& bucket, std::chrono::seconds ttl) {
+    natsStatus status = js_KeyValue(kv, js_, bucket.c_str());
+    if (status == NATS_NOT_FOUND) {
+        kvConfig config;
+        kvConfig_Init(&config);
+        config.Bucket = bucket.c_str();
+        config.History = 1;
+        config.TTL = std::chrono::duration_cast<std::chrono::nanoseconds>(ttl).count();
+        config.StorageType = js_FileStorage;
+        status = js_CreateKeyValue(kv, js_, &config);
+    }
+    if (status != NATS_OK) {
+        LOG_ERROR() << "Failed to open Key-Value bucket " << bucket << ": " << natsStatus_GetText(status)
+                    << std::endl;
+        *kv = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void JetStreamQueryStore::Close() {
+    if (kv_) {
+        kvStore_Destroy(kv_);
+        kv_ = nullptr;
+    }
+    if (counter_) {
+        kvStore_Destroy(counter_);
+        counter_ = nullptr;
+    }
+    if (js_) {
+        jsCtx_Destroy(js_);
+        js_ = nullptr;
+    }
+}
+
+bool JetStreamQueryStore::Reserve(int count, int& first) {
+    for (int attempt = 0; attempt < kMaxCompareAndSetAttempts; ++attempt) {
+        int next = 1;
+        uint64_t revision = 0;
+        kvEntry* entry = nullptr;
+        natsStatus status = kvStore_Get(&entry, counter_, kNextQueryKey);
+        if (status == NATS_OK) {
+            next = std::atoi(ValueOf(entry).c_str());
+            revision = kvEntry_Revision(entry);
+            kvEntry_Destroy(entry);
+        } else if (status != NATS_NOT_FOUND) {
+            LOG_ERROR() << "Failed to read the next query number: " << natsStatus_GetText(status) << std::endl;
+            return false;
+        }
+
+        const std::string reserved_up_to = std::to_string(next + count);
+        uint64_t new_revision = 0;
+        const char* value = reserved_up_to.c_str();
+        status = revision == 0 ? kvStore_CreateString(&new_revision, counter_, kNextQueryKey, value)
+                               : kvStore_UpdateString(&new_revision, counter_, kNextQueryKey, value, revision);
+        if (status == NATS_OK) {
+            first = next;
+            return true;
+        }
+        // Another replica reserved a block in between; read the counter again.
+    }
+    LOG_ERROR() << "Failed to reserve query numbers: too much contention" << std::endl;
+    return false;
+}
+
+bool JetStreamQueryStore::Put(int query, const std::string& id) {
+    uint64_t revision = 0;
+    natsStatus status = kvStore_PutString(&revision, kv_, QueryKey(query).c_str(), id.c_str());
+    if (status != NATS_OK) {
+        LOG_ERROR() << "Failed to store query=" << query << ": " << natsStatus_GetText(status) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::string JetStreamQueryStore::Get(int query, uint64_t since) {
+    kvEntry* entry = nullptr;
+    natsStatus status = kvStore_Get(&entry, kv_, QueryKey(query).c_str());
+    if (status != NATS_OK) {
+        if (status != NATS_NOT_FOUND) {
+            LOG_WARN() << "Failed to look up query=" << query << ": " << natsStatus_GetText(status) << std::endl;
+        }
+        return "";
+    }
+    std::string id = kvEntry_Revision(entry) > since ? ValueOf(entry) : std::string();
+    kvEntry_Destroy(entry);
+    return id;
+}
+
+uint64_t JetStreamQueryStore::StartupCheckpoint() {
+    // Revisions are the sequence numbers of the bucket's stream, so the marker's one orders it among the pairs.
+    for (int attempt = 0; attempt < kMaxCompareAndSetAttempts; ++attempt) {
+        uint64_t revision = 0;
+        kvEntry* entry = nullptr;
+        natsStatus status = kvStore_Get(&entry, kv_, kStartupKey);
+        if (status == NATS_OK) {
+            revision = kvEntry_Revision(entry);
+            const std::chrono::nanoseconds created(kvEntry_Created(entry));
+            kvEntry_Destroy(entry);
+            if (std::chrono::system_clock::now().time_since_epoch() - created < kSameStartupWindow) {
+                return revision;  // marked by a replica that got the heartbeat first
+            }
+        } else if (status != NATS_NOT_FOUND) {
+            LOG_WARN() << "Failed to read the MathCore startup marker: " << natsStatus_GetText(status) << std::endl;
+            return 0;
+        }
+
+        uint64_t marked = 0;
+        status = revision == 0 ? kvStore_CreateString(&marked, kv_, kStartupKey, "")
+                               : kvStore_UpdateString(&marked, kv_, kStartupKey, "", revision);
+        if (status == NATS_OK) {
+            return marked;
+        }
+        // Another replica marked the startup in between; read its marker.
+    }
+    LOG_WARN() << "Failed to mark the MathCore startup: too much contention" << std::endl;
+    return 0;
+}
+
+void JetStreamQueryStore::Remove(int query) {
+    natsStatus status = kvStore_Delete(kv_, QueryKey(query).c_str());
+    if (status != NATS_OK) {
+        LOG_WARN() << "Failed to remove query=" << query << ": " << natsStatus_GetText(status) << std::endl;
+    }
+}
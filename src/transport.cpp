@@ -0,0 +1,179 @@
+#include "transport.h"
+
+#include <algorithm>
+#include <cctype>
+
+#include "logger.h"
+#include "metrics.h"
+
+const char* ToString(WireEncoding encoding) {
+    switch (encoding) {
+        case WireEncoding::Json: return "json";
+        case WireEncoding::MsgPack: return "msgpack";
+        case WireEncoding::Cbor: return "cbor";
+        default: return "undefined";
+    }
+}
+
+bool ParseWireEncoding(const std::string& name, WireEncoding& encoding) {
+    std::string lowered(name);
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    if (lowered == "json") {
+        encoding = WireEncoding::Json;
+    } else if (lowered == "msgpack") {
+        encoding = WireEncoding::MsgPack;
+    } else if (lowered == "cbor") {
+        encoding = WireEncoding::Cbor;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* ContentType(WireEncoding encoding) {
+    switch (encoding) {
+        case WireEncoding::MsgPack: return "application/msgpack";
+        case WireEncoding::Cbor: return "application/cbor";
+        default: return "application/json";
+    }
+}
+
+std::string EncodePayload(const nlohmann::json& message, WireEncoding encoding) {
+    static metrics::Histogram& encode = metrics::Global().GetHistogram(
+        "nats_connector_nats_encode_seconds", "Serialization of outgoing NATS payloads");
+    const auto start = metrics::Histogram::Clock::now();
+    std::string payload;
+    switch (encoding) {
+        case WireEncoding::MsgPack: nlohmann::json::to_msgpack(message, payload); break;
+        case WireEncoding::Cbor: nlohmann::json::to_cbor(message, payload); break;
+        default: payload = message.dump(); break;
+    }
+    encode.RecordSince(start);
+    return payload;
+}
+
+NatsMessage::~NatsMessage() {
+    if (msg_) natsMsg_Destroy(msg_);
+}
+
+NatsMessage::NatsMessage(NatsMessage&& other) noexcept : msg_(other.msg_), json_(std::move(other.json_)) {
+    other.msg_ = nullptr;
+}
+
+NatsMessage& NatsMessage::operator=(NatsMessage&& other) noexcept {
+    if (this != &other) {
+        if (msg_) natsMsg_Destroy(msg_);
+        msg_ = other.msg_;
+        json_ = std::move(other.json_);
+        other.msg_ = nullptr;
+    }
+    return *this;
+}
+
+std::string_view NatsMessage::Subject() const {
+    if (!msg_) return {};
+    return natsMsg_GetSubject(msg_);
+}
+
+std::string_view NatsMessage::Data() const {
+    if (!msg_) return {};
+    const char* data = natsMsg_GetData(msg_);
+    return data ? std::string_view(data, static_cast<std::size_t>(natsMsg_GetDataLength(msg_))) : std::string_view();
+}
+
+std::string_view NatsMessage::Reply() const {
+    const char* reply = msg_ ? natsMsg_GetReply(msg_) : nullptr;
+    return reply ? std::string_view(reply) : std::string_view();
+}
+
+std::string_view NatsMessage::Header(const char* name) const {
+    const char* value = nullptr;
+    if (!msg_ || natsMsgHeader_Get(msg_, name, &value) != NATS_OK || !value) return {};
+    return value;
+}
+
+WireEncoding NatsMessage::Encoding() const {
+    std::string_view content_type = Header(Transport::kContentTypeHeader);
+    if (content_type == ContentType(WireEncoding::MsgPack)) return WireEncoding::MsgPack;
+    if (content_type == ContentType(WireEncoding::Cbor)) return WireEncoding::Cbor;
+    return WireEncoding::Json;
+}
+
+const nlohmann::json& NatsMessage::Json() const {
+    if (!json_) {
+        std::string_view data = Data();
+        switch (Encoding()) {
+            case WireEncoding::MsgPack:
+                json_ = std::make_unique<nlohmann::json>(nlohmann::json::from_msgpack(data.begin(), data.end()));
+                break;
+            case WireEncoding::Cbor:
+                json_ = std::make_unique<nlohmann::json>(nlohmann::json::from_cbor(data.begin(), data.end()));
+                break;
+            default: json_ = std::make_unique<nlohmann::json>(nlohmann::json::parse(data.begin(), data.end())); break;
+        }
+    }
+    return *json_;
+}
+
+natsMsg* NatsMessage::Release() {
+    natsMsg* msg = msg_;
+    msg_ = nullptr;
+    return msg;
+}
+
+bool Transport::Subscribe(const std::string& subject,
+                          std::function<void(const std::string&, const nlohmann::json&)> handler) {
+    return SubscribeRaw(subject, [handler = std::move(handler)](NatsMessage& message) {
+        try {
+            const nlohmann::json& json_data = message.Json();
+            handler(std::string(message.Subject()), json_data);
+        } catch (const std::exception& e) {
+            LOG_ERROR() << "Failed to parse JSON message: " << e.what() << "\n";
+        }
+    });
+}
+
+void Transport::SetSubjectEncoding(const std::string& subject_prefix, WireEncoding encoding) {
+    for (auto& entry : subject_encodings_) {
+        if (entry.first == subject_prefix) {
+            entry.second = encoding;
+            return;
+        }
+    }
+    subject_encodings_.emplace_back(subject_prefix, encoding);
+}
+
+WireEncoding Transport::EncodingFor(const std::string& subject) const {
+    WireEncoding encoding = WireEncoding::Json;
+    std::size_t matched = 0;
+    for (const auto& entry : subject_encodings_) {
+        const std::string& prefix = entry.first;
+        if (prefix.size() >= matched && subject.compare(0, prefix.size(), prefix) == 0) {
+            encoding = entry.second;
+            matched = prefix.size();
+        }
+    }
+    return encoding;
+}
+
+Transport::Headers Transport::HeadersFor(WireEncoding encoding) {
+    if (encoding == WireEncoding::Json) {
+        return {};
+    }
+    return {{kContentTypeHeader, ContentType(encoding)}};
+}
+
+PendingRequest Transport::Request(const std::string& subject,
+                                  const nlohmann::json& message,
+                                  Clock::time_point deadline,
+                                  const std::string& group) {
+    auto promise = std::make_shared<std::promise<NatsReply>>();
+    PendingRequest request;
+    request.reply = promise->get_future();
+    request.id = AsyncRequest(subject, message, deadline, group, [promise](NatsReply&& reply) {
+        promise->set_value(std::move(reply));
+    });
+    return request;
+}
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+
+#include "admission_controller.h"
+
+using Ticket = std::shared_ptr<AdmissionController::Ticket>;
+
+namespace {
+
+AdmissionLimits Limits(int max_in_flight, int max_queued, std::chrono::milliseconds queue_timeout) {
+    AdmissionLimits limits;
+    limits.max_in_flight = max_in_flight;
+    limits.max_queued = max_queued;
+    limits.queue_timeout = queue_timeout;
+    return limits;
+}
+
+}  // namespace
+
+TEST(AdmissionControllerTest, AdmitNeverWaits) {
+    AdmissionController admission(Limits(1, 10, std::chrono::hours(1)));
+    Ticket first = admission.Admit("state");
+    ASSERT_TRUE(first);
+    EXPECT_FALSE(admission.Admit("state"));
+    EXPECT_EQ(admission.in_flight(), 1);
+
+    first.reset();
+    EXPECT_TRUE(admission.Admit("state"));
+}
+
+TEST(AdmissionControllerTest, ParkedRequestGetsReleasedSlot) {
+    AdmissionController admission(Limits(1, 10, std::chrono::hours(1)));
+    Ticket first = admission.Admit("state");
+    Ticket parked;
+    bool called = false;
+    ASSERT_TRUE(admission.Park("state", [&](Ticket ticket) {
+        called = true;
+        parked = std::move(ticket);
+    }));
+    EXPECT_FALSE(called);
+    EXPECT_EQ(admission.queued(), 1);
+
+    first.reset();  // the releasing thread hands the slot over
+    EXPECT_TRUE(called);
+    EXPECT_TRUE(parked);
+    EXPECT_EQ(admission.queued(), 0);
+    EXPECT_EQ(admission.in_flight(), 1);
+}
+
+TEST(AdmissionControllerTest, ParkedRequestIsRejectedAfterTimeout) {
+    AdmissionController admission(Limits(1, 10, std::chrono::milliseconds(20)));
+    Ticket first = admission.Admit("state");
+    std::promise<bool> admitted;
+    ASSERT_TRUE(admission.Park("state", [&](Ticket ticket) { admitted.set_value(ticket != nullptr); }));
+
+    auto result = admitted.get_future();
+    ASSERT_EQ(result.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_FALSE(result.get());
+    EXPECT_EQ(admission.queued(), 0);
+}
+
+TEST(AdmissionControllerTest, FullQueueRejectsRightAway) {
+    AdmissionController admission(Limits(1, 1, std::chrono::hours(1)));
+    Ticket first = admission.Admit("state");
+    int rejected = 0;
+    EXPECT_TRUE(admission.Park("state", [&](Ticket ticket) { rejected += ticket ? 0 : 1; }));
+    EXPECT_FALSE(admission.Park("state", [](Ticket) { FAIL() << "a refused request must not be called back"; }));
+    EXPECT_EQ(rejected, 0);
+}
+
+TEST(AdmissionControllerTest, ReleaseServesWaiterThatFits) {
+    AdmissionLimits limits = Limits(0, 10, std::chrono::hours(1));
+    limits.max_in_flight_per_endpoint["getlog"] = 1;
+    limits.max_in_flight_per_endpoint["state"] = 1;
+    AdmissionController admission(limits);
+    Ticket getlog = admission.Admit("getlog");
+    Ticket state = admission.Admit("state");
+
+    Ticket parked_getlog;
+    Ticket parked_state;
+    ASSERT_TRUE(admission.Park("getlog", [&](Ticket ticket) { parked_getlog = std::move(ticket); }));
+    ASSERT_TRUE(admission.Park("state", [&](Ticket ticket) { parked_state = std::move(ticket); }));
+
+    state.reset();
+    EXPECT_FALSE(parked_getlog);
+    EXPECT_TRUE(parked_state);
+    EXPECT_EQ(admission.queued(), 1);
+}
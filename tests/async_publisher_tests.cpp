@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_publisher.h"
+#include "metrics.h"
+#include "pending_requests.h"
+
+namespace {
+
+AsyncPublisher::Message MakeMessage(const std::string& subject, const std::string& payload = "{}") {
+    return AsyncPublisher::Message{subject, "", payload, {}};
+}
+
+}  // namespace
+
+TEST(AsyncPublisherTest, PublishesInOrder) {
+    std::mutex mutex;
+    std::vector<std::string> published;
+    {
+        AsyncPublisher publisher(
+            AsyncPublishOptions{},
+            [&](const AsyncPublisher::Message& message) {
+                std::lock_guard<std::mutex> lock(mutex);
+                published.push_back(message.subject);
+                return true;
+            },
+            [](std::chrono::milliseconds) { return true; });
+        for (int i = 0; i < 100; ++i) {
+            ASSERT_TRUE(publisher.Enqueue(MakeMessage("Start." + std::to_string(i))));
+        }
+    }  // the destructor publishes what's still queued
+
+    ASSERT_EQ(published.size(), 100u);
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(published[i], "Start." + std::to_string(i));
+    }
+}
+
+TEST(AsyncPublisherTest, FlushWaitsForQueuedMessages) {
+    std::atomic<int> published{0};
+    std::atomic<int> flushes{0};
+    AsyncPublisher publisher(
+        AsyncPublishOptions{},
+        [&](const AsyncPublisher::Message&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            ++published;
+            return true;
+        },
+        [&](std::chrono::milliseconds) {
+            ++flushes;
+            return true;
+        });
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(publisher.Enqueue(MakeMessage("Start.x")));
+    }
+
+    EXPECT_TRUE(publisher.Flush(std::chrono::seconds(5)));
+    EXPECT_EQ(published.load(), 10);
+    EXPECT_GE(flushes.load(), 1);
+}
+
+TEST(AsyncPublisherTest, FlushReportsRefusedMessages) {
+    AsyncPublisher publisher(
+        AsyncPublishOptions{},
+        [](const AsyncPublisher::Message& message) { return message.subject != "Start.bad"; },
+        [](std::chrono::milliseconds) { return true; });
+
+    ASSERT_TRUE(publisher.Enqueue(MakeMessage("Start.bad")));
+    EXPECT_FALSE(publisher.Flush(std::chrono::seconds(5)));
+    ASSERT_TRUE(publisher.Enqueue(MakeMessage("Start.good")));
+    EXPECT_TRUE(publisher.Flush(std::chrono::seconds(5)));
+}
+
+TEST(AsyncPublisherTest, RefusedRequestFailsItsReplyHandler) {
+    PendingRequests pending;
+    std::promise<NatsReply> reply;
+    uint64_t id = pending.Add([&](NatsReply&& result) { reply.set_value(std::move(result)); },
+                              PendingRequests::Clock::time_point::max(),
+                              "mathcore",
+                              false);
+    {
+        AsyncPublisher publisher(
+            AsyncPublishOptions{},
+            [](const AsyncPublisher::Message&) { return false; },
+            [](std::chrono::milliseconds) { return true; });
+        AsyncPublisher::Message message = MakeMessage("State.x");
+        message.reply = "_INBOX.test." + std::to_string(id);
+        message.on_failure = [&pending, id]() {
+            NatsReply failure;
+            failure.status = NatsReply::Status::Failed;
+            failure.error = "Failed to publish message to NATS";
+            pending.Complete(id, std::move(failure));
+        };
+        ASSERT_TRUE(publisher.Enqueue(std::move(message)));  // accepted; the connection refuses it later
+    }
+
+    auto result = reply.get_future();
+    ASSERT_EQ(result.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_EQ(result.get().status, NatsReply::Status::Failed);
+}
+
+TEST(AsyncPublisherTest, FullQueueRejectsAfterTimeout) {
+    std::mutex gate;
+    std::unique_lock<std::mutex> hold(gate);  // blocks the publisher thread inside the first publish
+    AsyncPublishOptions options;
+    options.max_queued = 2;
+    options.queue_timeout = std::chrono::milliseconds(20);
+    AsyncPublisher publisher(
+        options,
+        [&](const AsyncPublisher::Message&) {
+            std::lock_guard<std::mutex> lock(gate);
+            return true;
+        },
+        [](std::chrono::milliseconds) { return true; });
+
+    ASSERT_TRUE(publisher.Enqueue(MakeMessage("Start.1")));
+    // wait until the publisher thread took the first message and is stuck publishing it
+    while (publisher.queued() != 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_TRUE(publisher.Enqueue(MakeMessage("Start.2")));
+    ASSERT_TRUE(publisher.Enqueue(MakeMessage("Start.3")));
+    EXPECT_FALSE(publisher.Enqueue(MakeMessage("Start.4")));
+    EXPECT_EQ(publisher.queued(), 2u);
+
+    hold.unlock();
+    EXPECT_TRUE(publisher.Flush(std::chrono::seconds(5)));
+    EXPECT_TRUE(publisher.Enqueue(MakeMessage("Start.5")));
+}
+
+TEST(AsyncPublisherTest, ByteLimitAdmitsOversizedMessageIntoEmptyQueue) {
+    std::mutex gate;
+    std::unique_lock<std::mutex> hold(gate);
+    AsyncPublishOptions options;
+    options.max_queued_bytes = 8;
+    options.queue_timeout = std::chrono::milliseconds(20);
+    AsyncPublisher publisher(
+        options,
+        [&](const AsyncPublisher::Message&) {
+            std::lock_guard<std::mutex> lock(gate);
+            return true;
+        },
+        [](std::chrono::milliseconds) { return true; });
+
+    ASSERT_TRUE(publisher.Enqueue(MakeMessage("Start.1", "x")));
+    while (publisher.queued() != 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(publisher.Enqueue(MakeMessage("Start.2", std::string(16, 'x'))));
+    EXPECT_FALSE(publisher.Enqueue(MakeMessage("Start.3", "x")));
+    hold.unlock();
+}
+
+TEST(AsyncPublisherTest, QueueDepthAddsUpOverPublishers) {
+    metrics::Gauge& depth = metrics::Global().GetGauge("nats_connector_nats_publish_queue_depth", "");
+    const int64_t before = depth.Value();
+    std::mutex gate;
+    std::unique_lock<std::mutex> hold(gate);
+    auto blocked = [&](const AsyncPublisher::Message&) {
+        std::lock_guard<std::mutex> lock(gate);
+        return true;
+    };
+    AsyncPublisher first(AsyncPublishOptions{}, blocked, [](std::chrono::milliseconds) { return true; });
+    AsyncPublisher second(AsyncPublishOptions{}, blocked, [](std::chrono::milliseconds) { return true; });
+
+    ASSERT_TRUE(first.Enqueue(MakeMessage("Start.1")));
+    ASSERT_TRUE(second.Enqueue(MakeMessage("Start.2")));
+    while (first.queued() != 0 || second.queued() != 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_TRUE(first.Enqueue(MakeMessage("Start.3")));
+    ASSERT_TRUE(second.Enqueue(MakeMessage("Start.4")));
+    ASSERT_TRUE(second.Enqueue(MakeMessage("Start.5")));
+    EXPECT_EQ(depth.Value() - before, 3);
+
+    hold.unlock();
+    EXPECT_TRUE(first.Flush(std::chrono::seconds(5)));
+    EXPECT_TRUE(second.Flush(std::chrono::seconds(5)));
+    EXPECT_EQ(depth.Value(), before);
+}
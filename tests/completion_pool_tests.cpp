@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "admission_controller.h"
+#include "completion_pool.h"
+#include "loopback_transport.h"
+
+using Ticket = std::shared_ptr<AdmissionController::Ticket>;
+
+TEST(CompletionPoolTest, StopRunsQueuedTasks) {
+    CompletionPool pool(2);
+    std::atomic<int> ran{0};
+    for (int i = 0; i < 100; ++i) {
+        pool.Post([&ran]() {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            ran.fetch_add(1);
+        });
+    }
+    pool.Stop();
+    EXPECT_EQ(ran.load(), 100);
+}
+
+TEST(CompletionPoolTest, PostAfterStopRunsOnCaller) {
+    CompletionPool pool(1);
+    pool.Stop();
+    std::thread::id ran_on;
+    pool.Post([&ran_on]() { ran_on = std::this_thread::get_id(); });
+    EXPECT_EQ(ran_on, std::this_thread::get_id());
+    pool.Stop();  // nothing left to stop
+}
+
+// The objects of ServerApp::main in their declaration order, torn down the way it does: requests nobody answered
+// are cancelled and their continuations, holding admission tickets, run before the controller goes away.
+TEST(CompletionPoolTest, ShutdownReleasesTicketsOfPendingRequests) {
+    CompletionPool pool(2);
+    AdmissionLimits limits;
+    limits.max_in_flight = 4;
+    limits.queue_timeout = std::chrono::hours(1);
+    AdmissionController admission(limits);
+    auto transport = std::make_unique<LoopbackTransport>();
+
+    std::atomic<int> answered{0};
+    for (int i = 0; i < 4; ++i) {
+        Ticket ticket = admission.Admit("state");
+        ASSERT_TRUE(ticket);
+        transport->AsyncRequest("State.Request." + std::to_string(i), nlohmann::json::object(),
+                                Transport::Clock::time_point::max(), "mathcore",
+                                [&pool, &answered, ticket](NatsReply&& reply) {
+                                    EXPECT_EQ(reply.status, NatsReply::Status::Cancelled);
+                                    pool.Post([&answered, ticket]() {
+                                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                                        answered.fetch_add(1);
+                                    });
+                                });
+    }
+    // Gets the slot of the first continuation that finishes.
+    std::atomic<bool> parked_admitted{false};
+    ASSERT_TRUE(admission.Park("state", [&pool, &parked_admitted](Ticket ticket) {
+        pool.Post([&parked_admitted, ticket]() { parked_admitted.store(ticket != nullptr); });
+    }));
+    EXPECT_EQ(admission.in_flight(), 4);
+
+    transport.reset();  // NatsManager::Disconnect()
+    pool.Stop();
+    EXPECT_EQ(answered.load(), 4);
+    EXPECT_TRUE(parked_admitted.load());
+    EXPECT_EQ(admission.in_flight(), 0);
+    EXPECT_EQ(admission.queued(), 0);
+}
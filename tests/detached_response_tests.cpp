@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/HTTPRequestHandlerFactory.h>
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/Net/HTTPServer.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/StreamCopier.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "detached_response.h"
+
+namespace {
+
+using Respond = std::function<void(DetachedResponse&)>;
+
+// Answers every request through its detached connection with `respond`.
+class DetachingHandler : public Poco::Net::HTTPRequestHandler {
+  public:
+    explicit DetachingHandler(Respond respond) : respond_(std::move(respond)) {}
+
+    void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse&) override {
+        std::shared_ptr<DetachedResponse> detached = DetachedResponse::Detach(request);
+        ASSERT_TRUE(detached);
+        respond_(*detached);
+    }
+
+  private:
+    Respond respond_;
+};
+
+class DetachingHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
+  public:
+    explicit DetachingHandlerFactory(Respond respond) : respond_(std::move(respond)) {}
+
+    Poco::Net::HTTPRequestHandler* createRequestHandler(const Poco::Net::HTTPServerRequest&) override {
+        return new DetachingHandler(respond_);
+    }
+
+  private:
+    Respond respond_;
+};
+
+// Serves one GET with `respond` on a local port and reads the response.
+std::string Fetch(Respond respond, Poco::Net::HTTPResponse& response) {
+    Poco::Net::ServerSocket socket(static_cast<Poco::UInt16>(0));  // any free port
+    Poco::Net::HTTPServer server(new DetachingHandlerFactory(std::move(respond)), socket,
+                                 new Poco::Net::HTTPServerParams);
+    server.start();
+
+    Poco::Net::HTTPClientSession session("127.0.0.1", socket.address().port());
+    Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_GET, "/getlog?id=1");
+    session.sendRequest(request);
+    std::string body;
+    Poco::StreamCopier::copyToString(session.receiveResponse(response), body);
+    server.stop();
+    return body;
+}
+
+}  // namespace
+
+TEST(DetachedResponseTest, ChunksMakeOneBody) {
+    Poco::Net::HTTPResponse response;
+    std::string body = Fetch(
+        [](DetachedResponse& detached) {
+            EXPECT_TRUE(detached.SendChunk("application/json", "[\"a\","));
+            EXPECT_TRUE(detached.SendChunk("application/json", ""));
+            EXPECT_TRUE(detached.SendChunk("application/json", "\"b\"]"));
+            detached.FinishChunked(true);
+        },
+        response);
+
+    EXPECT_EQ(response.getStatus(), Poco::Net::HTTPResponse::HTTP_OK);
+    EXPECT_TRUE(response.getChunkedTransferEncoding());
+    EXPECT_EQ(body, "[\"a\",\"b\"]");
+}
+
+TEST(DetachedResponseTest, AllEmptyChunksMakeEmptyResponse) {
+    Poco::Net::HTTPResponse response;
+    std::string body = Fetch(
+        [](DetachedResponse& detached) {
+            EXPECT_TRUE(detached.SendChunk("application/json", ""));
+            EXPECT_TRUE(detached.SendChunk("application/json", ""));
+            detached.FinishChunked(true);
+        },
+        response);
+
+    EXPECT_EQ(response.getStatus(), Poco::Net::HTTPResponse::HTTP_OK);
+    EXPECT_EQ(response.getContentType(), "application/json");
+    EXPECT_EQ(response.getContentLength(), 0);
+    EXPECT_EQ(body, "");
+}
@@ -1,47 +1,263 @@
 #include <gtest/gtest.h>
 
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/SocketAddress.h>
+
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
+
+#include "http_handler.h"
+#include "loopback_transport.h"
+
+namespace {
 
-#include "math_picker.h"
-#include "nats_manager.h"
-#include "std_err_capture.h"
+// Response of a request that didn't come through Poco's HTTPServer: the handler answers it on the calling
+// thread (Dispatch()'s blocking fallback), and the body is collected here.
+class FakeResponse : public Poco::Net::HTTPServerResponse {
+  public:
+    void sendContinue() override {}
+    std::ostream& send() override {
+        sent_ = true;
+        return body_;
+    }
+    // No `override`: only some Poco versions declare it.
+    std::pair<std::ostream*, std::ostream*> beginSend() {
+        sent_ = true;
+        return {&body_, &body_};
+    }
+    void sendFile(const std::string&, const std::string&) override {}
+    void sendBuffer(const void* buffer, std::size_t length) override {
+        sent_ = true;
+        body_.write(static_cast<const char*>(buffer), static_cast<std::streamsize>(length));
+    }
+    void redirect(const std::string&, HTTPStatus) override {}
+    void requireAuthentication(const std::string&) override {}
+    bool sent() const override { return sent_; }
 
-class MathPickerIntegrationTest : public ::testing::Test {
+    std::string body() const { return body_.str(); }
+
+  private:
+    std::ostringstream body_;
+    bool sent_ = false;
+};
+
+class FakeRequest : public Poco::Net::HTTPServerRequest {
+  public:
+    FakeRequest(const std::string& method, const std::string& uri, FakeResponse& response) :
+        params_(new Poco::Net::HTTPServerParams), response_(response) {
+        setMethod(method);
+        setURI(uri);
+    }
+
+    std::istream& stream() override { return body_; }
+    const Poco::Net::SocketAddress& clientAddress() const override { return address_; }
+    const Poco::Net::SocketAddress& serverAddress() const override { return address_; }
+    const Poco::Net::HTTPServerParams& serverParams() const override { return *params_; }
+    Poco::Net::HTTPServerResponse& response() const override { return response_; }
+    bool secure() const override { return false; }
+
+  private:
+    std::istringstream body_;
+    Poco::Net::SocketAddress address_;
+    Poco::Net::HTTPServerParams::Ptr params_;
+    FakeResponse& response_;
+};
+
+struct Reply {
+    Poco::Net::HTTPResponse::HTTPStatus status{};
+    std::string body;
+    std::string retry_after;
+};
+
+bool WaitFor(const std::function<bool()>& condition) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+}  // namespace
+
+// MathCore requests go over LoopbackTransport; a test plays MathCore by holding the requests it receives and
+// answering them when it likes. Members are declared in the order of ServerApp::main.
+class HttpHandlerTest : public ::testing::Test {
   protected:
-    StderrCapture stderr_capture_;
-    MathPicker math_picker_;
-    NatsManager nats_;
-    std::string server_url = "nats://localhost:4222";
-    std::string test_channel = "test.subject";
-
-    void SetUp() override {}
-    void TearDown() override {}
+    QueryRegistry queries_;
+    MathCoreInstances instances_;
+    IdGenerator ids_;
+    RequestCoalescer coalescer_;
+    CompletionPool pool_{2};
+    std::unique_ptr<AdmissionController> admission_;
+    LoopbackTransport transport_;
+
+    std::mutex held_mutex_;
+    std::vector<NatsMessage> held_;  // MathCore requests not answered yet
+    int received_ = 0;
+
+    void SetUp() override { Admit(AdmissionLimits()); }
+    void TearDown() override { transport_.CancelRequests("mathcore", "test over"); }
+
+    void Admit(const AdmissionLimits& limits) { admission_ = std::make_unique<AdmissionController>(limits); }
+
+    // Holds every MathCore request to `subject`.
+    void HoldRequests(const std::string& subject) {
+        ASSERT_TRUE(transport_.SubscribeRaw(subject, [this](NatsMessage& request) {
+            std::lock_guard<std::mutex> lock(held_mutex_);
+            held_.push_back(std::move(request));
+            ++received_;
+        }));
+    }
+    bool WaitForHeld(std::size_t count) {
+        return WaitFor([this, count]() {
+            std::lock_guard<std::mutex> lock(held_mutex_);
+            return held_.size() >= count;
+        });
+    }
+    // Answers the oldest held request.
+    void Answer(std::string_view payload) {
+        NatsMessage request(nullptr);
+        {
+            std::lock_guard<std::mutex> lock(held_mutex_);
+            ASSERT_FALSE(held_.empty());
+            request = std::move(held_.front());
+            held_.erase(held_.begin());
+        }
+        EXPECT_TRUE(transport_.Respond(request, payload));
+    }
+
+    Reply Get(const std::string& uri) {
+        HandlerContext context{transport_,
+                               pool_,
+                               *admission_,
+                               queries_,
+                               instances_,
+                               ids_,
+                               coalescer_,
+                               std::chrono::milliseconds(0),
+                               std::chrono::milliseconds(0),
+                               true,
+                               std::chrono::milliseconds(0),
+                               CompressionSettings()};
+        FakeResponse response;
+        FakeRequest request(Poco::Net::HTTPRequest::HTTP_GET, uri, response);
+        FileRequestHandler handler(context);
+        handler.handleRequest(request, response);
+        return Reply{response.getStatus(), response.body(), response.get("Retry-After", "")};
+    }
 };
 
-TEST_F(MathPickerIntegrationTest, Initialize) {
-    ASSERT_TRUE(math_picker_.Initialize(server_url, test_channel)) << "Failed to initialize with error:\n"
-                                                                   << stderr_capture_.Output();
+TEST_F(HttpHandlerTest, StateIsAnsweredByMathCore) {
+    ASSERT_EQ(queries_.Register("job-1"), 1);
+    ASSERT_TRUE(transport_.SubscribeRaw("State.Request.job-1", [this](NatsMessage& request) {
+        EXPECT_EQ(request.Json()["id"], "job-1");
+        transport_.Respond(request, R"({"state":{"status":1},"solutions":[]})");
+    }));
+
+    Reply reply = Get("/state?num=1");
+    EXPECT_EQ(reply.status, Poco::Net::HTTPResponse::HTTP_OK);
+    nlohmann::json body = nlohmann::json::parse(reply.body);
+    EXPECT_EQ(body["state"]["query"], 1);
+    EXPECT_EQ(admission_->in_flight(), 0);
 }
 
-TEST_F(MathPickerIntegrationTest, OnMessageTrigger) {
-    std::string received_message;
-    std::string response_message = "Your ticket is: someNumber, and message is:\n";
-    std::string sending_message = "something";
+TEST_F(HttpHandlerTest, ParkedRequestGetsFreedSlot) {
+    AdmissionLimits limits;
+    limits.max_in_flight = 1;
+    limits.queue_timeout = std::chrono::hours(1);
+    Admit(limits);
+    ASSERT_EQ(queries_.Register("job-1"), 1);
+    ASSERT_EQ(queries_.Register("job-2"), 2);
+    HoldRequests("State.Request.*");
 
-    ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
-    ASSERT_TRUE(
-        nats_.Subscribe("Answers." + test_channel,
-                        [&](const std::string& subject, const std::string& message) { received_message = message; }))
-        << "Failed to subscribe. Stderr:\n"
-        << stderr_capture_.Output();
+    Reply first;
+    Reply second;
+    std::thread first_client([&]() { first = Get("/state?num=1"); });
+    ASSERT_TRUE(WaitForHeld(1));
+    std::thread second_client([&]() { second = Get("/state?num=2"); });
+    ASSERT_TRUE(WaitFor([this]() { return admission_->queued() == 1; }));
 
-    ASSERT_TRUE(math_picker_.Initialize(server_url, test_channel)) << "Failed to initialize with error:\n"
-                                                                   << stderr_capture_.Output();
-    math_picker_.OnMessageTrigger(test_channel, sending_message);
+    Answer(R"({"message":"DONE"})");
+    first_client.join();
+    ASSERT_TRUE(WaitForHeld(1));  // sent once the first request left its slot
+    Answer(R"({"message":"DONE"})");
+    second_client.join();
 
-    // Since subscribe callbacks are async, wait a little to receive the message.
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(first.status, Poco::Net::HTTPResponse::HTTP_OK);
+    EXPECT_EQ(second.status, Poco::Net::HTTPResponse::HTTP_OK);
+    EXPECT_EQ(nlohmann::json::parse(second.body)["state"]["globalID"], "job-2");
+}
 
-    EXPECT_EQ(received_message, response_message + sending_message + "\n");
-}
\ No newline at end of file
+TEST_F(HttpHandlerTest, ParkedRequestIsRejectedAfterQueueTimeout) {
+    AdmissionLimits limits;
+    limits.max_in_flight = 1;
+    limits.queue_timeout = std::chrono::milliseconds(50);
+    limits.retry_after = std::chrono::seconds(7);
+    Admit(limits);
+    ASSERT_EQ(queries_.Register("job-1"), 1);
+    HoldRequests("State.Request.*");
+
+    Reply first;
+    std::thread first_client([&]() { first = Get("/state?num=1"); });
+    ASSERT_TRUE(WaitForHeld(1));
+
+    Reply rejected = Get("/logslist");
+    EXPECT_EQ(rejected.status, Poco::Net::HTTPResponse::HTTP_SERVICE_UNAVAILABLE);
+    EXPECT_EQ(rejected.retry_after, "7");
+    EXPECT_EQ(nlohmann::json::parse(rejected.body)["error"], "Service overloaded, retry later");
+
+    Answer(R"({"message":"DONE"})");
+    first_client.join();
+    EXPECT_EQ(first.status, Poco::Net::HTTPResponse::HTTP_OK);
+}
+
+TEST_F(HttpHandlerTest, IdenticalStateRequestsShareOneMathCoreRequest) {
+    ASSERT_EQ(queries_.Register("job-1"), 1);
+    HoldRequests("State.Request.*");
+
+    Reply first;
+    Reply second;
+    std::thread first_client([&]() { first = Get("/state?num=1"); });
+    ASSERT_TRUE(WaitForHeld(1));
+    std::thread second_client([&]() { second = Get("/state?num=1"); });
+    ASSERT_TRUE(WaitFor([this]() { return coalescer_.coalesced() == 1; }));
+
+    Answer(R"({"state":{"status":1},"solutions":[]})");
+    first_client.join();
+    second_client.join();
+
+    EXPECT_EQ(received_, 1);
+    EXPECT_EQ(first.status, Poco::Net::HTTPResponse::HTTP_OK);
+    EXPECT_EQ(first.body, second.body);
+    EXPECT_EQ(nlohmann::json::parse(second.body)["state"]["query"], 1);
+}
+
+TEST_F(HttpHandlerTest, StreamedLogIsDeliveredWhole) {
+    ASSERT_TRUE(transport_.SubscribeRaw("GetLog.Request.*", [this](NatsMessage& request) {
+        const char* chunks[] = {R"({"log":[)", R"("a",)", R"("b"]})"};
+        for (int i = 0; i < 3; ++i) {
+            Transport::Headers headers = {{Transport::kChunkSeqHeader, std::to_string(i)}};
+            if (i == 2) {
+                headers.emplace_back(Transport::kChunkLastHeader, "true");
+            }
+            transport_.Respond(request, chunks[i], headers);
+        }
+    }));
+
+    Reply reply = Get("/getlog?id=job-1");
+    EXPECT_EQ(reply.status, Poco::Net::HTTPResponse::HTTP_OK);
+    EXPECT_EQ(reply.body, R"({"log":["a","b"]})");
+}
@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "id_generator.h"
+
+TEST(IdGeneratorTest, FormatsTimeNodeAndSequence) {
+    IdGenerator ids(7);
+    const std::string id(ids.Next().view());
+
+    ASSERT_EQ(id.size(), IdGenerator::kLength);
+    for (std::size_t i = 0; i < id.size(); ++i) {
+        if (i == 8 || i == 15 || i == 19 || i == 23) {
+            EXPECT_EQ(id[i], '_') << id;
+        } else {
+            EXPECT_TRUE(id[i] >= '0' && id[i] <= '9') << id;
+        }
+    }
+    EXPECT_EQ(id.substr(20, 3), "007");
+    EXPECT_EQ(id.find('.'), std::string::npos);
+}
+
+TEST(IdGeneratorTest, ClampsNode) {
+    IdGenerator ids(123456);
+    EXPECT_EQ(std::string(ids.Next().view()).substr(20, 3), "999");
+}
+
+TEST(IdGeneratorTest, IdsIncreaseWithinOneMillisecond) {
+    IdGenerator ids;
+    std::string previous(ids.Next().view());
+    for (int i = 0; i < 10000; ++i) {
+        std::string next(ids.Next().view());
+        ASSERT_LT(previous, next);
+        previous = std::move(next);
+    }
+}
+
+TEST(IdGeneratorTest, UniqueAcrossThreads) {
+    IdGenerator ids;
+    constexpr int kThreads = 8;
+    constexpr int kPerThread = 5000;
+    std::vector<std::vector<std::string>> generated(kThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&ids, &generated, t]() {
+            for (int i = 0; i < kPerThread; ++i) {
+                generated[t].emplace_back(ids.Next().view());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::set<std::string> unique;
+    for (const auto& per_thread : generated) {
+        // each thread sees its own IDs in increasing order
+        EXPECT_TRUE(std::is_sorted(per_thread.begin(), per_thread.end()));
+        unique.insert(per_thread.begin(), per_thread.end());
+    }
+    EXPECT_EQ(unique.size(), static_cast<std::size_t>(kThreads * kPerThread));
+}
@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.h"
+
+namespace {
+
+std::string ReadFile(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+std::size_t CountLines(const std::filesystem::path& path) {
+    const std::string content = ReadFile(path);
+    return static_cast<std::size_t>(std::count(content.begin(), content.end(), '\n'));
+}
+
+// Waits for the writer thread to get `text` into `path`.
+bool WaitForText(const std::filesystem::path& path, const std::string& text) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (ReadFile(path).find(text) != std::string::npos) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return false;
+}
+
+std::time_t LocalNoon(int year, int month, int day) {
+    std::tm tm{};
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = 12;
+    tm.tm_isdst = -1;
+    return std::mktime(&tm);
+}
+
+std::filesystem::path DailyLogPath(std::time_t time) {
+    std::tm tm{};
+    localtime_r(&time, &tm);
+    char name[32];
+    std::strftime(name, sizeof(name), "%Y-%m-%d.log", &tm);
+    return std::filesystem::path("logs") / name;
+}
+
+std::atomic<std::time_t> g_fake_time{0};
+
+}  // namespace
+
+class LoggerAsyncTest : public ::testing::Test {
+  protected:
+    std::filesystem::path dir_;
+    std::filesystem::path file_;
+
+    void SetUp() override {
+        dir_ = std::filesystem::temp_directory_path() /
+               ("logger_test_" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())));
+        std::filesystem::remove_all(dir_);
+        std::filesystem::create_directories(dir_);
+        file_ = dir_ / "records.log";
+    }
+    void TearDown() override {
+        logger::StopAsync();
+        std::filesystem::remove_all(dir_);
+    }
+};
+
+TEST_F(LoggerAsyncTest, StopWritesEveryQueuedRecord) {
+    logger::AsyncOptions options;
+    options.flush_interval = std::chrono::hours(1);
+    logger::StartAsync(options);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([this, t]() {
+            for (int i = 0; i < 1000; ++i) {
+                logger::log(file_.string()) << "thread " << t << " record " << i << std::endl;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    logger::StopAsync();
+
+    EXPECT_EQ(CountLines(file_), 4000u);
+}
+
+TEST_F(LoggerAsyncTest, RecordsRacingWithStopAreNotLost) {
+    logger::StartAsync();
+
+    std::atomic<bool> stop{false};
+    std::atomic<std::size_t> written{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            while (!stop.load()) {
+                logger::log(file_.string()) << "record" << std::endl;
+                written.fetch_add(1);
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    logger::StopAsync();  // statements logged from now on are written synchronously
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    stop.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_GT(written.load(), 0u);
+    EXPECT_EQ(CountLines(file_), written.load());
+}
+
+TEST_F(LoggerAsyncTest, ErrorFlushesWithoutWaitingForTimer) {
+    logger::AsyncOptions options;
+    options.flush_interval = std::chrono::hours(1);
+    logger::StartAsync(options);
+
+    logger::log(file_.string()) << "info" << std::endl;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(ReadFile(file_).find("info"), std::string::npos);  // waits for the timer
+
+    logger::log_error(file_.string()) << "error" << std::endl;
+    EXPECT_TRUE(WaitForText(file_, "error"));
+    EXPECT_NE(ReadFile(file_).find("info"), std::string::npos);  // written in the same batch
+}
+
+TEST_F(LoggerAsyncTest, RollsDailyFileOverMidnight) {
+    const std::time_t first_day = LocalNoon(2001, 2, 3);
+    const std::time_t second_day = LocalNoon(2001, 2, 4);
+    const std::filesystem::path first_log = DailyLogPath(first_day);
+    const std::filesystem::path second_log = DailyLogPath(second_day);
+    std::filesystem::remove(first_log);
+    std::filesystem::remove(second_log);
+
+    g_fake_time.store(first_day);
+    logger::AsyncOptions options;
+    options.clock = []() { return std::chrono::system_clock::from_time_t(g_fake_time.load()); };
+    logger::StartAsync(options);
+
+    logger::log_error() << "before midnight" << std::endl;
+    ASSERT_TRUE(WaitForText(first_log, "before midnight"));
+    g_fake_time.store(second_day);
+    logger::log_error() << "after midnight" << std::endl;
+    logger::StopAsync();
+
+    EXPECT_EQ(ReadFile(first_log).find("after midnight"), std::string::npos);
+    EXPECT_NE(ReadFile(second_log).find("after midnight"), std::string::npos);
+    EXPECT_EQ(ReadFile(second_log).find("before midnight"), std::string::npos);
+    std::filesystem::remove(first_log);
+    std::filesystem::remove(second_log);
+}
+
+TEST_F(LoggerAsyncTest, LogErrorHonorsRuntimeLevel) {
+    logger::SetLevel(logger::Level::Off);
+    logger::log_error(file_.string()) << "suppressed" << std::endl;
+    logger::SetLevel(logger::Level::Info);
+    logger::log_error(file_.string()) << "written" << std::endl;
+
+    EXPECT_EQ(ReadFile(file_).find("suppressed"), std::string::npos);
+    EXPECT_NE(ReadFile(file_).find("written"), std::string::npos);
+}
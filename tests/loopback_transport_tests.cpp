@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "loopback_transport.h"
+
+TEST(LoopbackTransportTest, SubjectMatches) {
+    EXPECT_TRUE(LoopbackTransport::SubjectMatches("State.Request.42", "State.Request.42"));
+    EXPECT_FALSE(LoopbackTransport::SubjectMatches("State.Request.42", "State.Request.43"));
+    EXPECT_TRUE(LoopbackTransport::SubjectMatches("State.Request.*", "State.Request.42"));
+    EXPECT_FALSE(LoopbackTransport::SubjectMatches("State.Request.*", "State.Request"));
+    EXPECT_FALSE(LoopbackTransport::SubjectMatches("State.Request.*", "State.Request.42.x"));
+    EXPECT_TRUE(LoopbackTransport::SubjectMatches("State.*.42", "State.Request.42"));
+    EXPECT_TRUE(LoopbackTransport::SubjectMatches("State.>", "State.Request.42"));
+    EXPECT_TRUE(LoopbackTransport::SubjectMatches("State.>", "State.Request"));
+    EXPECT_FALSE(LoopbackTransport::SubjectMatches("State.>", "State"));
+    EXPECT_TRUE(LoopbackTransport::SubjectMatches(">", "anything.at.all"));
+    EXPECT_FALSE(LoopbackTransport::SubjectMatches("State", "StateX"));
+}
+
+TEST(LoopbackTransportTest, IsValidSubject) {
+    EXPECT_TRUE(LoopbackTransport::IsValidSubject("Start.20240101", false));
+    EXPECT_FALSE(LoopbackTransport::IsValidSubject("", false));
+    EXPECT_FALSE(LoopbackTransport::IsValidSubject("Start..x", false));
+    EXPECT_FALSE(LoopbackTransport::IsValidSubject("Start.", false));
+    EXPECT_FALSE(LoopbackTransport::IsValidSubject("Start.*", false));
+    EXPECT_TRUE(LoopbackTransport::IsValidSubject("Start.*", true));
+    EXPECT_TRUE(LoopbackTransport::IsValidSubject("Start.>", true));
+    EXPECT_FALSE(LoopbackTransport::IsValidSubject("Start.>.x", true));
+}
+
+TEST(LoopbackTransportTest, PublishReachesMatchingSubscriptions) {
+    LoopbackTransport transport;
+    std::vector<std::string> received;
+    ASSERT_TRUE(transport.SubscribeRaw("IsMathAlive.*", [&](NatsMessage& message) {
+        received.push_back(std::string(message.Subject()) + "=" + std::string(message.Data()));
+    }));
+    ASSERT_TRUE(transport.Subscribe("IsMathAlive.>", [&](const std::string& subject, const nlohmann::json& message) {
+        received.push_back(subject + ":" + message["event"].get<std::string>());
+    }));
+
+    ASSERT_TRUE(transport.Publish("IsMathAlive.core1", {{"event", "startup"}}));
+    ASSERT_TRUE(transport.PublishRaw("Other.subject", "ignored"));
+    EXPECT_FALSE(transport.PublishRaw("IsMathAlive.*", "wildcards can't be published to"));
+
+    ASSERT_EQ(received.size(), 2u);
+    EXPECT_EQ(received[0], "IsMathAlive.core1={\"event\":\"startup\"}");
+    EXPECT_EQ(received[1], "IsMathAlive.core1:startup");
+
+    ASSERT_TRUE(transport.Unsubscribe("IsMathAlive.*"));
+    EXPECT_FALSE(transport.Unsubscribe("IsMathAlive.*"));
+    ASSERT_TRUE(transport.Publish("IsMathAlive.core1", {{"event", "alive"}}));
+    ASSERT_EQ(received.size(), 3u);
+    EXPECT_EQ(received[2], "IsMathAlive.core1:alive");
+
+    NatsStats stats;
+    ASSERT_TRUE(transport.GetStats(stats));
+    EXPECT_EQ(stats.out_msgs, 3u);
+    EXPECT_EQ(stats.in_msgs, 3u);
+}
+
+TEST(LoopbackTransportTest, SubjectEncodingSetsContentType) {
+    LoopbackTransport transport;
+    transport.SetSubjectEncoding("State.", WireEncoding::MsgPack);
+    WireEncoding received_encoding = WireEncoding::Json;
+    nlohmann::json received_json;
+    ASSERT_TRUE(transport.SubscribeRaw("State.Request.*", [&](NatsMessage& message) {
+        received_encoding = message.Encoding();
+        received_json = message.Json();
+    }));
+
+    ASSERT_TRUE(transport.Publish("State.Request.7", {{"query", 7}}));
+    EXPECT_EQ(received_encoding, WireEncoding::MsgPack);
+    EXPECT_EQ(received_json, nlohmann::json({{"query", 7}}));
+}
+
+TEST(LoopbackTransportTest, RequestReply) {
+    LoopbackTransport transport;
+    ASSERT_TRUE(transport.SubscribeRaw("State.Request.*", [&](NatsMessage& request) {
+        EXPECT_TRUE(transport.Respond(request, "{\"message\":\"CALCULATING\"}"));
+    }));
+
+    PendingRequest request =
+        transport.Request("State.Request.42", {}, Transport::Clock::now() + std::chrono::seconds(5));
+    ASSERT_NE(request.id, 0u);
+    ASSERT_EQ(request.reply.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+    NatsReply reply = request.reply.get();
+    ASSERT_EQ(reply.status, NatsReply::Status::Ok);
+    EXPECT_EQ(reply.message->Json()["message"], "CALCULATING");
+}
+
+TEST(LoopbackTransportTest, StreamedRequest) {
+    const std::vector<std::string> chunks = {"[\"first\",", "\"second\",", "\"third\"]"};
+    LoopbackTransport transport;
+    ASSERT_TRUE(transport.SubscribeRaw("GetLog.Request.*", [&](NatsMessage& request) {
+        for (std::size_t i = 0; i < chunks.size(); ++i) {
+            Transport::Headers headers{{Transport::kChunkSeqHeader, std::to_string(i)}};
+            if (i + 1 == chunks.size()) {
+                headers.emplace_back(Transport::kChunkLastHeader, "true");
+            }
+            transport.Respond(request, chunks[i], headers);
+        }
+    }));
+
+    std::string received;
+    int calls = 0;
+    NatsReply::Status final_status = NatsReply::Status::Failed;
+    uint64_t id = transport.AsyncStreamRequest("GetLog.Request.log",
+                                               {},
+                                               Transport::Clock::now() + std::chrono::seconds(5),
+                                               "",
+                                               [&](NatsReply&& reply) {
+                                                   ++calls;
+                                                   if (reply.status == NatsReply::Status::Ok) {
+                                                       received.append(reply.message->Data());
+                                                   }
+                                                   if (!reply.more) {
+                                                       final_status = reply.status;
+                                                   }
+                                               });
+    ASSERT_NE(id, 0u);
+    EXPECT_EQ(final_status, NatsReply::Status::Ok);
+    EXPECT_EQ(calls, 3);
+    EXPECT_EQ(received, chunks[0] + chunks[1] + chunks[2]);
+}
+
+TEST(LoopbackTransportTest, UnansweredRequestTimesOut) {
+    LoopbackTransport transport;
+    PendingRequest request =
+        transport.Request("LogsList.Request", {}, Transport::Clock::now() + std::chrono::milliseconds(20));
+    ASSERT_NE(request.id, 0u);
+    ASSERT_EQ(request.reply.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_EQ(request.reply.get().status, NatsReply::Status::Timeout);
+}
+
+TEST(LoopbackTransportTest, CancelRequestsOfGroup) {
+    LoopbackTransport transport;
+    PendingRequest first = transport.Request("State.Request.1", {}, Transport::Clock::time_point::max(), "mathcore");
+    PendingRequest second = transport.Request("State.Request.2", {}, Transport::Clock::time_point::max(), "mathcore");
+    PendingRequest other = transport.Request("State.Request.3", {}, Transport::Clock::time_point::max(), "other");
+
+    EXPECT_EQ(transport.CancelRequests("mathcore", "MathCore was restarted"), 2u);
+    NatsReply reply = first.reply.get();
+    EXPECT_EQ(reply.status, NatsReply::Status::Cancelled);
+    EXPECT_EQ(reply.error, "MathCore was restarted");
+    EXPECT_EQ(second.reply.get().status, NatsReply::Status::Cancelled);
+    EXPECT_EQ(other.reply.wait_for(std::chrono::seconds(0)), std::future_status::timeout);
+
+    EXPECT_TRUE(transport.CancelRequest(other.id, "done"));
+    EXPECT_FALSE(transport.CancelRequest(other.id, "done"));
+    EXPECT_EQ(other.reply.get().status, NatsReply::Status::Cancelled);
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "mathcore_instances.h"
+
+namespace {
+
+const MathCoreInstances::Clock::time_point kStart = MathCoreInstances::Clock::now();
+constexpr std::chrono::seconds kTimeout(60);
+
+}  // namespace
+
+TEST(MathCoreInstancesTest, RoutesToLeastLoadedInstance) {
+    MathCoreInstances instances(true);
+    instances.Record("a", "alive", 4.5, kStart);
+    instances.Record("b", "alive", 2, kStart);
+
+    // b takes jobs until the ones routed to it since its last report make it as busy as a.
+    EXPECT_EQ(instances.Assign("1").instance, "b");
+    EXPECT_EQ(instances.Assign("2").instance, "b");
+    EXPECT_EQ(instances.Assign("3").instance, "b");
+    EXPECT_EQ(instances.Assign("4").instance, "a");
+    EXPECT_EQ(instances.Find("2").instance, "b");
+    EXPECT_EQ(instances.pinned_size(), 4u);
+
+    // a fresh report replaces the estimate
+    instances.Record("a", "alive", 0, kStart);
+    EXPECT_EQ(instances.Assign("5").instance, "a");
+}
+
+TEST(MathCoreInstancesTest, BalancesByJobCountWithoutLoadReports) {
+    MathCoreInstances instances(true);
+    instances.Record("a", "alive", -1, kStart);
+    instances.Record("b", "alive", -1, kStart);
+
+    int on_a = 0;
+    for (int i = 0; i < 10; ++i) {
+        on_a += instances.Assign(std::to_string(i)).instance == "a" ? 1 : 0;
+        instances.Record("a", "alive", -1, kStart);  // heartbeats without a load figure keep the job count
+    }
+    EXPECT_EQ(on_a, 5);
+}
+
+TEST(MathCoreInstancesTest, SkipsDeadInstances) {
+    MathCoreInstances instances(true);
+    instances.Record("a", "alive", 0, kStart);
+    instances.Record("b", "alive", 9, kStart + std::chrono::seconds(30));
+    EXPECT_EQ(instances.NextExpiry(kTimeout), kStart + kTimeout);
+
+    std::vector<std::string> expired = instances.Expire(kStart + kTimeout, kTimeout);
+    ASSERT_EQ(expired.size(), 1u);
+    EXPECT_EQ(expired[0], "a");
+    EXPECT_EQ(instances.alive_count(), 1u);
+    EXPECT_EQ(instances.Assign("1").instance, "b");
+
+    instances.Expire(kStart + std::chrono::seconds(90), kTimeout);
+    EXPECT_EQ(instances.alive_count(), 0u);
+    EXPECT_TRUE(instances.Assign("2").instance.empty());
+    EXPECT_EQ(instances.NextExpiry(kTimeout), MathCoreInstances::Clock::time_point::max());
+}
+
+TEST(MathCoreInstancesTest, RestartOnlyLosesOwnJobs) {
+    MathCoreInstances instances(true);
+    instances.Record("a", "startup", 0, kStart);
+    instances.Record("b", "startup", 0.5, kStart);
+    MathCoreInstances::Route on_a = instances.Assign("1");
+    MathCoreInstances::Route on_b = instances.Assign("2");
+    ASSERT_EQ(on_a.instance, "a");
+    ASSERT_EQ(on_b.instance, "b");
+    MathCoreInstances::Route shared = instances.Shared();
+
+    MathCoreInstances::Update update = instances.Record("a", "startup", -1, kStart);
+    EXPECT_TRUE(update.restarted);
+    ASSERT_EQ(update.lost_jobs.size(), 1u);
+    EXPECT_EQ(update.lost_jobs[0], "1");
+    EXPECT_TRUE(instances.Restarted(on_a));
+    EXPECT_FALSE(instances.Restarted(on_b));
+    EXPECT_FALSE(instances.Restarted(shared));  // with routing there's no restart of MathCore as a whole
+    EXPECT_TRUE(instances.Find("1").instance.empty());
+    EXPECT_EQ(instances.Find("2").instance, "b");
+    EXPECT_EQ(instances.startups(), 3u);
+}
+
+TEST(MathCoreInstancesTest, WithoutRoutingAnyRestartCounts) {
+    MathCoreInstances instances;
+    instances.Record("a", "alive", -1, kStart);
+    instances.Record("b", "alive", -1, kStart);
+    MathCoreInstances::Route route = instances.Find("1");
+    EXPECT_TRUE(route.instance.empty());
+
+    instances.Record("b", "startup", -1, kStart);
+    EXPECT_TRUE(instances.Restarted(route));
+    EXPECT_FALSE(instances.Restarted(instances.Find("1")));
+}
+
+TEST(MathCoreInstancesTest, ReleaseUndoesAssign) {
+    MathCoreInstances instances(true);
+    instances.Record("a", "alive", 0, kStart);
+    instances.Record("b", "alive", 0, kStart);
+    instances.Assign("1");
+    instances.Release("1");
+
+    EXPECT_EQ(instances.pinned_size(), 0u);
+    EXPECT_TRUE(instances.Find("1").instance.empty());
+    // the released job no longer counts against its instance
+    instances.Assign("2");
+    EXPECT_NE(instances.Assign("3").instance, instances.Find("2").instance);
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+TEST(MetricsTest, CounterSumsShardsOfAllThreads) {
+    metrics::Counter counter;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&counter]() {
+            for (int i = 0; i < 10000; ++i) {
+                counter.Add();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(counter.Value(), 40000u);
+}
+
+TEST(MetricsTest, HistogramBucketsBoundTheirValues) {
+    for (uint64_t value : {0ull, 1ull, 31ull, 32ull, 33ull, 1000ull, 123456ull, 987654321ull}) {
+        std::size_t bucket = metrics::Histogram::BucketOf(value);
+        EXPECT_TRUE(metrics::Histogram::UpperBound(bucket) >= value);
+        // at most 1/16 above the recorded value
+        EXPECT_TRUE(metrics::Histogram::UpperBound(bucket) <= value + value / 16);
+    }
+    EXPECT_EQ(metrics::Histogram::BucketOf(uint64_t(1) << 50), metrics::Histogram::kBuckets - 1);
+}
+
+TEST(MetricsTest, HistogramQuantiles) {
+    metrics::Histogram histogram;
+    for (uint64_t micros = 1; micros <= 1000; ++micros) {
+        histogram.Record(micros);
+    }
+    metrics::Histogram::Snapshot snapshot = histogram.Collect();
+    EXPECT_EQ(snapshot.count, 1000u);
+    EXPECT_EQ(snapshot.sum, 500500u);
+
+    uint64_t median = snapshot.ValueAt(0.5);
+    EXPECT_TRUE(median >= 500 && median <= 532);
+    uint64_t p99 = snapshot.ValueAt(0.99);
+    EXPECT_TRUE(p99 >= 990 && p99 <= 1023);
+    EXPECT_EQ(metrics::Histogram().Collect().ValueAt(0.5), 0u);
+}
+
+TEST(MetricsTest, RendersPrometheusText) {
+    metrics::Registry registry;
+    registry.GetCounter("test_requests_total", "Requests", "endpoint=\"state\"").Add(3);
+    registry.GetGauge("test_in_flight", "In flight").Set(2);
+    registry.GetHistogram("test_latency_seconds", "Latency").Record(1000);
+
+    std::string text = registry.Render();
+    EXPECT_NE(text.find("# TYPE test_requests_total counter\n"), std::string::npos);
+    EXPECT_NE(text.find("test_requests_total{endpoint=\"state\"} 3\n"), std::string::npos);
+    EXPECT_NE(text.find("test_in_flight 2\n"), std::string::npos);
+    EXPECT_NE(text.find("# TYPE test_latency_seconds summary\n"), std::string::npos);
+    EXPECT_NE(text.find("test_latency_seconds{quantile=\"0.5\"} 0.001"), std::string::npos);
+    EXPECT_NE(text.find("test_latency_seconds_count 1\n"), std::string::npos);
+
+    // the same name and labels give the same metric
+    registry.GetCounter("test_requests_total", "Requests", "endpoint=\"state\"").Add();
+    EXPECT_EQ(registry.GetCounter("test_requests_total", "", "endpoint=\"state\"").Value(), 4u);
+}
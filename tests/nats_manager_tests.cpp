@@ -1,8 +1,13 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
+#include <vector>
 
+#include "metrics.h"
 #include "nats_manager.h"
 #include "std_err_capture.h"
 
@@ -36,9 +41,9 @@ TEST_F(NatsManagerIntegrationTest, Subscribe) {
 
     ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
     ASSERT_TRUE(nats_.Subscribe(test_channel,
-                                [&](const std::string& subject, const std::string& message) {
+                                [&](const std::string& subject, const nlohmann::json& message) {
                                     received_subject = subject;
-                                    received_message = message;
+                                    received_message = message.get<std::string>();
                                 }))
         << "Failed to subscribe. Stderr:\n"
         << stderr_capture_.Output();
@@ -53,14 +58,267 @@ TEST_F(NatsManagerIntegrationTest, Subscribe) {
     EXPECT_EQ(received_message, sending_message);
 }
 
+TEST_F(NatsManagerIntegrationTest, SubscribeRaw) {
+    std::string received_subject;
+    std::string received_payload;
+    natsMsg* kept_message = nullptr;
+    nlohmann::json sending_message = {{"event", "heartbeat"}};
+
+    ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+    ASSERT_TRUE(nats_.SubscribeRaw(test_channel,
+                                   [&](NatsMessage& message) {
+                                       received_subject = std::string(message.Subject());
+                                       received_payload = std::string(message.Data());
+                                       kept_message = message.Release();  // take ownership of the natsMsg
+                                   }))
+        << "Failed to subscribe. Stderr:\n"
+        << stderr_capture_.Output();
+
+    ASSERT_TRUE(nats_.Publish(test_channel, sending_message)) << "Failed to publish message. Stderr:\n"
+                                                              << stderr_capture_.Output();
+
+    // Since subscribe callbacks are async, wait a little to receive the message.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    EXPECT_EQ(received_subject, test_channel);
+    EXPECT_EQ(received_payload, sending_message.dump());
+    ASSERT_NE(kept_message, nullptr);
+    NatsMessage owned(kept_message);
+    EXPECT_EQ(owned.Json(), sending_message);
+}
+
+TEST_F(NatsManagerIntegrationTest, StreamedRequest) {
+    const std::vector<std::string> chunks = {"[\"first\",", "\"second\",", "\"third\"]"};
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    std::string received;
+    int calls = 0;
+    bool done = false;
+    NatsReply::Status final_status = NatsReply::Status::Failed;
+
+    ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+    // Responder streaming its answer as numbered chunks to the reply subject.
+    ASSERT_TRUE(nats_.SubscribeRaw(test_channel, [&](NatsMessage& request) {
+        const char* reply_subject = natsMsg_GetReply(request.get());
+        for (std::size_t i = 0; i < chunks.size(); ++i) {
+            natsMsg* chunk = nullptr;
+            natsMsg_Create(&chunk, reply_subject, nullptr, chunks[i].data(), static_cast<int>(chunks[i].size()));
+            natsMsgHeader_Set(chunk, NatsManager::kChunkSeqHeader, std::to_string(i).c_str());
+            if (i + 1 == chunks.size()) {
+                natsMsgHeader_Set(chunk, NatsManager::kChunkLastHeader, "true");
+            }
+            natsConnection_PublishMsg(nats_.get_connection(), chunk);
+            natsMsg_Destroy(chunk);
+        }
+    }));
+
+    uint64_t id = nats_.AsyncStreamRequest(test_channel,
+                                           nlohmann::json{{"id", "log"}},
+                                           NatsManager::Clock::now() + std::chrono::seconds(5),
+                                           "",
+                                           [&](NatsReply&& reply) {
+                                               std::lock_guard<std::mutex> lock(mutex);
+                                               ++calls;
+                                               if (reply.status == NatsReply::Status::Ok) {
+                                                   received.append(reply.message->Data());
+                                               }
+                                               if (!reply.more) {
+                                                   final_status = reply.status;
+                                                   done = true;
+                                                   done_cv.notify_one();
+                                               }
+                                           });
+    ASSERT_NE(id, 0u);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(done_cv.wait_for(lock, std::chrono::seconds(5), [&]() { return done; }));
+    EXPECT_EQ(final_status, NatsReply::Status::Ok);
+    EXPECT_EQ(calls, 3);
+    EXPECT_EQ(received, chunks[0] + chunks[1] + chunks[2]);
+}
+
+TEST_F(NatsManagerIntegrationTest, SubjectEncoding) {
+    nats_.SetSubjectEncoding("", WireEncoding::Cbor);
+    nats_.SetSubjectEncoding("test.", WireEncoding::MsgPack);
+    EXPECT_EQ(nats_.EncodingFor("other.subject"), WireEncoding::Cbor);
+    EXPECT_EQ(nats_.EncodingFor(test_channel), WireEncoding::MsgPack);
+
+    WireEncoding received_encoding = WireEncoding::Json;
+    nlohmann::json received_message;
+    nlohmann::json sending_message = {{"solutions", {1.5, 2.25, 3.125}}, {"status", 1}};
+
+    ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+    ASSERT_TRUE(nats_.SubscribeRaw(test_channel, [&](NatsMessage& message) {
+        received_encoding = message.Encoding();
+        received_message = message.Json();
+    }));
+    ASSERT_TRUE(nats_.Publish(test_channel, sending_message)) << "Failed to publish message. Stderr:\n"
+                                                              << stderr_capture_.Output();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    EXPECT_EQ(received_encoding, WireEncoding::MsgPack);
+    EXPECT_EQ(received_message, sending_message);
+}
+
 TEST_F(NatsManagerIntegrationTest, Disconnect) {
     ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
-    ASSERT_TRUE(nats_.Subscribe(test_channel, [&](const std::string& subject, const std::string& message) {}))
+    ASSERT_TRUE(nats_.Subscribe(test_channel, [&](const std::string& subject, const nlohmann::json& message) {}))
         << "Failed to subscribe. Stderr:\n"
         << stderr_capture_.Output();
     ASSERT_NE(nats_.get_connection(), nullptr);
-    ASSERT_NE(nats_.get_subscription(), nullptr);
     nats_.Disconnect();
     EXPECT_EQ(nats_.get_connection(), nullptr);
-    EXPECT_EQ(nats_.get_subscription(), nullptr);
-}
\ No newline at end of file
+}
+TEST_F(NatsManagerIntegrationTest, ConnectionPool) {
+    NatsOptions options;
+    options.connections = 4;
+    nats_.SetOptions(options);
+    ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+    ASSERT_EQ(nats_.connection_count(), 4u);
+    EXPECT_NE(nats_.get_connection(3), nullptr);
+    // Everything about one job travels over the same connection.
+    EXPECT_EQ(nats_.ShardOf("Start.20250808_120000_000_000_00001"),
+              nats_.ShardOf("State.Request.20250808_120000_000_000_00001"));
+
+    ASSERT_TRUE(nats_.SubscribeRaw("test.pool.*", [&](NatsMessage& request) {
+        nats_.Respond(request, request.Data());
+    }));
+
+    std::vector<PendingRequest> requests;
+    for (int i = 0; i < 16; ++i) {
+        requests.push_back(nats_.Request("test.pool." + std::to_string(i),
+                                         nlohmann::json{{"n", i}},
+                                         NatsManager::Clock::now() + std::chrono::seconds(5)));
+    }
+    for (int i = 0; i < 16; ++i) {
+        NatsReply reply = requests[i].reply.get();
+        ASSERT_EQ(reply.status, NatsReply::Status::Ok) << reply.error;
+        EXPECT_EQ(reply.message->Json()["n"], i);
+    }
+
+    NatsStats stats;
+    ASSERT_TRUE(nats_.GetStats(stats));
+    EXPECT_GE(stats.out_msgs, 32u);
+}
+
+TEST_F(NatsManagerIntegrationTest, QueueSubscription) {
+    NatsManager other;
+    std::atomic<int> received_here{0};
+    std::atomic<int> received_there{0};
+    std::atomic<int> received_plain{0};
+
+    ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+    ASSERT_TRUE(other.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+    ASSERT_TRUE(nats_.QueueSubscribeRaw("test.queue", "workers", [&](NatsMessage&) { ++received_here; }));
+    ASSERT_TRUE(other.QueueSubscribeRaw("test.queue", "workers", [&](NatsMessage&) { ++received_there; }));
+    ASSERT_TRUE(nats_.SubscribeRaw("test.queue", [&](NatsMessage&) { ++received_plain; }));
+
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(nats_.PublishRaw("test.queue", "{}"));
+    }
+    ASSERT_TRUE(nats_.Flush(std::chrono::seconds(5)));
+    ASSERT_TRUE(other.Flush(std::chrono::seconds(5)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Every message went to exactly one member of the queue group, and to the plain subscriber as well.
+    EXPECT_EQ(received_here.load() + received_there.load(), 100);
+    EXPECT_EQ(received_plain.load(), 100);
+    EXPECT_TRUE(nats_.Unsubscribe("test.queue"));
+    EXPECT_TRUE(nats_.Unsubscribe("test.queue"));
+    EXPECT_FALSE(nats_.Unsubscribe("test.queue"));
+}
+
+TEST_F(NatsManagerIntegrationTest, FlushOfSubjectCoversItsMessages) {
+    NatsOptions options;
+    options.connections = 4;
+    options.async_publish.enabled = true;
+    nats_.SetOptions(options);
+    NatsManager other;
+    std::atomic<int> received{0};
+    ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+    ASSERT_TRUE(other.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+    ASSERT_TRUE(other.SubscribeRaw("Start.>", [&](NatsMessage&) { ++received; }));
+    ASSERT_TRUE(other.Flush(std::chrono::seconds(5)));
+
+    for (int i = 0; i < 10; ++i) {
+        const std::string subject = "Start.job" + std::to_string(i);
+        ASSERT_TRUE(nats_.PublishRaw(subject, "{}"));
+        // Only the connection that carried it is flushed, and that's enough for the server to have it.
+        ASSERT_TRUE(nats_.Flush(subject, std::chrono::seconds(5)));
+    }
+    for (int i = 0; i < 100 && received < 10; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(received.load(), 10);
+}
+
+TEST_F(NatsManagerIntegrationTest, SlowConsumerIsCounted) {
+    metrics::Counter& slow_consumers = metrics::Global().GetCounter(
+        "nats_connector_nats_slow_consumer_total", "Slow consumer reports: nats.c dropped messages",
+        "path=\"subscription\"");
+    const uint64_t before = slow_consumers.Value();
+
+    NatsOptions options;
+    options.pending_msgs = 1;
+    nats_.SetOptions(options);
+    ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+    ASSERT_TRUE(nats_.SubscribeRaw(test_channel, [](NatsMessage&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }));
+    for (int i = 0; i < 20; ++i) {
+        ASSERT_TRUE(nats_.PublishRaw(test_channel, "{}"));
+    }
+    ASSERT_TRUE(nats_.Flush(std::chrono::seconds(5)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    EXPECT_GT(slow_consumers.Value(), before);
+}
+
+// Subscriptions come and go from several threads, and from inside handlers, while messages keep arriving on a
+// subscription that stays: none of its messages may be lost and nothing may crash.
+TEST_F(NatsManagerIntegrationTest, SubscriptionChurn) {
+    constexpr int kChurnThreads = 4;
+    constexpr int kRounds = 200;
+    constexpr int kMessages = 2000;
+
+    NatsOptions options;
+    options.connections = 2;
+    nats_.SetOptions(options);
+    ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+
+    std::atomic<int> received{0};
+    ASSERT_TRUE(nats_.SubscribeRaw("test.churn.stable", [&](NatsMessage&) { ++received; }));
+
+    std::atomic<bool> stop{false};
+    std::thread publisher([&]() {
+        for (int i = 0; i < kMessages; ++i) {
+            nats_.PublishRaw("test.churn.stable", "{}");
+            nats_.PublishRaw("test.churn.volatile", "{}");
+        }
+    });
+    std::vector<std::thread> churners;
+    for (int t = 0; t < kChurnThreads; ++t) {
+        churners.emplace_back([&, t]() {
+            const std::string subject = "test.churn.self." + std::to_string(t);
+            for (int round = 0; round < kRounds && !stop; ++round) {
+                EXPECT_TRUE(nats_.SubscribeRaw("test.churn.volatile", [](NatsMessage&) {}));
+                // this one removes itself from its first message
+                EXPECT_TRUE(nats_.SubscribeRaw(subject, [&, subject](NatsMessage&) { nats_.Unsubscribe(subject); }));
+                nats_.PublishRaw(subject, "{}");
+                EXPECT_TRUE(nats_.Unsubscribe("test.churn.volatile"));
+            }
+        });
+    }
+
+    publisher.join();
+    stop = true;
+    for (auto& thread : churners) {
+        thread.join();
+    }
+    ASSERT_TRUE(nats_.Flush(std::chrono::seconds(5)));
+    for (int i = 0; i < 500 && received < kMessages; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(received.load(), kMessages);
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+    #include <sys/resource.h>
+
+    #include <csignal>
+#endif
+
+#include "query_journal.h"
+
+#if !defined(_WIN32)
+namespace {
+
+// Writes past `bytes` into any file of the process fail (EFBIG) while this is alive.
+class FileSizeLimit {
+  public:
+    explicit FileSizeLimit(rlim_t bytes) {
+        getrlimit(RLIMIT_FSIZE, &saved_);
+        rlimit limit = saved_;
+        limit.rlim_cur = bytes;
+        setrlimit(RLIMIT_FSIZE, &limit);
+        saved_handler_ = std::signal(SIGXFSZ, SIG_IGN);
+    }
+    ~FileSizeLimit() {
+        setrlimit(RLIMIT_FSIZE, &saved_);
+        std::signal(SIGXFSZ, saved_handler_);
+    }
+
+  private:
+    rlimit saved_{};
+    void (*saved_handler_)(int) = nullptr;
+};
+
+}  // namespace
+#endif
+
+class QueryJournalTest : public ::testing::Test {
+  protected:
+    std::filesystem::path dir_;
+    QueryJournalOptions options_;
+
+    void SetUp() override {
+        dir_ = std::filesystem::temp_directory_path() /
+               ("query_journal_test_" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())));
+        std::filesystem::remove_all(dir_);
+        std::filesystem::create_directories(dir_);
+        options_.snapshot_path = (dir_ / "query_state.json").string();
+        options_.sync = false;
+    }
+    void TearDown() override { std::filesystem::remove_all(dir_); }
+};
+
+TEST_F(QueryJournalTest, ReplaysJournalAfterRestart) {
+    {
+        QueryJournal journal(options_);
+        EXPECT_TRUE(journal.Open().empty());
+        journal.Add("first", 1);
+        journal.Add("second", 2);
+        EXPECT_TRUE(journal.WaitCommitted(journal.Remove("first")));
+    }
+
+    QueryJournal journal(options_);
+    auto state = journal.Open();
+    ASSERT_EQ(state.size(), 1u);
+    EXPECT_EQ(state["second"], 2);
+}
+
+TEST_F(QueryJournalTest, IgnoresTornRecord) {
+    {
+        QueryJournal journal(options_);
+        journal.Open();
+        EXPECT_TRUE(journal.WaitCommitted(journal.Add("kept", 7)));
+    }
+    {
+        std::ofstream journal_file(options_.snapshot_path + ".journal", std::ios::app);
+        journal_file << "+\t8\tto";  // crash in the middle of a record
+    }
+
+    {
+        QueryJournal journal(options_);
+        auto state = journal.Open();
+        ASSERT_EQ(state.size(), 1u);
+        EXPECT_EQ(state["kept"], 7);
+        EXPECT_TRUE(journal.WaitCommitted(journal.Add("after", 9)));
+    }
+
+    QueryJournal journal(options_);
+    auto state = journal.Open();
+    EXPECT_EQ(state.size(), 2u);
+    EXPECT_EQ(state["after"], 9);
+}
+
+TEST_F(QueryJournalTest, CompactsIntoSnapshot) {
+    options_.compact_after = 10;
+    {
+        QueryJournal journal(options_);
+        journal.Open();
+        uint64_t last = 0;
+        for (int i = 1; i <= 25; ++i) {
+            last = journal.Add("id" + std::to_string(i), i);
+        }
+        EXPECT_TRUE(journal.WaitCommitted(last));
+    }
+    EXPECT_LT(std::filesystem::file_size(options_.snapshot_path + ".journal"), 25u * 8u);
+
+    QueryJournal journal(options_);
+    auto state = journal.Open();
+    EXPECT_EQ(state.size(), 25u);
+    EXPECT_EQ(state["id25"], 25);
+}
+
+TEST_F(QueryJournalTest, ConcurrentWritersAreAllCommitted) {
+    {
+        QueryJournal journal(options_);
+        journal.Open();
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 8; ++t) {
+            writers.emplace_back([&journal, t]() {
+                for (int i = 0; i < 100; ++i) {
+                    int query = t * 100 + i;
+                    EXPECT_TRUE(journal.WaitCommitted(journal.Add("id" + std::to_string(query), query)));
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+    }
+
+    QueryJournal journal(options_);
+    EXPECT_EQ(journal.Open().size(), 800u);
+}
+
+#if !defined(_WIN32)
+TEST_F(QueryJournalTest, FailedCommitOnlyFailsItsRecords) {
+    options_.sync = true;
+    {
+        QueryJournal journal(options_);
+        journal.Open();
+        EXPECT_TRUE(journal.WaitCommitted(journal.Add("before", 1)));
+        {
+            FileSizeLimit limit(64);  // neither the journal nor a snapshot can take the long ID
+            EXPECT_FALSE(journal.WaitCommitted(journal.Add(std::string(200, 'x'), 2)));
+        }
+        // The journal may end in a torn record; the next commit starts over from a snapshot.
+        EXPECT_TRUE(journal.WaitCommitted(journal.Add("after", 3)));
+        EXPECT_TRUE(journal.WaitCommitted(journal.Add("later", 4)));
+    }
+
+    QueryJournal journal(options_);
+    auto state = journal.Open();
+    EXPECT_EQ(state["before"], 1);
+    EXPECT_EQ(state["after"], 3);
+    EXPECT_EQ(state["later"], 4);
+}
+#endif
@@ -0,0 +1,218 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "query_registry.h"
+#include "shared_query_store.h"
+
+namespace {
+
+// SharedQueryStore of replicas living in one process.
+class MemoryQueryStore : public SharedQueryStore {
+  public:
+    bool Reserve(int count, int& first) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        first = next_;
+        next_ += count;
+        return true;
+    }
+    bool Put(int query, const std::string& id) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pairs_[query] = {id, ++revision_};
+        return true;
+    }
+    std::string Get(int query, uint64_t since) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++gets_;
+        auto it = pairs_.find(query);
+        return it != pairs_.end() && it->second.second > since ? it->second.first : std::string();
+    }
+    void Remove(int query) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pairs_.erase(query);
+    }
+    // Replicas asking within a second of each other saw the same startup.
+    uint64_t StartupCheckpoint() override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto now = std::chrono::steady_clock::now();
+        if (startup_ == 0 || now - startup_marked_ >= std::chrono::seconds(1)) {
+            startup_ = ++revision_;
+            startup_marked_ = now;
+        }
+        return startup_;
+    }
+
+    int gets() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return gets_;
+    }
+
+  private:
+    std::mutex mutex_;
+    int next_ = 1;
+    uint64_t revision_ = 0;
+    uint64_t startup_ = 0;
+    std::chrono::steady_clock::time_point startup_marked_;
+    int gets_ = 0;
+    std::map<int, std::pair<std::string, uint64_t>> pairs_;  // query -> ID, revision
+};
+
+}  // namespace
+
+TEST(QueryRegistryTest, LooksUpBothWays) {
+    QueryRegistry queries;
+    int first = queries.Register("first");
+    int second = queries.Register("second");
+
+    EXPECT_EQ(first, 1);
+    EXPECT_EQ(second, 2);
+    EXPECT_EQ(queries.FindId(second), "second");
+    EXPECT_EQ(queries.FindQuery("first"), first);
+    EXPECT_EQ(queries.FindId(3), "");
+    EXPECT_EQ(queries.FindQuery("unknown"), 0);
+}
+
+TEST(QueryRegistryTest, ForgetDropsBothDirections) {
+    QueryRegistry queries;
+    int query = queries.Register("failed");
+    queries.Forget("failed");
+
+    EXPECT_EQ(queries.FindId(query), "");
+    EXPECT_EQ(queries.FindQuery("failed"), 0);
+    EXPECT_EQ(queries.persisted_size(), 0u);
+}
+
+TEST(QueryRegistryTest, MathCoreRestartResetsNumbering) {
+    QueryRegistry queries;
+    queries.Register("before");
+    queries.ResetActive();
+
+    EXPECT_EQ(queries.FindId(1), "");
+    EXPECT_EQ(queries.Register("after"), 1);
+    EXPECT_EQ(queries.FindId(1), "after");
+    EXPECT_EQ(queries.persisted_size(), 2u);  // "before" still waits for its result
+}
+
+TEST(QueryRegistryTest, PersistsUncompletedPairs) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "query_registry_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    QueryJournalOptions options;
+    options.snapshot_path = (dir / "query_state.json").string();
+    options.sync = false;
+
+    {
+        QueryJournal journal(options);
+        QueryRegistry queries;
+        queries.Open(journal);
+        queries.Register("delivered");
+        queries.Register("pending");
+        queries.Complete("delivered");
+        queries.Close();
+    }
+
+    QueryJournal journal(options);
+    QueryRegistry queries;
+    queries.Open(journal);
+    EXPECT_EQ(queries.FindQuery("pending"), 2);
+    EXPECT_EQ(queries.FindQuery("delivered"), 0);
+    EXPECT_EQ(queries.Register("next"), 3);
+    queries.Close();
+
+    std::filesystem::remove_all(dir);
+}
+
+TEST(QueryRegistryTest, ConcurrentRegistrationsGetUniqueNumbers) {
+    QueryRegistry queries;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&queries, t]() {
+            for (int i = 0; i < 500; ++i) {
+                std::string id = std::to_string(t) + "_" + std::to_string(i);
+                int query = queries.Register(id);
+                EXPECT_EQ(queries.FindId(query), id);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(queries.active_size(), 4000u);
+    for (int query = 1; query <= 4000; ++query) {
+        EXPECT_NE(queries.FindId(query), "");
+    }
+}
+
+TEST(QueryRegistryTest, ReplicasShareQueryNumbers) {
+    MemoryQueryStore store;
+    QueryRegistry first;
+    QueryRegistry second;
+    first.Share(store, 10);
+    second.Share(store, 10);
+
+    int a = first.Register("a");
+    int b = second.Register("b");
+    int c = first.Register("c");
+    EXPECT_EQ(a, 1);
+    EXPECT_EQ(b, 11);  // the second replica got the next block
+    EXPECT_EQ(c, 2);
+
+    // Each replica finds the other's jobs through the store.
+    EXPECT_EQ(second.FindId(a), "a");
+    EXPECT_EQ(first.FindId(b), "b");
+    EXPECT_EQ(first.FindId(50), "");
+
+    second.Forget("b");
+    EXPECT_EQ(store.Get(b, 0), "");
+    first.ResetActive();
+    EXPECT_EQ(first.Register("d"), 3);  // numbers aren't reused after a MathCore restart
+    EXPECT_EQ(first.FindId(c), "");     // issued before the restart
+    EXPECT_EQ(second.FindId(3), "d");
+}
+
+TEST(QueryRegistryTest, ReplicasAgreeOnStartup) {
+    MemoryQueryStore store;
+    QueryRegistry first;
+    QueryRegistry second;
+    first.Share(store, 10);
+    second.Share(store, 10);
+    int old_job = first.Register("old");
+
+    // The second replica gets the startup heartbeat after the first has already taken a job for the new MathCore.
+    first.ResetActive();
+    int new_job = first.Register("new");
+    second.ResetActive();
+
+    EXPECT_EQ(second.FindId(new_job), "new");
+    EXPECT_EQ(second.FindId(old_job), "");
+}
+
+TEST(QueryRegistryTest, UnknownNumbersAreLookedUpOnce) {
+    MemoryQueryStore store;
+    QueryRegistry first;
+    QueryRegistry second;
+    first.Share(store, 10);
+    second.Share(store, 10);
+
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(first.FindId(42), "");
+    }
+    EXPECT_EQ(store.gets(), 1);
+
+    // A miss is only believed briefly: the number may be issued by another replica meanwhile.
+    EXPECT_EQ(first.FindId(1), "");
+    int query = second.Register("late");
+    ASSERT_EQ(query, 1);
+    EXPECT_EQ(first.FindId(query), "");
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    EXPECT_EQ(first.FindId(query), "late");
+}
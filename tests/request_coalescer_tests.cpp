@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "request_coalescer.h"
+
+TEST(RequestCoalescerTest, FollowersShareTheLeadersResponse) {
+    RequestCoalescer coalescer;
+    std::vector<std::string> answers;
+    auto waiter = [&answers](std::string_view body) { answers.emplace_back(body); };
+
+    EXPECT_TRUE(coalescer.Join("State.Request.a", waiter));
+    EXPECT_FALSE(coalescer.Join("State.Request.a", waiter));
+    EXPECT_FALSE(coalescer.Join("State.Request.a", waiter));
+    EXPECT_TRUE(coalescer.Join("State.Request.b", waiter));
+    EXPECT_EQ(coalescer.in_flight(), 2u);
+    EXPECT_TRUE(answers.empty());
+
+    coalescer.Complete("State.Request.a", "{\"state\":1}", std::chrono::milliseconds(0));
+    EXPECT_EQ(answers, std::vector<std::string>(3, "{\"state\":1}"));
+    EXPECT_EQ(coalescer.in_flight(), 1u);
+    EXPECT_EQ(coalescer.coalesced(), 2u);
+
+    // the flight is over and nothing was cached: the next request asks again
+    EXPECT_TRUE(coalescer.Join("State.Request.a", waiter));
+}
+
+TEST(RequestCoalescerTest, CachedBodyAnswersRightAway) {
+    RequestCoalescer coalescer;
+    std::vector<std::string> answers;
+    auto waiter = [&answers](std::string_view body) { answers.emplace_back(body); };
+
+    EXPECT_TRUE(coalescer.Join("LogsList.Request", waiter));
+    coalescer.Complete("LogsList.Request", "[1,2]", std::chrono::milliseconds(60000));
+    EXPECT_FALSE(coalescer.Join("LogsList.Request", waiter));
+    EXPECT_EQ(answers, std::vector<std::string>(2, "[1,2]"));
+}
+
+TEST(RequestCoalescerTest, CachedBodyExpires) {
+    RequestCoalescer coalescer;
+    auto waiter = [](std::string_view) {};
+
+    EXPECT_TRUE(coalescer.Join("LogsList.Request", waiter));
+    coalescer.Complete("LogsList.Request", "[]", std::chrono::milliseconds(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_TRUE(coalescer.Join("LogsList.Request", waiter));
+}
+
+TEST(RequestCoalescerTest, ConcurrentJoinsHaveOneLeader) {
+    RequestCoalescer coalescer;
+    constexpr int kThreads = 8;
+    std::atomic<int> leaders{0};
+    std::atomic<int> answered{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&]() {
+            if (coalescer.Join("key", [&answered](std::string_view) { ++answered; })) {
+                ++leaders;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(leaders.load(), 1);
+
+    coalescer.Complete("key", "body", std::chrono::milliseconds(0));
+    EXPECT_EQ(answered.load(), kThreads);
+}
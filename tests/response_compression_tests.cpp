@@ -0,0 +1,54 @@
+#include <gtest/gtest.h>
+
+#include <Poco/InflatingStream.h>
+
+#include <sstream>
+#include <string>
+
+#include "response_compression.h"
+
+namespace {
+
+std::string Inflate(const std::string& compressed, Poco::InflatingStreamBuf::StreamType type) {
+    std::istringstream source(compressed);
+    Poco::InflatingInputStream inflater(source, type);
+    std::ostringstream result;
+    result << inflater.rdbuf();
+    return result.str();
+}
+
+}  // namespace
+
+TEST(ResponseCompressionTest, NegotiatesByQValue) {
+    EXPECT_EQ(NegotiateEncoding(""), ContentEncoding::Identity);
+    EXPECT_EQ(NegotiateEncoding("identity"), ContentEncoding::Identity);
+    EXPECT_EQ(NegotiateEncoding("gzip, deflate, br"), ContentEncoding::Gzip);
+    EXPECT_EQ(NegotiateEncoding("deflate"), ContentEncoding::Deflate);
+    EXPECT_EQ(NegotiateEncoding("gzip;q=0.5, deflate;q=0.8"), ContentEncoding::Deflate);
+    EXPECT_EQ(NegotiateEncoding("GZIP;Q=0"), ContentEncoding::Identity);
+    EXPECT_EQ(NegotiateEncoding("*"), ContentEncoding::Gzip);
+    EXPECT_EQ(NegotiateEncoding("gzip;q=0, *;q=0.3"), ContentEncoding::Deflate);
+}
+
+TEST(ResponseCompressionTest, CompressRoundTrip) {
+    std::string body = "{\"solutions\":[";
+    for (int i = 0; i < 1000; ++i) {
+        body += std::to_string(i * 0.25) + ",";
+    }
+    body += "0]}";
+
+    std::string gzip = Compress(body, ContentEncoding::Gzip, 6);
+    EXPECT_LT(gzip.size(), body.size());
+    EXPECT_EQ(Inflate(gzip, Poco::InflatingStreamBuf::STREAM_GZIP), body);
+
+    std::string deflate = Compress(body, ContentEncoding::Deflate, 1);
+    EXPECT_EQ(Inflate(deflate, Poco::InflatingStreamBuf::STREAM_ZLIB), body);
+}
+
+TEST(ResponseCompressionTest, StreamPiecesFormOneBody) {
+    StreamCompressor compressor(ContentEncoding::Gzip, 6);
+    std::string compressed = compressor.Compress("[\"first\",");
+    compressed += compressor.Compress("\"second\"]");
+    compressed += compressor.Finish();
+    EXPECT_EQ(Inflate(compressed, Poco::InflatingStreamBuf::STREAM_GZIP), "[\"first\",\"second\"]");
+}
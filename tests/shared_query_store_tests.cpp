@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iterator>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nats_manager.h"
+#include "query_registry.h"
+#include "shared_query_store.h"
+#include "std_err_capture.h"
+
+// Needs a NATS server with JetStream enabled on localhost:4222 (nats-server -js).
+class SharedQueryStoreIntegrationTest : public ::testing::Test {
+  protected:
+    StderrCapture stderr_capture_;
+    NatsManager nats_;
+    JetStreamQueryStore store_;
+    SharedQueryOptions options_;
+    std::string server_url = "nats://localhost:4222";
+
+    void SetUp() override {
+        options_.bucket = "nats_connector_test";
+        options_.ttl = std::chrono::seconds(3600);
+        ASSERT_TRUE(nats_.Connect(server_url)) << "Failed to connect to NATS. Stderr:\n" << stderr_capture_.Output();
+        ASSERT_TRUE(store_.Open(nats_.get_connection(), options_))
+            << "Failed to open the bucket (is JetStream enabled?). Stderr:\n"
+            << stderr_capture_.Output();
+    }
+    void TearDown() override { store_.Close(); }
+};
+
+TEST_F(SharedQueryStoreIntegrationTest, PutGetRemove) {
+    ASSERT_TRUE(store_.Put(7, "20250808_120000_000_000_00001"));
+    EXPECT_EQ(store_.Get(7, 0), "20250808_120000_000_000_00001");
+    EXPECT_EQ(store_.Get(8, 0), "");
+    store_.Remove(7);
+    EXPECT_EQ(store_.Get(7, 0), "");
+}
+
+TEST_F(SharedQueryStoreIntegrationTest, GetSkipsPairsBeforeStartup) {
+    ASSERT_TRUE(store_.Put(7, "20250808_120000_000_000_00005"));
+    const uint64_t checkpoint = store_.StartupCheckpoint();
+    ASSERT_NE(checkpoint, 0u);
+    ASSERT_TRUE(store_.Put(8, "20250808_120000_000_000_00006"));
+    // Another replica seeing the same startup a moment later.
+    EXPECT_EQ(store_.StartupCheckpoint(), checkpoint);
+
+    EXPECT_EQ(store_.Get(7, checkpoint), "");
+    EXPECT_EQ(store_.Get(8, checkpoint), "20250808_120000_000_000_00006");
+    store_.Remove(7);
+    store_.Remove(8);
+}
+
+TEST_F(SharedQueryStoreIntegrationTest, ConcurrentReservationsDontOverlap) {
+    constexpr int kBlock = 10;
+    std::vector<std::vector<int>> firsts(4);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < firsts.size(); ++t) {
+        threads.emplace_back([this, &firsts, t]() {
+            // Every thread plays a replica with its own connection to the bucket.
+            NatsManager nats;
+            JetStreamQueryStore store;
+            ASSERT_TRUE(nats.Connect(server_url));
+            ASSERT_TRUE(store.Open(nats.get_connection(), options_));
+            for (int i = 0; i < 5; ++i) {
+                int first = 0;
+                ASSERT_TRUE(store.Reserve(kBlock, first));
+                firsts[t].push_back(first);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::set<int> blocks;
+    for (const auto& replica : firsts) {
+        blocks.insert(replica.begin(), replica.end());
+    }
+    ASSERT_EQ(blocks.size(), 20u);
+    for (auto it = std::next(blocks.begin()); it != blocks.end(); ++it) {
+        EXPECT_GE(*it - *std::prev(it), kBlock) << "blocks at " << *std::prev(it) << " and " << *it << " overlap";
+    }
+}
+
+TEST_F(SharedQueryStoreIntegrationTest, NumbersDontGoBackAfterPairsExpire) {
+    SharedQueryOptions expiring = options_;
+    expiring.bucket = "nats_connector_ttl_test";
+    expiring.ttl = std::chrono::seconds(1);
+    JetStreamQueryStore store;
+    ASSERT_TRUE(store.Open(nats_.get_connection(), expiring));
+
+    int first = 0;
+    ASSERT_TRUE(store.Reserve(10, first));
+    ASSERT_TRUE(store.Put(first, "20250808_120000_000_000_00004"));
+    // No replica reserves anything for longer than the TTL.
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+    EXPECT_EQ(store.Get(first, 0), "");
+
+    int next = 0;
+    ASSERT_TRUE(store.Reserve(10, next));
+    EXPECT_GE(next, first + 10);
+}
+
+TEST_F(SharedQueryStoreIntegrationTest, ReplicaFindsQueriesOfAnother) {
+    QueryRegistry first;
+    QueryRegistry second;
+    first.Share(store_, 100);
+    second.Share(store_, 100);
+
+    int query = first.Register("20250808_120000_000_000_00002");
+    ASSERT_NE(query, 0);
+    EXPECT_NE(second.Register("20250808_120000_000_000_00003"), query);
+    EXPECT_EQ(second.FindId(query), "20250808_120000_000_000_00002");
+    first.Close();
+    second.Close();
+}
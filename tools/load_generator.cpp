@@ -0,0 +1,220 @@
+// Load generator: drives a running connector over HTTP with a mix of /start, /state and /getlog requests from
+// `concurrency` keep-alive clients, then reports throughput, errors and latency percentiles per endpoint.
+// Run it against a connector talking to MathCore (or to mathcore-sim) through a local nats-server.
+//
+// Usage: nats-connector-load [--host=localhost] [--port=9000] [--concurrency=16] [--duration_s=30]
+//                            [--start=1] [--state=8] [--getlog=1] [--body_bytes=256]
+// --start/--state/--getlog are relative weights of the request mix.
+
+#include <Poco/Exception.h>
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/StreamCopier.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "metrics.h"
+#include "nlohmann/json.hpp"
+#include "tool_options.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadOptions {
+    std::string host = "localhost";
+    int port = 9000;
+    int concurrency = 16;
+    std::chrono::seconds duration{30};
+    int start_weight = 1;
+    int state_weight = 8;
+    int getlog_weight = 1;
+    std::size_t body_bytes = 256;  // size of the job sent with /start
+};
+
+// Results of one endpoint, shared by all clients.
+struct EndpointStats {
+    explicit EndpointStats(const char* endpoint) : name(endpoint) {}
+
+    const char* name;
+    metrics::Histogram latency;
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> errors{0};
+};
+
+struct LoadStats {
+    EndpointStats start{"start"};
+    EndpointStats state{"state"};
+    EndpointStats getlog{"getlog"};
+};
+
+// True if a connector response reports a failure (transport and HTTP errors are counted separately).
+bool IsErrorResponse(const std::string& body) {
+    nlohmann::json response = nlohmann::json::parse(body, nullptr, false);
+    if (response.is_discarded()) {
+        return true;
+    }
+    if (!response.is_object()) {
+        return false;  // /logslist and friends may answer with arrays
+    }
+    if (response.contains("error")) {
+        return true;
+    }
+    const nlohmann::json& status = response.contains("state") ? response["state"] : response;
+    return status.is_object() && status.contains("status") && status["status"] == 0;
+}
+
+class LoadClient {
+  public:
+    LoadClient(const LoadOptions& options, int index, LoadStats& stats) :
+        options_(options),
+        session_(options.host, static_cast<Poco::UInt16>(options.port)),
+        random_(static_cast<std::mt19937::result_type>(index)),
+        stats_(stats) {
+        session_.setKeepAlive(true);
+        session_.setTimeout(Poco::Timespan(60, 0));
+        job_ = nlohmann::json({{"job", std::string(options.body_bytes, 'j')}}).dump();
+    }
+
+    void Run(Clock::time_point until) {
+        const int total = options_.start_weight + options_.state_weight + options_.getlog_weight;
+        std::uniform_int_distribution<int> pick(0, total > 0 ? total - 1 : 0);
+        while (Clock::now() < until) {
+            int roll = pick(random_);
+            if (jobs_.empty() || roll < options_.start_weight) {
+                Start();
+            } else if (roll < options_.start_weight + options_.state_weight) {
+                const auto& job = jobs_[std::uniform_int_distribution<std::size_t>(0, jobs_.size() - 1)(random_)];
+                Get(stats_.state, "/state?num=" + std::to_string(job.first));
+            } else {
+                const auto& job = jobs_[std::uniform_int_distribution<std::size_t>(0, jobs_.size() - 1)(random_)];
+                Get(stats_.getlog, "/getlog?id=" + job.second);
+            }
+        }
+    }
+
+  private:
+    static constexpr std::size_t kMaxKnownJobs = 1000;
+
+    void Start() {
+        std::string body;
+        if (!Send(stats_.start, Poco::Net::HTTPRequest::HTTP_POST, "/start", job_, body)) {
+            return;
+        }
+        nlohmann::json response = nlohmann::json::parse(body, nullptr, false);
+        if (response.is_object() && response.contains("query") && response.contains("globalID")) {
+            if (jobs_.size() >= kMaxKnownJobs) {
+                jobs_.erase(jobs_.begin());
+            }
+            jobs_.emplace_back(response["query"].get<int>(), response["globalID"].get<std::string>());
+        }
+    }
+
+    void Get(EndpointStats& stats, const std::string& path) {
+        std::string body;
+        Send(stats, Poco::Net::HTTPRequest::HTTP_GET, path, "", body);
+    }
+
+    bool Send(EndpointStats& stats,
+              const std::string& method,
+              const std::string& path,
+              const std::string& payload,
+              std::string& body) {
+        const Clock::time_point sent = Clock::now();
+        bool ok = false;
+        try {
+            Poco::Net::HTTPRequest request(method, path, Poco::Net::HTTPMessage::HTTP_1_1);
+            request.setKeepAlive(true);
+            if (!payload.empty()) {
+                request.setContentType("application/json");
+                request.setContentLength(static_cast<std::streamsize>(payload.size()));
+            }
+            session_.sendRequest(request) << payload;
+            Poco::Net::HTTPResponse response;
+            std::istream& stream = session_.receiveResponse(response);
+            Poco::StreamCopier::copyToString(stream, body);
+            ok = response.getStatus() == Poco::Net::HTTPResponse::HTTP_OK && !IsErrorResponse(body);
+        } catch (const Poco::Exception&) {
+            session_.reset();
+        }
+        stats.latency.RecordSince(sent);
+        ++stats.requests;
+        if (!ok) {
+            ++stats.errors;
+        }
+        return ok;
+    }
+
+    const LoadOptions& options_;
+    Poco::Net::HTTPClientSession session_;
+    std::mt19937 random_;
+    LoadStats& stats_;
+    std::string job_;
+    std::vector<std::pair<int, std::string>> jobs_;  // query number and ID of jobs this client started
+};
+
+void PrintReport(const LoadStats& stats, std::chrono::duration<double> elapsed) {
+    std::printf("%-8s %10s %8s %10s %10s %10s %10s %10s\n", "endpoint", "requests", "errors", "req/s", "p50 ms",
+                "p90 ms", "p99 ms", "p99.9 ms");
+    for (const EndpointStats* endpoint_stats : {&stats.start, &stats.state, &stats.getlog}) {
+        const EndpointStats& endpoint = *endpoint_stats;
+        const metrics::Histogram::Snapshot latency = endpoint.latency.Collect();
+        const uint64_t requests = endpoint.requests.load();
+        std::printf("%-8s %10llu %8llu %10.1f %10.2f %10.2f %10.2f %10.2f\n",
+                    endpoint.name,
+                    static_cast<unsigned long long>(requests),
+                    static_cast<unsigned long long>(endpoint.errors.load()),
+                    static_cast<double>(requests) / elapsed.count(),
+                    static_cast<double>(latency.ValueAt(0.5)) / 1000.0,
+                    static_cast<double>(latency.ValueAt(0.9)) / 1000.0,
+                    static_cast<double>(latency.ValueAt(0.99)) / 1000.0,
+                    static_cast<double>(latency.ValueAt(0.999)) / 1000.0);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ToolOptions args;
+    if (!args.Parse(argc, argv)) {
+        return 2;
+    }
+    LoadOptions options;
+    options.host = args.GetString("host", options.host);
+    options.port = static_cast<int>(args.GetInt("port", options.port));
+    options.concurrency = static_cast<int>(args.GetInt("concurrency", options.concurrency));
+    options.duration = std::chrono::seconds(args.GetInt("duration_s", options.duration.count()));
+    options.start_weight = static_cast<int>(args.GetInt("start", options.start_weight));
+    options.state_weight = static_cast<int>(args.GetInt("state", options.state_weight));
+    options.getlog_weight = static_cast<int>(args.GetInt("getlog", options.getlog_weight));
+    options.body_bytes =
+        static_cast<std::size_t>(args.GetInt("body_bytes", static_cast<long long>(options.body_bytes)));
+
+    LoadStats stats;
+
+    std::cout << "Running " << options.concurrency << " clients against " << options.host << ":" << options.port
+              << " for " << options.duration.count() << "s" << std::endl;
+    const Clock::time_point started = Clock::now();
+    const Clock::time_point until = started + options.duration;
+    std::vector<std::thread> clients;
+    for (int i = 0; i < options.concurrency; ++i) {
+        clients.emplace_back([&options, &stats, i, until]() {
+            LoadClient client(options, i, stats);
+            client.Run(until);
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    PrintReport(stats, Clock::now() - started);
+    return 0;
+}
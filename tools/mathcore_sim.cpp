@@ -0,0 +1,295 @@
+// MathCore simulator: answers the connector's NATS subjects the way MathCore does, so the connector can be
+// driven end to end without the real solver.
+//
+//   Start.<ID>             a job; it "computes" for compute_ms (+- jitter_ms) and then has a result
+//   State.Request.<ID>     replies CALCULATING while computing, the result afterwards, an error for unknown IDs
+//   LogsList.Request       replies the IDs of finished jobs
+//   GetLog.Request.<ID>    replies the job's log; logs above chunk_bytes are streamed with Chunk-Seq/Chunk-Last
+//   IsMathAlive.<instance> heartbeats, a "startup" event first and after every simulated restart; "load" is the
+//                          number of jobs still computing
+// Start, State.Request and GetLog.Request are also answered as <subject>.<instance>.<ID>, the subjects of a
+// connector routing jobs over several instances (mathcore.routing).
+//
+// Usage: mathcore-sim [--nats=nats://localhost:4222] [--instance=sim] [--compute_ms=2000] [--jitter_ms=500]
+//                     [--solutions=10] [--solution_bytes=64] [--log_bytes=65536] [--chunk_bytes=16384]
+//                     [--heartbeat_ms=1000] [--restart_every_s=0] [--restart_downtime_s=5] [--run_for_s=0]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "logger.h"
+#include "nats_manager.h"
+#include "tool_options.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::atomic<bool> g_stop{false};
+
+void OnSignal(int) { g_stop.store(true); }
+
+struct SimOptions {
+    std::string nats_url = "nats://localhost:4222";
+    std::string instance = "sim";
+    std::chrono::milliseconds compute{2000};
+    std::chrono::milliseconds jitter{500};
+    std::size_t solutions = 10;           // entries in a finished job's state
+    std::size_t solution_bytes = 64;      // filler per solution
+    std::size_t log_bytes = 64 * 1024;    // size of every job's log
+    std::size_t chunk_bytes = 16 * 1024;  // GetLog replies above this are streamed, 0 - never
+    std::chrono::milliseconds heartbeat{1000};
+    std::chrono::milliseconds restart_every{0};  // 0 - never restarts
+    std::chrono::milliseconds restart_downtime{5000};
+    std::chrono::milliseconds run_for{0};  // 0 - until SIGINT/SIGTERM
+};
+
+class MathCoreSimulator {
+  public:
+    explicit MathCoreSimulator(const SimOptions& options) : options_(options), random_(std::random_device{}()) {}
+
+    bool Start() {
+        if (!nats_.Connect(options_.nats_url)) {
+            return false;
+        }
+        const std::string own = "." + options_.instance + ".*";
+        bool subscribed =
+            nats_.SubscribeRaw("Start.*", [this](NatsMessage& message) { OnStart(message); }) &&
+            nats_.SubscribeRaw("Start" + own, [this](NatsMessage& message) { OnStart(message); }) &&
+            nats_.SubscribeRaw("State.Request.*", [this](NatsMessage& message) { OnState(message); }) &&
+            nats_.SubscribeRaw("State.Request" + own, [this](NatsMessage& message) { OnState(message); }) &&
+            nats_.SubscribeRaw("LogsList.Request", [this](NatsMessage& message) { OnLogsList(message); }) &&
+            nats_.SubscribeRaw("GetLog.Request.*", [this](NatsMessage& message) { OnGetLog(message); }) &&
+            nats_.SubscribeRaw("GetLog.Request" + own, [this](NatsMessage& message) { OnGetLog(message); });
+        if (!subscribed) {
+            return false;
+        }
+        Heartbeat("startup");
+        return true;
+    }
+
+    // Heartbeats and scheduled restarts until stopped.
+    void Run() {
+        const Clock::time_point started = Clock::now();
+        Clock::time_point next_restart = started + options_.restart_every;
+        while (!g_stop.load()) {
+            const Clock::time_point now = Clock::now();
+            if (options_.run_for.count() > 0 && now - started >= options_.run_for) {
+                break;
+            }
+            if (options_.restart_every.count() > 0 && now >= next_restart) {
+                Restart();
+                next_restart = Clock::now() + options_.restart_every;
+                continue;
+            }
+            Heartbeat("alive");
+            std::this_thread::sleep_for(options_.heartbeat);
+        }
+        nats_.Disconnect();
+        std::cout << "Jobs started: " << started_.load() << ", state replies: " << state_replies_.load()
+                  << ", logs sent: " << logs_sent_.load() << std::endl;
+    }
+
+  private:
+    struct Job {
+        Clock::time_point done_at;
+    };
+
+    // The job ID is the last token of every job subject.
+    static std::string IdOf(const NatsMessage& message) {
+        std::string_view subject = message.Subject();
+        std::size_t dot = subject.rfind('.');
+        return std::string(dot == std::string_view::npos ? subject : subject.substr(dot + 1));
+    }
+
+    bool Down() const { return down_.load(std::memory_order_relaxed); }
+
+    void OnStart(NatsMessage& message) {
+        if (Down()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::uniform_int_distribution<long long> jitter(-options_.jitter.count(), options_.jitter.count());
+        auto compute = options_.compute + std::chrono::milliseconds(jitter(random_));
+        jobs_[IdOf(message)] = Job{Clock::now() + std::max(compute, std::chrono::milliseconds(0))};
+        ++started_;
+    }
+
+    void OnState(NatsMessage& message) {
+        if (Down()) {
+            return;
+        }
+        const std::string id = IdOf(message);
+        nlohmann::json reply;
+        bool known = false;
+        bool done = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = jobs_.find(id);
+            known = it != jobs_.end();
+            done = known && Clock::now() >= it->second.done_at;
+        }
+        if (!known) {
+            reply["error"] = "Unknown job " + id;
+        } else if (!done) {
+            reply["message"] = "CALCULATING";
+        } else {
+            reply["state"] = {{"globalID", id},
+                              {"status", 1},
+                              {"desc", "DONE"},
+                              {"solnumbs", options_.solutions},
+                              {"time", options_.compute.count()}};
+            reply["solutions"] = nlohmann::json::array();
+            for (std::size_t i = 0; i < options_.solutions; ++i) {
+                reply["solutions"].push_back({{"n", i}, {"value", std::string(options_.solution_bytes, 'x')}});
+            }
+        }
+        ++state_replies_;
+        Reply(message, reply.dump());
+    }
+
+    void OnLogsList(NatsMessage& message) {
+        if (Down()) {
+            return;
+        }
+        nlohmann::json logs = nlohmann::json::array();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const Clock::time_point now = Clock::now();
+            for (const auto& job : jobs_) {
+                if (now >= job.second.done_at) {
+                    logs.push_back(job.first);
+                }
+            }
+        }
+        Reply(message, logs.dump());
+    }
+
+    void OnGetLog(NatsMessage& message) {
+        if (Down()) {
+            return;
+        }
+        const std::string id = IdOf(message);
+        bool known = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            known = jobs_.count(id) != 0;
+        }
+        if (!known) {
+            Reply(message, nlohmann::json({{"error", "Unknown job " + id}}).dump());
+            return;
+        }
+
+        const std::string log = nlohmann::json({{"id", id}, {"log", std::string(options_.log_bytes, 'l')}}).dump();
+        ++logs_sent_;
+        if (options_.chunk_bytes == 0 || log.size() <= options_.chunk_bytes) {
+            Reply(message, log);
+            return;
+        }
+        std::size_t seq = 0;
+        for (std::size_t offset = 0; offset < log.size(); offset += options_.chunk_bytes, ++seq) {
+            std::string_view chunk = std::string_view(log).substr(offset, options_.chunk_bytes);
+            bool last = offset + options_.chunk_bytes >= log.size();
+            ReplyChunk(message, chunk, seq, last);
+        }
+    }
+
+    void Reply(const NatsMessage& request, std::string_view payload) { nats_.Respond(request, payload); }
+
+    void ReplyChunk(const NatsMessage& request, std::string_view chunk, std::size_t seq, bool last) {
+        Transport::Headers headers{{Transport::kChunkSeqHeader, std::to_string(seq)}};
+        if (last) {
+            headers.emplace_back(Transport::kChunkLastHeader, "true");
+        }
+        nats_.Respond(request, chunk, headers);
+    }
+
+    void Heartbeat(const char* event) {
+        if (Down()) {
+            return;
+        }
+        std::size_t computing = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const Clock::time_point now = Clock::now();
+            for (const auto& job : jobs_) {
+                if (now < job.second.done_at) {
+                    ++computing;
+                }
+            }
+        }
+        nats_.Publish("IsMathAlive." + options_.instance, {{"event", event}, {"load", computing}});
+    }
+
+    // Goes silent for the downtime, forgets every job and comes back with a startup heartbeat.
+    void Restart() {
+        std::cout << "Simulating MathCore restart" << std::endl;
+        down_.store(true);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.clear();
+        }
+        const Clock::time_point back_at = Clock::now() + options_.restart_downtime;
+        while (!g_stop.load() && Clock::now() < back_at) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        down_.store(false);
+        Heartbeat("startup");
+    }
+
+    const SimOptions options_;
+    NatsManager nats_;
+    std::mutex mutex_;
+    std::mt19937_64 random_;
+    std::unordered_map<std::string, Job> jobs_;
+    std::atomic<bool> down_{false};
+    std::atomic<uint64_t> started_{0};
+    std::atomic<uint64_t> state_replies_{0};
+    std::atomic<uint64_t> logs_sent_{0};
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ToolOptions args;
+    if (!args.Parse(argc, argv)) {
+        return 2;
+    }
+    SimOptions options;
+    options.nats_url = args.GetString("nats", options.nats_url);
+    options.instance = args.GetString("instance", options.instance);
+    options.compute = args.GetMillis("compute_ms", options.compute);
+    options.jitter = args.GetMillis("jitter_ms", options.jitter);
+    options.solutions = static_cast<std::size_t>(args.GetInt("solutions", static_cast<long long>(options.solutions)));
+    options.solution_bytes =
+        static_cast<std::size_t>(args.GetInt("solution_bytes", static_cast<long long>(options.solution_bytes)));
+    options.log_bytes = static_cast<std::size_t>(args.GetInt("log_bytes", static_cast<long long>(options.log_bytes)));
+    options.chunk_bytes =
+        static_cast<std::size_t>(args.GetInt("chunk_bytes", static_cast<long long>(options.chunk_bytes)));
+    options.heartbeat = args.GetMillis("heartbeat_ms", options.heartbeat);
+    options.restart_every = std::chrono::seconds(args.GetInt("restart_every_s", 0));
+    options.restart_downtime = std::chrono::seconds(args.GetInt("restart_downtime_s", 5));
+    options.run_for = std::chrono::seconds(args.GetInt("run_for_s", 0));
+
+    logger::SetLevel(logger::Level::Warn);
+    std::signal(SIGINT, OnSignal);
+    std::signal(SIGTERM, OnSignal);
+
+    MathCoreSimulator simulator(options);
+    if (!simulator.Start()) {
+        std::cerr << "Failed to connect to " << options.nats_url << std::endl;
+        return 1;
+    }
+    std::cout << "MathCore simulator '" << options.instance << "' connected to " << options.nats_url << std::endl;
+    simulator.Run();
+    return 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+
+// "--key=value" command line options of the bundled tools. "--key" alone means "true".
+class ToolOptions {
+  public:
+    // Returns false (after printing the offending argument) on anything that isn't an option.
+    bool Parse(int argc, char** argv) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0 || arg.size() < 3) {
+                std::cerr << "Unexpected argument: " << arg << std::endl;
+                return false;
+            }
+            std::size_t eq = arg.find('=');
+            if (eq == std::string::npos) {
+                values_[arg.substr(2)] = "true";
+            } else {
+                values_[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            }
+        }
+        return true;
+    }
+
+    bool Has(const std::string& key) const { return values_.count(key) != 0; }
+
+    std::string GetString(const std::string& key, const std::string& fallback) const {
+        auto it = values_.find(key);
+        return it == values_.end() ? fallback : it->second;
+    }
+
+    long long GetInt(const std::string& key, long long fallback) const {
+        auto it = values_.find(key);
+        return it == values_.end() ? fallback : std::strtoll(it->second.c_str(), nullptr, 10);
+    }
+
+    std::chrono::milliseconds GetMillis(const std::string& key, std::chrono::milliseconds fallback) const {
+        return std::chrono::milliseconds(GetInt(key, fallback.count()));
+    }
+
+  private:
+    std::map<std::string, std::string> values_;
+};